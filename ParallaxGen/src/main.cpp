@@ -13,26 +13,31 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 #include <boost/algorithm/string/join.hpp>
-#include <boost/filesystem/path.hpp>
-#include <boost/filesystem/operations.hpp>
 #include <boost/stacktrace/stacktrace.hpp>
 
 #include <windows.h>
+#include <shlobj.h>
 
 #include <chrono>
 #include <cstdlib>
 #include <exception>
 #include <filesystem>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "BethesdaGame.hpp"
 #include "ParallaxGen.hpp"
 #include "ParallaxGenConfig.hpp"
 #include "ParallaxGenD3D.hpp"
 #include "ParallaxGenDirectory.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
 #include "ParallaxGenPlugin.hpp"
+#include "ParallaxGenScheduler.hpp"
+#include "ParallaxGenTextureDB.hpp"
+#include "ParallaxGenUtil.hpp"
 #include "patchers/PatcherComplexMaterial.hpp"
 #include "patchers/PatcherTruePBR.hpp"
 #include "patchers/PatcherVanillaParallax.hpp"
@@ -49,8 +54,12 @@ struct ParallaxGenCLIArgs {
   filesystem::path OutputDir;
   bool Autostart = false;
   bool NoMultithread = false;
+  size_t Threads = 0; // 0 means one per core
+  size_t MemoryBudget = 0; // MiB, 0 means derived from physical memory
   bool HighMem = false;
+  bool LowMem = false;
   bool NoGPU = false;
+  bool NoTextureDB = false;
   bool NoBSA = false;
   bool UpgradeShaders = false;
   bool OptimizeMeshes = false;
@@ -58,9 +67,18 @@ struct ParallaxGenCLIArgs {
   bool NoPlugin = false;
   bool NoZip = false;
   bool NoCleanup = false;
+  bool CompressZip = false;
+  bool Incremental = false;
+  bool Resume = false;
+  bool Journal = false;
+  string Shard;
+  size_t ShardIndex = 0; // parsed from Shard, 0 based
+  size_t ShardCount = 1;
+  vector<filesystem::path> MergeShards;
   bool NoDefaultConfig = false;
   bool IgnoreParallax = false;
   bool IgnoreComplexMaterial = false;
+  bool ValidateCMDetection = false;
   bool IgnoreTruePBR = false;
   bool DisableMLP = false;
 
@@ -72,8 +90,12 @@ struct ParallaxGenCLIArgs {
     OutStr += "OutputDir: " + OutputDir.string() + "\n";
     OutStr += "Autostart: " + to_string(static_cast<int>(Autostart)) + "\n";
     OutStr += "NoMultithread: " + to_string(static_cast<int>(NoMultithread)) + "\n";
+    OutStr += "Threads: " + to_string(Threads) + "\n";
+    OutStr += "MemoryBudget: " + to_string(MemoryBudget) + "\n";
     OutStr += "HighMem: " + to_string(static_cast<int>(HighMem)) + "\n";
+    OutStr += "LowMem: " + to_string(static_cast<int>(LowMem)) + "\n";
     OutStr += "NoGPU: " + to_string(static_cast<int>(NoGPU)) + "\n";
+    OutStr += "NoTextureDB: " + to_string(static_cast<int>(NoTextureDB)) + "\n";
     OutStr += "NoBSA: " + to_string(static_cast<int>(NoBSA)) + "\n";
     OutStr += "UpgradeShaders: " + to_string(static_cast<int>(UpgradeShaders)) + "\n";
     OutStr += "OptimizeMeshes: " + to_string(static_cast<int>(OptimizeMeshes)) + "\n";
@@ -81,14 +103,34 @@ struct ParallaxGenCLIArgs {
     OutStr += "NoPlugin: " + to_string(static_cast<int>(NoPlugin)) + "\n";
     OutStr += "NoZip: " + to_string(static_cast<int>(NoZip)) + "\n";
     OutStr += "NoCleanup: " + to_string(static_cast<int>(NoCleanup)) + "\n";
+    OutStr += "CompressZip: " + to_string(static_cast<int>(CompressZip)) + "\n";
+    OutStr += "Incremental: " + to_string(static_cast<int>(Incremental)) + "\n";
+    OutStr += "Resume: " + to_string(static_cast<int>(Resume)) + "\n";
+    OutStr += "Journal: " + to_string(static_cast<int>(Journal)) + "\n";
+    OutStr += "Shard: " + Shard + "\n";
+    OutStr += "MergeShards: " + to_string(MergeShards.size()) + "\n";
     OutStr += "NoDefaultConfig: " + to_string(static_cast<int>(NoDefaultConfig)) + "\n";
     OutStr += "IgnoreParallax: " + to_string(static_cast<int>(IgnoreParallax)) + "\n";
     OutStr += "IgnoreComplexMaterial: " + to_string(static_cast<int>(IgnoreComplexMaterial)) + "\n";
+    OutStr += "ValidateCMDetection: " + to_string(static_cast<int>(ValidateCMDetection)) + "\n";
     OutStr += "IgnoreTruePBR: " + to_string(static_cast<int>(IgnoreTruePBR)) + "\n";
     OutStr += "DisableMLP: " + to_string(static_cast<int>(DisableMLP));
 
     return OutStr;
   }
+
+  // Settings outside of ParallaxGen's own flags that can change a patched mesh, incremental runs only reuse results
+  // produced with the same values
+  [[nodiscard]] auto getIncrementalSettings() const -> string {
+    string OutStr;
+    OutStr += string("Version: ") + PARALLAXGEN_VERSION + "\n";
+    OutStr += "GameType: " + GameType + "\n";
+    OutStr += "UpgradeShaders: " + to_string(static_cast<int>(UpgradeShaders)) + "\n";
+    OutStr += "NoGPU: " + to_string(static_cast<int>(NoGPU)) + "\n";
+    OutStr += "DisableMLP: " + to_string(static_cast<int>(DisableMLP));
+
+    return OutStr;
+  }
 };
 
 // Store game type strings and their corresponding BethesdaGame::GameType enum
@@ -113,23 +155,32 @@ auto getGameTypeMapStr() -> string {
   return GameTypeStr;
 }
 
-auto deployDynamicCubemapFile(ParallaxGenDirectory *PGD, const filesystem::path &OutputDir,
-                              const filesystem::path &ExePath) -> void {
+auto deployDynamicCubemapFile(ParallaxGenDirectory *PGD, ParallaxGen *PG, const filesystem::path &ExePath) -> void {
   // Install default cubemap file if needed
   static const filesystem::path DynCubeMapPath = "textures/cubemaps/dynamic1pxcubemap_black.dds";
   if (!PGD->isFile(DynCubeMapPath)) {
     spdlog::info("Installing default dynamic cubemap file");
 
-    // Create Directory
-    const filesystem::path OutputCubemapPath = OutputDir / DynCubeMapPath.parent_path();
-    filesystem::create_directories(OutputCubemapPath);
+    const filesystem::path AssetPath = ExePath / "assets/dynamic1pxcubemap_black_ENB.dds";
+    auto AssetBytes = ParallaxGenUtil::getFileBytes(AssetPath);
+    if (AssetBytes.empty()) {
+      spdlog::error(L"Unable to read default dynamic cubemap file: {}", AssetPath.wstring());
+      return;
+    }
 
-    boost::filesystem::path AssetPath = boost::filesystem::path(ExePath) / "assets/dynamic1pxcubemap_black_ENB.dds";
-    boost::filesystem::path OutputPath = boost::filesystem::path(OutputDir) / DynCubeMapPath;
+    PG->addFileToOutput(DynCubeMapPath, std::move(AssetBytes));
+  }
+}
 
-    // Move File
-    boost::filesystem::copy_file(AssetPath, OutputPath, boost::filesystem::copy_options::overwrite_existing);
+// The texture database has to outlive the output folder, which is cleared every run, and the install folder may be
+// read only. The output folder is only used when local app data can't be found, the database then lasts one run
+auto getTextureDBPath(const filesystem::path &OutputDir) -> filesystem::path {
+  const auto AppDataPath = BethesdaGame::getSystemPath(FOLDERID_LocalAppData);
+  if (AppDataPath.empty()) {
+    return OutputDir / ParallaxGenTextureDB::getDBName();
   }
+
+  return AppDataPath / "ParallaxGen" / ParallaxGenTextureDB::getDBName();
 }
 
 void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
@@ -148,6 +199,11 @@ void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
   // Print configuration parameters
   spdlog::debug("Configuration Parameters:\n\n{}\n", Args.getString());
 
+  // Every parallel stage shares one pool, it has to be sized before its first use
+  ParallaxGenScheduler::setNumThreads(Args.NoMultithread ? 1 : Args.Threads);
+  // Same for the memory budget
+  ParallaxGenMemoryGovernor::setBudget(Args.MemoryBudget * 1024 * 1024);
+
   // print output location
   spdlog::info(L"ParallaxGen output directory (the contents will be deleted if you "
                L"start generation!): {}",
@@ -169,6 +225,10 @@ void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
     PGD3D.initGPU();
   }
 
+  if (Args.ValidateCMDetection) {
+    PGD3D.enableCMValidation();
+  }
+
   //
   // Generation
   //
@@ -198,7 +258,35 @@ void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
   }
 
   // delete existing output
-  PG.deleteOutputDir();
+  PG.deleteOutputDir(Args.Incremental, Args.Resume);
+
+  // Generated files stream straight into the output zip (and loose files if they are kept)
+  PG.initOutput(!Args.NoZip, Args.NoCleanup, Args.CompressZip);
+
+  if (Args.Incremental) {
+    PG.initIncremental(Args.getIncrementalSettings());
+  }
+
+  // Finished meshes are journaled so the run can be resumed if it is interrupted. Runs that already keep a record of
+  // every mesh journal it for free, others only when asked since the records cost a texture stat per mesh
+  if (Args.Journal || Args.Incremental || Args.Resume || Args.ShardCount > 1) {
+    PG.initJournal(Args.getIncrementalSettings());
+  }
+
+  if (Args.Resume) {
+    PG.initResume();
+  }
+
+  if (Args.ShardCount > 1) {
+    PG.initShard(Args.ShardIndex, Args.ShardCount, Args.getIncrementalSettings());
+  }
+
+  if (!Args.MergeShards.empty()) {
+    PG.initMerge(Args.MergeShards);
+  }
+
+  // Shards only record plugin changes, the merge writes the plugin
+  const bool WritePlugin = !Args.NoPlugin && Args.ShardCount == 1;
 
   // Check if ParallaxGen output already exists in data directory
   const filesystem::path PGStateFilePath = BG.getGameDataPath() / ParallaxGen::getDiffJSONName();
@@ -209,13 +297,17 @@ void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
   }
 
   // Init PGP library
-  if (!Args.NoPlugin) {
+  if (WritePlugin) {
     spdlog::info("Initializing plugin patcher");
     ParallaxGenPlugin::initialize(BG);
     ParallaxGenPlugin::populateObjs();
   }
 
   // Populate file map from data directory
+  if (Args.LowMem) {
+    PGD.enableLowMemoryFileMap(filesystem::temp_directory_path() /
+                               ("ParallaxGen_FileMap_" + to_string(GetCurrentProcessId()) + ".bin"));
+  }
   PGD.populateFileMap(!Args.NoBSA);
 
   // Find relevant files
@@ -230,6 +322,11 @@ void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
   PGD.mapFiles(PGC.getNIFBlocklist(), PGC.getManualTextureMaps(), VanillaBSAList, !Args.NoMapFromMeshes, !Args.NoMultithread,
                Args.HighMem);
 
+  // Texture analysis of previous runs, needs the file map to tell which records are still current
+  if (!Args.NoTextureDB) {
+    PGD3D.loadTextureDB(getTextureDBPath(Args.OutputDir));
+  }
+
   spdlog::info("Finding complex material env maps");
   PGD3D.findCMMaps(VanillaBSAList);
   spdlog::info("Done finding complex material env maps");
@@ -252,30 +349,27 @@ void mainRunner(ParallaxGenCLIArgs &Args, const filesystem::path &ExePath) {
   // Release cached files, if any
   PGD.clearCache();
 
+  PGD3D.saveTextureDB();
+
   spdlog::info("ParallaxGen has finished patching meshes.");
 
   // Write plugin
-  if (!Args.NoPlugin) {
+  if (WritePlugin) {
     spdlog::info("Saving ParallaxGen.esp");
     ParallaxGenPlugin::savePlugin(Args.OutputDir);
   }
 
   // Deploy dynamic cubemap file
-  deployDynamicCubemapFile(&PGD, Args.OutputDir, ExePath);
-
-  // archive
-  if (!Args.NoZip) {
-    PG.zipMeshes();
-  }
+  deployDynamicCubemapFile(&PGD, &PG, ExePath);
 
-  // cleanup
-  if (!Args.NoCleanup) {
-    PG.deleteMeshes();
-  }
+  // Finish zip and flush remaining output
+  PG.finishOutput();
 
   const auto EndTime = chrono::high_resolution_clock::now();
   const auto Duration = chrono::duration_cast<chrono::seconds>(EndTime - StartTime).count();
 
+  ParallaxGenMemoryGovernor::get().printSummary();
+  PGD3D.printDDSMetadataCacheSummary();
   spdlog::info("ParallaxGen took {} seconds to complete", Duration);
 }
 
@@ -314,8 +408,15 @@ void addArguments(CLI::App &App, ParallaxGenCLIArgs &Args, const filesystem::pat
   App.add_flag("--no-bsa", Args.NoBSA, "Don't load BSA files, only loose files");
   // App Options
   App.add_flag("--autostart", Args.Autostart, "Start generation without user input");
-  App.add_flag("--no-multithread", Args.NoMultithread, "Don't use multithreading (Slower)");
-  auto *FlagNoGpu = App.add_flag("--no-gpu", Args.NoGPU, "Don't use the GPU for any operations (Slower)");
+  auto *FlagNoMultithread = App.add_flag("--no-multithread", Args.NoMultithread, "Don't use multithreading (Slower)");
+  App.add_option("--threads", Args.Threads, "Number of worker threads (default: one per CPU core)")
+      ->excludes(FlagNoMultithread);
+  App.add_option("--memory-budget", Args.MemoryBudget,
+                 "Memory in MiB that meshes and textures being processed may hold before work waits (default: half of "
+                 "physical memory)");
+  App.add_flag("--no-gpu", Args.NoGPU, "Don't use the GPU for any operations (Slower)");
+  App.add_flag("--no-texture-db", Args.NoTextureDB,
+               "Don't reuse or save texture analysis (DDS metadata, complex material checks) between runs");
   App.add_flag("--no-default-conifg", Args.NoDefaultConfig,
                "Don't load the default config file (You need to know what "
                "you're doing for this)");
@@ -325,15 +426,40 @@ void addArguments(CLI::App &App, ParallaxGenCLIArgs &Args, const filesystem::pat
   App.add_flag("--no-map-from-meshes", Args.NoMapFromMeshes,
                "Don't map textures from meshes (faster but less accurate)");
   App.add_flag("--no-plugin", Args.NoPlugin, "Don't create a ParallaxGen.esp plugin");
-  App.add_flag("--high-mem", Args.HighMem, "Enable high memory usage (faster runtime but uses a lot more RAM)");
+  auto *FlagHighMem =
+      App.add_flag("--high-mem", Args.HighMem, "Enable high memory usage (faster runtime but uses a lot more RAM)");
+  App.add_flag("--low-mem", Args.LowMem,
+               "Keep the load order file map in a memory mapped temp file instead of RAM (for very large load orders). "
+               "Only the file map moves to disk, the lists of meshes and texture maps stay in RAM")
+      ->excludes(FlagHighMem);
   App.add_flag("--no-zip", Args.NoZip, "Don't zip the output meshes (also enables --no-cleanup)");
-  App.add_flag("--no-cleanup", Args.NoCleanup, "Don't delete generated meshes after zipping");
+  App.add_flag("--no-cleanup", Args.NoCleanup, "Also keep generated files as loose files next to the zip");
+  App.add_flag("--compress-zip", Args.CompressZip,
+               "Deflate files in the output zip (compression runs on the patching threads)");
+  App.add_flag("--incremental", Args.Incremental,
+               "Reuse meshes from the previous output whose inputs haven't changed (the previous output must be in "
+               "the output directory)");
+  App.add_flag("--resume", Args.Resume,
+               "Continue an interrupted run with the same settings, meshes it finished are reused if their inputs "
+               "haven't changed (the interrupted run needs --journal, --incremental or --shard, patched meshes are "
+               "only reused from loose output, see --no-cleanup)");
+  App.add_flag("--journal", Args.Journal,
+               "Journal finished meshes to the output directory so the run can be continued with --resume if it is "
+               "interrupted");
+  auto *OptShard = App.add_option("--shard", Args.Shard,
+                                  "Only patch part i of N of the meshes (format i/N), use --merge-shards to combine the "
+                                  "outputs of all N parts");
+  App.add_option("--merge-shards", Args.MergeShards,
+                 "Combine the output directories of a --shard run into one output identical to an unsharded run")
+      ->excludes(OptShard);
   // Patchers
-  App.add_flag("--upgrade-shaders", Args.UpgradeShaders, "Upgrade shaders to a better version whenever possible")
-      ->excludes(FlagNoGpu);
+  App.add_flag("--upgrade-shaders", Args.UpgradeShaders, "Upgrade shaders to a better version whenever possible");
   App.add_flag("--ignore-parallax", Args.IgnoreParallax, "Don't generate any parallax meshes");
   auto *FlagIgnoreCM = App.add_flag("--ignore-complex-material", Args.IgnoreComplexMaterial,
                                     "Don't generate any complex material meshes");
+  App.add_flag("--validate-cm-detection", Args.ValidateCMDetection,
+               "Also count every env mask in full and warn where complex material detection disagrees (Slower)")
+      ->excludes(FlagIgnoreCM);
   App.add_flag("--ignore-truepbr", Args.IgnoreTruePBR, "Don't apply any TruePBR configs in the load order");
   App.add_flag("--disable-mlp", Args.DisableMLP, "Disable MLP (Multi-Layer Parallax) if complex material is possible")
       ->excludes(FlagIgnoreCM);
@@ -362,6 +488,36 @@ void addArguments(CLI::App &App, ParallaxGenCLIArgs &Args, const filesystem::pat
       }
     }
 
+    // Parse shard
+    if (!Args.Shard.empty()) {
+      const auto SlashPos = Args.Shard.find('/');
+      try {
+        if (SlashPos == string::npos) {
+          throw invalid_argument("missing /");
+        }
+        const auto Index = stoul(Args.Shard.substr(0, SlashPos));
+        const auto Count = stoul(Args.Shard.substr(SlashPos + 1));
+        if (Count == 0 || Index == 0 || Index > Count) {
+          throw out_of_range("index out of range");
+        }
+        Args.ShardIndex = Index - 1;
+        Args.ShardCount = Count;
+      } catch (const exception &) {
+        throw CLI::ValidationError("Invalid shard (--shard) specified: " + Args.Shard +
+                                   ". Expected i/N with 1 <= i <= N");
+      }
+    }
+
+    // Validate shard outputs
+    for (const auto &ShardDir : Args.MergeShards) {
+      if (!filesystem::is_directory(ShardDir)) {
+        throw CLI::ValidationError("Shard output (--merge-shards) is not a directory: " + ShardDir.string());
+      }
+      if (filesystem::exists(Args.OutputDir) && filesystem::equivalent(ShardDir, Args.OutputDir)) {
+        throw CLI::ValidationError("Output directory (-o) cannot be one of the shard outputs (--merge-shards)");
+      }
+    }
+
     // If --no-zip is set, also set --no-cleanup
     if (Args.NoZip) {
       Args.NoCleanup = true;
@@ -1,5 +1,8 @@
 #pragma once
 #include "BethesdaGame.hpp"
+#include "ParallaxGenFileTable.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
+#include "ParallaxGenUtil.hpp"
 
 #include <bsa/tes4.hpp>
 
@@ -7,9 +10,11 @@
 
 #include <cstddef>
 #include <filesystem>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <span>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -40,10 +45,12 @@ private:
    * path stores the path to the file, preserving case from the original path
    * bsa_file stores a shared pointer to a BSA file struct, or nullptr if the
    * file is a loose file
+   * size stores the size of the file in bytes (decompressed size for BSA files)
    */
   struct BethesdaFile {
     std::filesystem::path Path;
     std::shared_ptr<BSAFile> BSAFile;
+    size_t Size = 0;
   };
 
   // Class member variables
@@ -51,7 +58,15 @@ private:
   std::map<std::filesystem::path, BethesdaFile> FileMap; /** < Stores the file map for every file found in the load
                                                             order. Key is a lowercase path, value is a BethesdaFile */
 
-  std::unordered_map<std::filesystem::path, std::vector<std::byte>> FileCache; /** < Stores a cache of file bytes */
+  std::filesystem::path FileTablePath; /** < Where the file map is kept in low memory mode, empty otherwise */
+  std::unique_ptr<ParallaxGenFileTable::Builder> FileTableBuilder; /** < Collects the file map while it's populated */
+  ParallaxGenFileTable FileTable; /** < File map in low memory mode, replaces FileMap once populated */
+  std::vector<std::shared_ptr<BSAFile>> FileTableSources; /** < BSAs referenced by FileTable entries */
+
+  std::unordered_map<std::filesystem::path, std::shared_ptr<const std::vector<std::byte>>>
+      FileCache; /** < Stores a cache of file bytes, shared with the views handed out of it */
+  std::vector<ParallaxGenMemoryGovernor::Reservation> FileCacheMemory; /** < Memory budget held by the file cache */
+  size_t FileCacheBytes = 0; /** < Bytes held by the file cache */
   std::mutex FileCacheMutex; /** < Mutex for the file cache map */
 
   bool Logging;  /** < Bool for whether logging is enabled or not */
@@ -73,6 +88,27 @@ private:
   static auto getExtensionBlocklist() -> std::vector<std::wstring>;
 
 public:
+  /**
+   * @class FileView
+   * @brief Bytes of a file in the load order together with whatever keeps them alive, a memory map of a loose file,
+   * the BSA archive, a file cache entry or an extracted copy
+   */
+  class FileView {
+  private:
+    std::span<const std::byte> Bytes;                          /** < View into Mapping, Archive or CachedBytes */
+    std::vector<std::byte> ExtractedBytes;                     /** < Used instead of Bytes for extracted files */
+    ParallaxGenUtil::MappedFile Mapping;                       /** < Loose file */
+    std::shared_ptr<BSAFile> Archive;                          /** < BSA the bytes point into */
+    std::shared_ptr<const std::vector<std::byte>> CachedBytes; /** < File cache entry, outlives clearCache */
+
+    friend class BethesdaDirectory;
+
+  public:
+    [[nodiscard]] auto getBytes() const -> std::span<const std::byte> {
+      return ExtractedBytes.empty() ? Bytes : std::span<const std::byte>(ExtractedBytes);
+    }
+  };
+
   /**
    * @brief Construct a new Bethesda Directory object
    *
@@ -81,17 +117,28 @@ public:
    */
   BethesdaDirectory(BethesdaGame &BG, const bool &Logging);
 
+  /**
+   * @brief Keep the file map in a memory mapped table on disk instead of the heap, for load orders too large for the
+   * available memory. Has to be called before populateFileMap. Only the file map is affected, the mesh and texture
+   * maps ParallaxGenDirectory builds from it stay on the heap
+   *
+   * @param TablePath file the table is written to, it is deleted again once the table is closed
+   */
+  void enableLowMemoryFileMap(const std::filesystem::path &TablePath);
+
   /**
    * @brief Populate file map with all files in the load order
    */
   void populateFileMap(bool IncludeBSAs = true);
 
   /**
-   * @brief Get the file map vector
+   * @brief Visit files in the load order in sorted order
    *
-   * @return std::map<std::filesystem::path, BethesdaFile>
+   * @param Prefix lowercase directory ending in a separator to visit the files of, empty for every file
+   * @param Visitor called with the lowercase path and the file
    */
-  [[nodiscard]] auto getFileMap() const -> const std::map<std::filesystem::path, BethesdaFile> &;
+  void forEachFile(const std::wstring &Prefix,
+                   const std::function<void(const std::filesystem::path &, const BethesdaFile &)> &Visitor) const;
 
   /**
    * @brief Get the data directory path
@@ -109,11 +156,56 @@ public:
   [[nodiscard]] auto getFile(const std::filesystem::path &RelPath,
                              const bool &CacheFile = false) -> std::vector<std::byte>;
 
+  /**
+   * @brief Get the bytes of a file in the load order without copying them where possible. Loose files are memory
+   * mapped and uncompressed BSA files are read in place, compressed ones are extracted like getFile does
+   *
+   * @param RelPath path to the file relative to the data directory
+   * @return FileView bytes of the file, empty if it can't be read
+   */
+  [[nodiscard]] auto getFileView(const std::filesystem::path &RelPath) -> FileView;
+
+  /**
+   * @brief Get the first bytes of a file in the load order. Compressed BSA files are only decompressed as far as
+   * needed, used to read headers without extracting the whole file
+   *
+   * @param RelPath path to the file relative to the data directory
+   * @param NumBytes number of bytes to read from the start of the file
+   * @return std::vector<std::byte> at most NumBytes bytes, fewer if the file is shorter
+   */
+  [[nodiscard]] auto readFilePrefix(const std::filesystem::path &RelPath,
+                                    const size_t &NumBytes) -> std::vector<std::byte>;
+
+  /**
+   * @brief Get the size of a file in the load order without reading it
+   *
+   * @param RelPath path to the file relative to the data directory
+   * @return size_t size of the file in bytes, 0 if the file doesn't exist
+   */
+  [[nodiscard]] auto getFileSize(const std::filesystem::path &RelPath) const -> size_t;
+
+  /**
+   * @brief Sort files by size, largest first. Used to schedule long jobs early so they don't hold up the end of a stage
+   *
+   * @param Files files to sort, relative to the data directory
+   * @return std::vector<std::filesystem::path> files ordered by descending size
+   */
+  [[nodiscard]] auto getFilesBySizeDesc(const std::unordered_set<std::filesystem::path> &Files) const
+      -> std::vector<std::filesystem::path>;
+
   /**
    * @brief Clear the file cache
    */
   auto clearCache() -> void;
 
+  /**
+   * @brief Get the BSA archive a file in the load order is read from
+   *
+   * @param RelPath path to the file relative to the data directory
+   * @return std::filesystem::path path to the BSA archive, empty if the file is loose or doesn't exist
+   */
+  [[nodiscard]] auto getFileSource(const std::filesystem::path &RelPath) const -> std::filesystem::path;
+
   /**
    * @brief Check if a file in the load order is a loose file
    *
@@ -303,8 +395,17 @@ private:
    *
    * @param FilePath path to update or add
    * @param BSAFile BSA file or nullptr if it doesn't exist
+   * @param FileSize size of the file in bytes
    */
-  void updateFileMap(const std::filesystem::path &FilePath, std::shared_ptr<BSAFile> BSAFile);
+  void updateFileMap(const std::filesystem::path &FilePath, std::shared_ptr<BSAFile> BSAFile, const size_t &FileSize);
+
+  /**
+   * @brief Get a file object from an entry of the low memory file table
+   *
+   * @param Entry entry to convert
+   * @return BethesdaFile object of file in load order
+   */
+  [[nodiscard]] auto getFileFromTableEntry(const ParallaxGenFileTable::Entry &Entry) const -> BethesdaFile;
 
   /**
    * @brief Convert a list of wstrings to a LPCWSTRs
@@ -326,6 +427,17 @@ private:
    */
   static auto checkGlob(const LPCWSTR &Str, LPCWSTR &WinningGlob, const std::vector<LPCWSTR> &GlobList) -> bool;
 
+  /**
+   * @brief Decompress the start of a compressed BSA file
+   *
+   * @param Compressed compressed data as stored in the archive
+   * @param Version archive version, SSE archives use LZ4 frames and older ones zlib
+   * @param Out filled from the start of the decompressed data
+   * @return true if all of Out was filled
+   */
+  static auto decompressPrefix(std::span<const std::byte> Compressed, const bsa::tes4::version &Version,
+                               std::span<std::byte> Out) -> bool;
+
   static auto readINIValue(const std::filesystem::path &INIPath, const std::wstring &Section, const std::wstring &Key,
                            const bool &Logging, const bool &FirstINIRead) -> std::wstring;
 };
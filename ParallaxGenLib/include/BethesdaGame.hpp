@@ -66,12 +66,12 @@ public:
 
   [[nodiscard]] auto getActivePlugins(const bool &TrimExtension = false) const -> std::vector<std::wstring>;
 
+  // gets the system path for a folder (from windows.h), empty if it is unknown
+  static auto getSystemPath(const GUID &FolderID) -> std::filesystem::path;
+
 private:
   // locates the steam install locatino of steam
   [[nodiscard]] auto findGamePathFromSteam() const -> std::filesystem::path;
 
-  // gets the system path for a folder (from windows.h)
-  static auto getSystemPath(const GUID &FolderID) -> std::filesystem::path;
-
   [[nodiscard]] auto getGameRegistryPath() const -> std::string;
 };
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace DDSUtil {
+
+// Magic, header and DX10 header, everything parseDDSHeader needs
+constexpr size_t DDS_HEADER_MAX_SIZE = 4 + 124 + 20;
+
+// Fields of DirectX::TexMetadata, kept as their DXGI/DirectXTex values so this doesn't need DirectXTex
+struct DDSHeaderInfo {
+  size_t Width = 0;
+  size_t Height = 0;
+  size_t Depth = 1;
+  size_t ArraySize = 1;
+  size_t MipLevels = 1;
+  uint32_t MiscFlags = 0;  // TEX_MISC_FLAG
+  uint32_t MiscFlags2 = 0; // TEX_ALPHA_MODE in the low bits
+  uint32_t Format = 0;     // DXGI_FORMAT
+  uint32_t Dimension = 0;  // TEX_DIMENSION
+};
+
+// Reads the metadata of a DDS from its first bytes, the same DirectX::GetMetadataFromDDSMemory gives. Empty if the
+// header is invalid or uses a legacy pixel format this doesn't map, DirectXTex has to decide those
+auto parseDDSHeader(std::span<const std::byte> Bytes) -> std::optional<DDSHeaderInfo>;
+
+} // namespace DDSUtil
@@ -4,6 +4,8 @@
 #include <NifFile.hpp>
 #include <Shaders.hpp>
 #include <array>
+#include <span>
+#include <string_view>
 #include <tuple>
 
 constexpr unsigned NUM_TEXTURE_SLOTS = 9;
@@ -80,10 +82,31 @@ struct PGTextureHasher {
 auto getDefaultTextureType(const TextureSlots &Slot) -> TextureType;
 
 auto loadNIFFromBytes(const std::vector<std::byte> &NIFBytes) -> nifly::NifFile;
+// Parses a NIF directly from a contiguous buffer (file bytes, memory map etc.) without copying it
+auto loadNIFFromBytes(std::span<const std::byte> NIFBytes) -> nifly::NifFile;
+// Serializes a NIF into memory, throws if nifly fails to save it
+auto saveNIFToBytes(nifly::NifFile &NIF, const nifly::NifSaveOptions &Options) -> std::vector<std::byte>;
 
 auto getTexSuffixMap() -> std::map<std::wstring, std::tuple<TextureSlots, TextureType>>;
 
+// Result of matching a texture path against the suffix table
+struct TexSuffixMatch {
+  size_t BaseLength = 0; // length of the path without extension and suffix
+  TextureSlots Slot = TextureSlots::UNKNOWN;
+  TextureType Type = TextureType::UNKNOWN;
+};
+
+// Finds the longest known suffix (case insensitive) of a texture path in a single backward scan without allocating
+auto matchTexSuffix(std::wstring_view Path) -> TexSuffixMatch;
+
 auto getDefaultsFromSuffix(const std::filesystem::path &Path) -> std::tuple<TextureSlots, TextureType>;
+auto getDefaultsFromSuffix(std::wstring_view Path) -> std::tuple<TextureSlots, TextureType>;
+inline auto getDefaultsFromSuffix(const std::wstring &Path) -> std::tuple<TextureSlots, TextureType> {
+  return getDefaultsFromSuffix(std::wstring_view(Path));
+}
+inline auto getDefaultsFromSuffix(const wchar_t *Path) -> std::tuple<TextureSlots, TextureType> {
+  return getDefaultsFromSuffix(std::wstring_view(Path));
+}
 
 // shader helpers
 auto setShaderType(nifly::NiShader *NIFShader, const nifly::BSLightingShaderPropertyShaderType &Type,
@@ -116,6 +139,9 @@ auto setTextureSlot(nifly::NifFile *NIF, nifly::NiShape *NIFShape, const Texture
 auto getTextureSlot(nifly::NifFile *NIF, nifly::NiShape *NIFShape, const TextureSlots &Slot) -> std::string;
 auto getTextureSlots(nifly::NifFile &NIF, nifly::NiShape *NIFShape) -> std::array<std::wstring, NUM_TEXTURE_SLOTS>;
 auto getTexBase(const std::filesystem::path &TexPath) -> std::wstring;
+auto getTexBase(std::wstring_view TexPath) -> std::wstring;
+inline auto getTexBase(const std::wstring &TexPath) -> std::wstring { return getTexBase(std::wstring_view(TexPath)); }
+inline auto getTexBase(const wchar_t *TexPath) -> std::wstring { return getTexBase(std::wstring_view(TexPath)); }
 auto getTexMatch(const std::wstring &Base, const std::wstring &ExistingSlot, const TextureType &DesiredType,
                  const std::map<std::wstring, std::unordered_set<PGTexture, PGTextureHasher>> &SearchMap) -> PGTexture;
 // Gets all the texture prefixes for a textureset. ie. _n.dds is removed etc. for each slot
@@ -125,4 +151,31 @@ auto getSearchPrefixes(nifly::NifFile &NIF, nifly::NiShape *NIFShape)
 auto getSearchPrefixes(const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots)
     -> std::array<std::wstring, NUM_TEXTURE_SLOTS>;
 
+// Material state of a shape, read once before patching and shared by all patchers
+struct ShapeMaterialView {
+  nifly::NiShape *Shape = nullptr;
+  nifly::NiShader *Shader = nullptr;
+  nifly::BSLightingShaderProperty *ShaderBSLSP = nullptr; // nullptr if the shader is not a BSLightingShaderProperty
+  int ShapeBlockID = -1;
+  uint32_t TextureSetBlockID = 0;
+  nifly::BSLightingShaderPropertyShaderType ShaderType = nifly::BSLSP_DEFAULT;
+  uint32_t ShaderFlags1 = 0;
+  uint32_t ShaderFlags2 = 0;
+  std::array<std::wstring, NUM_TEXTURE_SLOTS> Slots;
+  std::array<std::wstring, NUM_TEXTURE_SLOTS> SearchPrefixes;
+
+  [[nodiscard]] auto hasFlag(const nifly::SkyrimShaderPropertyFlags1 &Flag) const -> bool {
+    return (ShaderFlags1 & Flag) != 0U;
+  }
+  [[nodiscard]] auto hasFlag(const nifly::SkyrimShaderPropertyFlags2 &Flag) const -> bool {
+    return (ShaderFlags2 & Flag) != 0U;
+  }
+  [[nodiscard]] auto getSlot(const TextureSlots &Slot) const -> const std::wstring & {
+    return Slots[static_cast<size_t>(Slot)];
+  }
+};
+
+// Builds the material view of a shape. Slots and prefixes are only filled for shapes with a textured lighting shader
+auto getShapeMaterialView(nifly::NifFile &NIF, nifly::NiShape *NIFShape) -> ShapeMaterialView;
+
 } // namespace NIFUtil
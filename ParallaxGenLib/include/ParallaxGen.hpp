@@ -1,15 +1,30 @@
 #pragma once
 
 #include <NifFile.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <miniz.h>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <nlohmann/json.hpp>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "NIFUtil.hpp"
 #include "ParallaxGenConfig.hpp"
 #include "ParallaxGenD3D.hpp"
 #include "ParallaxGenDirectory.hpp"
+#include "ParallaxGenIncremental.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
+#include "ParallaxGenOutput.hpp"
+#include "ParallaxGenShardedMap.hpp"
 #include "ParallaxGenTask.hpp"
 #include "patchers/PatcherComplexMaterial.hpp"
 #include "patchers/PatcherTruePBR.hpp"
@@ -34,6 +49,79 @@ private:
   bool IgnoreCM;
   bool IgnoreTruePBR;
 
+  // where generated files are written
+  std::unique_ptr<ParallaxGenOutput> Output;
+  bool ZipOutput = false;
+  bool LooseOutput = false;
+  std::mutex TopLevelOutputFilesMutex;
+  std::unordered_set<std::filesystem::path> TopLevelOutputFiles;
+
+  // records of this run (journaled), results of the previous run if incremental mode is on
+  std::unique_ptr<ParallaxGenIncremental> Incremental;
+  bool WriteManifest = false; // only incremental and sharded runs put the manifest in the output
+  // what an interrupted run finished, null unless resuming
+  std::unique_ptr<ParallaxGenIncremental> Resume;
+  std::string IncrementalRunSettings; // CLI settings that affect patching, part of every decision key
+  uint64_t DecisionSettingsKey = 0;
+
+  // sharded runs only patch the meshes whose path hashes to ShardIndex
+  size_t ShardIndex = 0;
+  size_t ShardCount = 1;
+  // merge runs take meshes from these shard outputs instead of patching them
+  std::vector<std::unique_ptr<ParallaxGenIncremental>> ShardOutputs;
+
+  // plugin shapes of every patched mesh, applied to the plugin sorted by mesh path once all meshes are done so the
+  // plugin doesn't depend on which thread finished first
+  std::mutex PluginShapesMutex;
+  std::map<std::filesystem::path, std::vector<ParallaxGenIncremental::PluginShape>> PluginShapes;
+
+  // byte-identical meshes that are patched once, maps the patched mesh to the meshes reusing its result
+  std::unordered_map<std::filesystem::path, std::vector<std::filesystem::path>> DuplicateMeshes;
+
+  // nif_filter values of the PBR configs, the only part of PBR matching that looks at the mesh path
+  std::set<std::wstring> PBRNIFFilters;
+
+  // Everything the material part of a shape's patch decision depends on
+  struct ShapeDecisionKey {
+    std::array<std::wstring, NUM_TEXTURE_SLOTS> Slots;
+    uint32_t ShaderType = 0;
+    uint32_t ShaderFlags1 = 0; // only the flags the patchers check
+    uint32_t ShaderFlags2 = 0;
+    std::string PathSignature; // see getMeshPathSignature
+
+    auto operator==(const ShapeDecisionKey &Other) const -> bool = default;
+  };
+
+  struct ShapeDecisionKeyHasher {
+    auto operator()(const ShapeDecisionKey &Key) const -> size_t {
+      size_t Hash = std::hash<std::string>{}(Key.PathSignature);
+      const auto Combine = [&Hash](const size_t &Value) { Hash ^= Value + 0x9e3779b9 + (Hash << 6) + (Hash >> 2); };
+      for (const auto &Slot : Key.Slots) {
+        Combine(std::hash<std::wstring>{}(Slot));
+      }
+      Combine(Key.ShaderType);
+      Combine(Key.ShaderFlags1);
+      Combine(Key.ShaderFlags2);
+      return Hash;
+    }
+  };
+
+  // Which patcher a material gets and with what, per shape checks (havok, skinning) still run for parallax
+  struct ShapeDecision {
+    ParallaxGenTask::PGResult Result = ParallaxGenTask::PGResult::SUCCESS;
+    bool EnableTruePBR = false;
+    std::map<size_t, std::tuple<nlohmann::json, std::wstring>> TruePBRData;
+    bool EnableCM = false;
+    bool EnableDynCubemaps = false;
+    std::wstring CMMatchedPath;
+    bool EnableParallax = false;
+    std::wstring ParallaxMatchedPath;
+  };
+
+  // decisions shared by every shape with the same material across all meshes, cleared at the start of patchMeshes
+  mutable ParallaxGenShardedMap<ShapeDecisionKey, std::shared_ptr<const ShapeDecision>, ShapeDecisionKeyHasher>
+      ShapeDecisions;
+
 public:
   //
   // The following methods are called from main.cpp and are public facing
@@ -47,36 +135,130 @@ public:
   void upgradeShaders();
   // enables parallax on relevant meshes
   void patchMeshes(const bool &MultiThread = true, const bool &PatchPlugin = true);
-  // zips all meshes and removes originals
-  void zipMeshes() const;
-  // deletes generated meshes
-  void deleteMeshes() const;
-  // deletes entire output folder
-  void deleteOutputDir() const;
+  // sets up the output, generated files stream into a zip and/or loose files in the output directory
+  void initOutput(const bool &Zip, const bool &Loose, const bool &CompressZip = false);
+  // adds a generated file to the output (thread safe)
+  void addFileToOutput(const std::filesystem::path &RelPath, std::vector<std::byte> Bytes);
+  void addFileToOutput(ParallaxGenOutputFile File);
+  // finishes the output, files other tools wrote to the output directory (plugin) are moved into the zip
+  void finishOutput();
+  // deletes entire output folder, KeepPrevious moves the last complete output aside for an incremental run instead and
+  // KeepPartial moves the output of an interrupted run aside to resume from
+  void deleteOutputDir(const bool &KeepPrevious = false, const bool &KeepPartial = false) const;
+  // enables incremental mode, meshes whose inputs are unchanged since the previous output reuse its results.
+  // RunSettings holds every CLI setting that can change a patched mesh
+  void initIncremental(const std::string &RunSettings);
+  // journals finished meshes to the output directory in periodic checkpoints so an interrupted run can be resumed.
+  // Records every mesh with its decision key, so only call it for runs that ask for it
+  void initJournal(const std::string &RunSettings);
+  // reuses what the interrupted run moved aside by deleteOutputDir finished, the same checks as incremental mode apply
+  void initResume();
+  // only patch the meshes of shard Index out of Count, the output also gets a manifest so the shards can be merged
+  void initShard(const size_t &Index, const size_t &Count, const std::string &RunSettings);
+  // takes meshes from the outputs of a sharded run instead of patching them, the result matches a single run
+  void initMerge(const std::vector<std::filesystem::path> &ShardDirs);
+  // whether a mesh belongs to shard Index out of Count, stable across runs and machines
+  [[nodiscard]] static auto isInShard(const std::filesystem::path &NIFFile, const size_t &Index, const size_t &Count)
+      -> bool;
   // get output zip name
   [[nodiscard]] static auto getOutputZipName() -> std::filesystem::path;
   // get diff json name
   [[nodiscard]] static auto getDiffJSONName() -> std::filesystem::path;
+  // get name of the folder the previous output is kept in during an incremental run
+  [[nodiscard]] static auto getPreviousOutputDirName() -> std::filesystem::path;
+  // get name of the folder the output of an interrupted run is kept in while resuming
+  [[nodiscard]] static auto getResumeDirName() -> std::filesystem::path;
 
 private:
-  // thread safe JSON update
-  std::mutex JSONUpdateMutex;
-  void threadSafeJSONUpdate(const std::function<void(nlohmann::json &)> &Operation, nlohmann::json &DiffJSON);
+  // One patched mesh in the diff JSON
+  struct MeshDiffEntry {
+    std::string NIFFile; // UTF-8 relative path, also the JSON key
+    uint32_t CRCBefore = 0;
+    uint32_t CRCAfter = 0;
+  };
+
+  // serializes the diff JSON sorted by path without building a JSON DOM
+  static auto serializeDiffJSON(std::vector<MeshDiffEntry> &DiffEntries) -> std::string;
+
+  // A complex material generated from a height map, OutputFile is empty if none was generated
+  struct ShaderUpgradeJob {
+    std::wstring TexBase;
+    ParallaxGenOutputFile OutputFile;
+    DirectX::TexMetadata Metadata{};
+  };
 
-  // upgrades a height map to complex material
-  auto convertHeightMapToComplexMaterial(const std::filesystem::path &HeightMap) -> ParallaxGenTask::PGResult;
+  // upgrades a height map to complex material, only reads the texture maps so it can run on any thread
+  auto convertHeightMapToComplexMaterial(const std::filesystem::path &HeightMap,
+                                         ShaderUpgradeJob &Job) const -> ParallaxGenTask::PGResult;
 
-  // processes a NIF file (enable parallax if needed)
-  auto processNIF(const std::filesystem::path &NIFFile, nlohmann::json &DiffJSON, const bool &PatchPlugin = true) -> ParallaxGenTask::PGResult;
+  // Work items passed between the stages of the mesh patching pipeline
+  struct MeshReadJob {
+    size_t Seq = 0; // position in the mesh list, output is written in this order
+    std::filesystem::path NIFFile;
+    std::vector<std::byte> NIFFileData;
+    ParallaxGenMemoryGovernor::Reservation Memory; // working set of the mesh, passed on to the write job
+  };
+
+  struct MeshWriteJob {
+    size_t Seq = 0;
+    std::filesystem::path NIFFile;
+    ParallaxGenOutputFile OutputFile; // serialized patched NIF, deflated already if the zip is compressed
+    uint32_t CRCBefore = 0;
+    ParallaxGenIncremental::MeshRecord Record; // what patching decided, reused for duplicates and incremental runs
+    ParallaxGenTask::PGResult Result = ParallaxGenTask::PGResult::SUCCESS;
+    ParallaxGenMemoryGovernor::Reservation Memory; // released once the mesh is written
+  };
+
+  // finds byte-identical meshes whose patching can't depend on their path, fills DuplicateMeshes and returns the
+  // meshes that still need to be patched
+  auto findDuplicateMeshes(const std::vector<std::filesystem::path> &Meshes, const bool &MultiThread)
+      -> std::vector<std::filesystem::path>;
+  // gives the duplicates of a patched mesh its result, adds their output if it was modified. DiffEntries is only
+  // touched if WriteJob has output, so it needs the same care as writeNIF then
+  void finishDuplicateMeshes(const std::filesystem::path &NIFFile, const MeshWriteJob &WriteJob,
+                             const ParallaxGenTask::PGResult &Result, const bool &PatchPlugin,
+                             std::vector<MeshDiffEntry> &DiffEntries, ParallaxGenTask &TaskTracker);
+
+  // how a mesh path matches the nif_filters and the dynamic cubemap blocklist, meshes with the same signature get the
+  // same decisions for the same materials
+  [[nodiscard]] auto getMeshPathSignature(const std::filesystem::path &NIFFile) const -> std::string;
+
+  // material part of a shape's patch decision, computed once per distinct material
+  auto getShapeDecision(const NIFUtil::ShapeMaterialView &View, const std::string &PathSignature,
+                        PatcherVanillaParallax &PatchVP, PatcherComplexMaterial &PatchCM,
+                        PatcherTruePBR &PatchTPBR) const -> std::shared_ptr<const ShapeDecision>;
+
+  // key over the settings every patching decision depends on
+  [[nodiscard]] auto computeSettingsKey(const bool &PatchPlugin) const -> uint64_t;
+  // key over the settings and the current state of every texture a mesh looked up
+  [[nodiscard]] auto computeDecisionKey(const std::vector<std::wstring> &TextureRefs) const -> uint64_t;
+  // reuses a mesh result from a previous or shard output, false if that output can't be used
+  auto tryReuseNIF(const ParallaxGenIncremental::MeshRecord &Previous, ParallaxGenIncremental &Source,
+                   const MeshReadJob &ReadJob, MeshWriteJob &WriteJob, const bool &PatchPlugin) -> bool;
+
+  // queues the plugin shapes of a patched mesh (thread safe)
+  void addPluginShapes(const std::filesystem::path &NIFFile,
+                       const std::vector<ParallaxGenIncremental::PluginShape> &Shapes);
+  // applies the queued plugin shapes to the plugin
+  void patchPlugin();
+
+  // processes a NIF file (enable parallax if needed), runs all pipeline stages in order on the calling thread
+  auto processNIF(const std::filesystem::path &NIFFile, std::vector<MeshDiffEntry> &DiffEntries,
+                  ParallaxGenTask &TaskTracker, const bool &PatchPlugin = true) -> ParallaxGenTask::PGResult;
+
+  // pipeline stage: reads the source NIF bytes
+  auto readNIF(const std::filesystem::path &NIFFile, MeshReadJob &ReadJob) const -> ParallaxGenTask::PGResult;
+
+  // pipeline stage: parses, patches and serializes a NIF, WriteJob.OutputFile is only set if the NIF was modified
+  auto patchNIF(MeshReadJob &ReadJob, MeshWriteJob &WriteJob, const bool &PatchPlugin) -> ParallaxGenTask::PGResult;
+
+  // pipeline stage: writes a patched NIF to the output and records its diff entry, only ever runs on one thread at a
+  // time so DiffEntries needs no lock
+  auto writeNIF(MeshWriteJob &WriteJob, std::vector<MeshDiffEntry> &DiffEntries) -> ParallaxGenTask::PGResult;
 
   // processes a shape within a NIF file
   auto processShape(const std::filesystem::path &NIFPath, nifly::NifFile &NIF, nifly::NiShape *NIFShape,
                     PatcherVanillaParallax &PatchVP, PatcherComplexMaterial &PatchCM, PatcherTruePBR &PatchTPBR,
-                    bool &ShapeModified, bool &ShapeDeleted, NIFUtil::ShapeShader &ShaderApplied) const -> ParallaxGenTask::PGResult;
-
-  // Zip methods
-  void addFileToZip(mz_zip_archive &Zip, const std::filesystem::path &FilePath,
-                    const std::filesystem::path &ZipPath) const;
-
-  void zipDirectory(const std::filesystem::path &DirPath, const std::filesystem::path &ZipPath) const;
+                    bool &ShapeModified, bool &ShapeDeleted, NIFUtil::ShapeShader &ShaderApplied,
+                    std::vector<std::wstring> &TextureRefs, const std::string &PathSignature) const -> ParallaxGenTask::PGResult;
 };
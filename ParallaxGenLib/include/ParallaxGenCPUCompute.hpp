@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// CPU versions of the compute shaders in shaders/, used when there is no GPU. They work on R8G8B8A8 pixels and match
+// what the shaders write. Rows are split across the scheduler, the inner loops use SSE2 where available.
+class ParallaxGenCPUCompute {
+public:
+  struct RGBAImage {
+    const uint8_t *Pixels = nullptr;
+    size_t Width = 0;
+    size_t Height = 0;
+    size_t RowPitch = 0; // bytes
+  };
+
+  struct MinMaxValues {
+    uint32_t MinEnvValue = UINT32_MAX;
+    uint32_t MaxEnvValue = 0;
+    uint32_t MinParallaxValue = UINT32_MAX;
+    uint32_t MaxParallaxValue = 0;
+  };
+
+  // MergeToComplexMaterial.hlsl: red of the env map goes to red, red of the parallax map goes to alpha, both nearest
+  // scaled to Width x Height. A missing map (nullptr) gives 0 env and full parallax. Returns the range of each channel
+  static auto mergeToComplexMaterial(const RGBAImage *EnvMap, const RGBAImage *ParallaxMap, const size_t &Width,
+                                     const size_t &Height, uint8_t *Output,
+                                     const size_t &OutputRowPitch) -> MinMaxValues;
+
+  // CountAlphaValues.hlsl: number of pixels with full alpha
+  static auto countAlphaValues(const RGBAImage &Image) -> size_t;
+  // countAlphaValues(Image) > Threshold, stops counting as soon as the rows counted so far decide it
+  static auto countAlphaValuesExceeds(const RGBAImage &Image, const size_t &Threshold) -> bool;
+
+  // Whether OpaqueCount full alpha pixels out of NumPixels on a lower mip suggest that more than Fraction of the larger
+  // mip has full alpha. Only an estimate, filter rounding and authored mips can give a lower mip more opaque pixels
+  // than the larger one has. Margin is how far over Fraction the estimate has to be
+  static auto showsOpaqueFraction(const size_t &OpaqueCount, const size_t &NumPixels, const double &Fraction,
+                                  const double &Margin) -> bool;
+
+  enum class BlockFormat { BC2, BC3, BC7 };
+
+  // countAlphaValues straight on the blocks of a compressed image, only the alpha of each block is decoded and no
+  // decoded image is allocated. Counts are the same as decompressing with DirectXTex first. RowPitch is the size of a
+  // row of blocks
+  static auto countAlphaValuesBC(const uint8_t *Blocks, const size_t &Width, const size_t &Height,
+                                 const size_t &RowPitch, const BlockFormat &Format) -> size_t;
+  static auto countAlphaValuesBCExceeds(const uint8_t *Blocks, const size_t &Width, const size_t &Height,
+                                        const size_t &RowPitch, const BlockFormat &Format,
+                                        const size_t &Threshold) -> bool;
+
+private:
+  // rows per scheduler task
+  static constexpr size_t ROWS_PER_TASK = 32;
+  // rows of 4x4 blocks per scheduler task
+  static constexpr size_t BLOCK_ROWS_PER_TASK = 8;
+
+  // Sums the counts of every task. With a threshold tasks are skipped once the sum is known to end up above it or at
+  // most at it, the result then only compares to the threshold like the full sum would. CountTask(Task) returns the
+  // count and the number of pixels the task looked at
+  template <typename CountTaskFunc>
+  static auto sumTaskCounts(const size_t &NumTasks, const size_t &NumPixels, const std::optional<size_t> &Threshold,
+                            CountTaskFunc CountTask) -> size_t;
+
+  static auto countAlphaValuesRGBA(const RGBAImage &Image, const std::optional<size_t> &Threshold) -> size_t;
+  static auto countAlphaValuesBlocks(const uint8_t *Blocks, const size_t &Width, const size_t &Height,
+                                     const size_t &RowPitch, const BlockFormat &Format,
+                                     const std::optional<size_t> &Threshold) -> size_t;
+};
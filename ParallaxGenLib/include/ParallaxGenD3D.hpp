@@ -4,15 +4,21 @@
 #include <d3d11.h>
 #include <wrl/client.h>
 
+#include <atomic>
 #include <cstddef>
 #include <filesystem>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "DDSUtil.hpp"
 #include "ParallaxGenDirectory.hpp"
+#include "ParallaxGenShardedMap.hpp"
 #include "ParallaxGenTask.hpp"
+#include "ParallaxGenTextureDB.hpp"
 
 #define NUM_GPU_THREADS 16
 #define GPU_BUFFER_SIZE_MULTIPLE 16
@@ -24,11 +30,12 @@ private:
 
   std::filesystem::path OutputDir;
   std::filesystem::path ExePath;
-  bool UseGPU;
+  bool UseGPU; // cleared if no GPU could be initialized, the CPU versions of the shaders run then
 
   // GPU objects
   Microsoft::WRL::ComPtr<ID3D11Device> PtrDevice;         // GPU device
   Microsoft::WRL::ComPtr<ID3D11DeviceContext> PtrContext; // GPU context
+  mutable std::mutex GPUContextMutex; // the immediate context is not thread safe, the device is
 
   static inline const D3D_FEATURE_LEVEL FeatureLevel = D3D_FEATURE_LEVEL_11_0; // DX11
 
@@ -49,17 +56,44 @@ private:
   };
   Microsoft::WRL::ComPtr<ID3D11ComputeShader> ShaderCountAlphaValues;
 
-  std::unordered_map<std::filesystem::path, DirectX::TexMetadata> DDSMetaDataCache{};
-  std::mutex DDSMetaDataMutex;
+  // Metadata of every DDS asked for, failed reads are kept too so broken files are only read once
+  struct DDSMetaDataEntry {
+    ParallaxGenTask::PGResult Result = ParallaxGenTask::PGResult::SUCCESS;
+    DirectX::TexMetadata Meta{};
+  };
+  ParallaxGenShardedMap<std::filesystem::path, DDSMetaDataEntry> DDSMetaDataCache;
+  std::atomic<size_t> DDSMetaDataLookups = 0;
+  std::atomic<size_t> DDSMetaDataReads = 0;
+  std::atomic<size_t> DDSMetaDataFailures = 0;
+
+  // Analysis of previous runs, only set if enabled
+  std::unique_ptr<ParallaxGenTextureDB> TextureDB;
+  ParallaxGenShardedMap<std::filesystem::path, int64_t> ArchiveModifiedTimes;
+  std::atomic<size_t> CMFromTextureDB = 0;
+
+  // Complex material detection stats
+  bool ValidateCM = false;
+  std::atomic<size_t> CMDecidedFromMips = 0;
+  std::atomic<size_t> CMValidationChecked = 0;
+  std::atomic<size_t> CMValidationMismatches = 0;
 
 public:
   // Constructor
   ParallaxGenD3D(ParallaxGenDirectory *PGD, std::filesystem::path OutputDir, std::filesystem::path ExePath,
                  const bool &UseGPU);
 
-  // Initialize GPU (also compiles shaders)
+  // Initialize GPU (also compiles shaders), falls back to the CPU if there is no DX11 device
   void initGPU();
 
+  // Also counts every env mask in full and reports where that disagrees with the detection
+  void enableCMValidation();
+
+  // Loads texture analysis of previous runs from DBPath, records still matching their texture go into the metadata
+  // cache and are used by findCMMaps. Needs the file map
+  void loadTextureDB(const std::filesystem::path &DBPath);
+  // Saves what this run analyzed for the next one
+  void saveTextureDB();
+
   // Check methods
   // files found in the bsa excludes are never CM maps, used for vanilla env masks
   auto findCMMaps(const std::unordered_set<std::wstring>& BSAExcludes) -> ParallaxGenTask::PGResult;
@@ -74,13 +108,37 @@ public:
   auto checkIfAspectRatioMatches(const std::filesystem::path &DDSPath1, const std::filesystem::path &DDSPath2,
                                  bool &CheckAspect) -> ParallaxGenTask::PGResult;
 
+  // Records metadata of a generated DDS that may never be written to disk (zip output)
+  void cacheDDSMetadata(const std::filesystem::path &DDSPath, const DirectX::TexMetadata &DDSMeta);
+
+  // logs hits and reads of the DDS metadata cache
+  void printDDSMetadataCacheSummary() const;
+
   // Gets the error message from an HRESULT for logging
   static auto getHRESULTErrorMessage(HRESULT HR) -> std::string;
 
 private:
   auto checkIfCM(const std::filesystem::path &DDSPath, bool &Result) -> ParallaxGenTask::PGResult;
   auto countAlphaValuesGPU(const DirectX::ScratchImage &Image) -> int;
-  static auto countAlphaValuesCPU(const DirectX::ScratchImage &Image, const bool &BCCompressed) -> int;
+  // More than half the pixels of the top mip have full alpha. Estimated is set when a lower mip decided it, which is
+  // a heuristic and can be wrong, otherwise the top mip was counted
+  auto isMostlyOpaque(const DirectX::ScratchImage &Image, bool &MostlyOpaque,
+                      bool &Estimated) -> ParallaxGenTask::PGResult;
+  // Pixels of a mip with full alpha, -1 on failure. With a threshold counting stops once the comparison to it is
+  // decided, only that comparison is exact then
+  static auto countAlphaValuesCPU(const DirectX::ScratchImage &Image, const size_t &Mip = 0,
+                                  const std::optional<size_t> &Threshold = std::nullopt) -> int;
+
+  // CPU versions of the shaders, returns the uncompressed merged image with mips
+  static auto mergeToComplexMaterialCPU(const DirectX::ScratchImage &ParallaxMapDDS,
+                                        const DirectX::ScratchImage &EnvMapDDS) -> DirectX::ScratchImage;
+
+  // BC3 compresses a merged complex material image, empty on failure
+  static auto compressComplexMaterial(const DirectX::ScratchImage &Image) -> DirectX::ScratchImage;
+
+  // one mip of Image as R8G8B8A8, decompressed or converted as needed
+  static auto getRGBAImage(const DirectX::ScratchImage &Image, DirectX::ScratchImage &Dest,
+                           const size_t &Mip = 0) -> ParallaxGenTask::PGResult;
 
   // GPU functions
   void initShaders();
@@ -133,6 +191,15 @@ private:
   auto getDDS(const std::filesystem::path &DDSPath, DirectX::ScratchImage &DDS) const -> ParallaxGenTask::PGResult;
 
   auto getDDSMetadata(const std::filesystem::path &DDSPath, DirectX::TexMetadata &DDSMeta) -> ParallaxGenTask::PGResult;
+  // where a load order texture is read from, nullopt for generated textures or if it can't be found
+  auto getTextureSource(const std::filesystem::path &DDSPath) -> std::optional<ParallaxGenTextureDB::Source>;
+
+  static auto toTexMetadata(const DDSUtil::DDSHeaderInfo &Info) -> DirectX::TexMetadata;
+  static auto toDDSHeaderInfo(const DirectX::TexMetadata &Meta) -> DDSUtil::DDSHeaderInfo;
+
+  // reads the header for getDDSMetadata on a cache miss
+  auto readDDSMetadata(const std::filesystem::path &DDSPath,
+                       DirectX::TexMetadata &DDSMeta) const -> ParallaxGenTask::PGResult;
 
   static auto loadRawPixelsToScratchImage(const std::vector<unsigned char> &RawPixels, const size_t &Width,
                                           const size_t &Height, const size_t &Mips, DXGI_FORMAT Format) -> DirectX::ScratchImage;
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <windows.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Sorted, immutable table of paths stored in a file and memory mapped, so the OS pages it in on demand instead of the
+// whole table living on the heap. Records are fixed size and sorted by key, their strings live in one block after
+// them. Lookups are binary searches over the records.
+class ParallaxGenFileTable {
+public:
+  static constexpr uint32_t NO_SOURCE = UINT32_MAX;
+
+  struct Entry {
+    std::wstring_view Key;  // lowercase path
+    std::wstring_view Path; // path as found in the load order
+    uint32_t Source = NO_SOURCE;
+    uint64_t Size = 0;
+  };
+
+  // Collects entries and writes them out as a table. Strings are pooled so collecting stays compact
+  class Builder {
+  private:
+    struct PendingRecord {
+      uint64_t KeyOffset;
+      uint64_t PathOffset;
+      uint64_t Size;
+      uint32_t KeyLength;
+      uint32_t PathLength;
+      uint32_t Source;
+    };
+
+    std::vector<wchar_t> Strings;
+    std::vector<PendingRecord> Records;
+
+  public:
+    // adds an entry, a later entry with the same key replaces an earlier one
+    void add(const std::wstring &Key, const std::wstring &Path, const uint32_t &Source, const uint64_t &Size);
+
+    // sorts the entries and writes the table to TablePath, false on I/O errors
+    auto write(const std::filesystem::path &TablePath) -> bool;
+
+    [[nodiscard]] auto size() const -> size_t { return Records.size(); }
+  };
+
+private:
+  // On-disk layout, native endianness since the table never leaves the machine that wrote it
+  static constexpr uint64_t TABLE_MAGIC = 0x3142544E47584C50ULL; // "PLXGNTB1"
+
+  struct Header {
+    uint64_t Magic;
+    uint64_t NumRecords;
+  };
+
+  struct Record {
+    uint64_t KeyOffset; // in wchar_t from the start of the string block
+    uint64_t PathOffset;
+    uint64_t Size;
+    uint32_t KeyLength;
+    uint32_t PathLength;
+    uint32_t Source;
+    uint32_t Padding;
+  };
+
+  HANDLE File = INVALID_HANDLE_VALUE;
+  HANDLE Mapping = nullptr;
+  const std::byte *View = nullptr;
+
+  const Record *Records = nullptr;
+  size_t NumRecords = 0;
+  const wchar_t *StringBlock = nullptr;
+
+public:
+  ParallaxGenFileTable() = default;
+  ParallaxGenFileTable(const ParallaxGenFileTable &) = delete;
+  auto operator=(const ParallaxGenFileTable &) -> ParallaxGenFileTable & = delete;
+  ParallaxGenFileTable(ParallaxGenFileTable &&) = delete;
+  auto operator=(ParallaxGenFileTable &&) -> ParallaxGenFileTable & = delete;
+  ~ParallaxGenFileTable();
+
+  // maps a table written by Builder, the file is deleted once the table is closed
+  auto open(const std::filesystem::path &TablePath) -> bool;
+  void close();
+
+  [[nodiscard]] auto isOpen() const -> bool { return View != nullptr; }
+  [[nodiscard]] auto size() const -> size_t { return NumRecords; }
+
+  [[nodiscard]] auto at(const size_t &Index) const -> Entry;
+  // entry with exactly Key, nullopt if there is none
+  [[nodiscard]] auto find(std::wstring_view Key) const -> std::optional<Entry>;
+  // index of the first entry whose key is not less than Key
+  [[nodiscard]] auto lowerBound(std::wstring_view Key) const -> size_t;
+
+  // order of the keys, the same as std::filesystem::path gives them so iteration order matches a std::map of paths
+  [[nodiscard]] static auto keyLess(std::wstring_view A, std::wstring_view B) -> bool;
+
+private:
+  [[nodiscard]] auto getKey(const size_t &Index) const -> std::wstring_view;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <miniz.h>
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 64-bit FNV-1a, used for keys that have to be stable across runs (std::hash is not)
+class ParallaxGenKeyHasher {
+private:
+  static constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+  static constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+  uint64_t State = FNV_OFFSET;
+
+public:
+  void add(const void *Data, const size_t &Size);
+  void add(const std::string &Str);
+  void add(const std::wstring &Str);
+  void add(const uint64_t &Value);
+
+  [[nodiscard]] auto get() const -> uint64_t { return State; }
+};
+
+// Keeps what a previous run decided for every mesh so an incremental run can reuse unchanged results without parsing.
+// A mesh is reused when its input bytes and the key over everything that influenced its patching both match.
+// Records can also be journaled as they come in, so an interrupted run can be resumed the same way.
+class ParallaxGenIncremental {
+public:
+  // A shape the plugin patcher was told about, replayed when a mesh is reused
+  struct PluginShape {
+    int Shader = 0; // NIFUtil::ShapeShader
+    std::wstring ShapeName;
+    int OldIndex = 0;
+    int NewIndex = 0;
+  };
+
+  struct MeshRecord {
+    std::filesystem::path NIFFile;
+    uint32_t CRCBefore = 0;
+    uint64_t DecisionKey = 0;
+    bool Patched = false;
+    uint32_t CRCAfter = 0;
+    std::vector<std::wstring> TextureRefs; // texture paths and search prefixes the mesh's shapes looked up
+    std::vector<PluginShape> PluginShapes;
+  };
+
+private:
+  std::filesystem::path PreviousDir;
+  std::unordered_map<std::string, MeshRecord> PreviousRecords;
+
+  // Previous zip output, reads are serialized since miniz shares one file handle
+  std::mutex PreviousZipMutex;
+  mz_zip_archive PreviousZip{};
+  bool PreviousZipOpen = false;
+
+  std::mutex RecordsMutex;
+  std::vector<MeshRecord> Records;
+
+  // Journal of this run's records, written under RecordsMutex
+  std::ofstream Journal;
+  std::string JournalBuffer;
+  size_t NumBufferedRecords = 0;
+  std::chrono::steady_clock::time_point LastCheckpoint;
+
+public:
+  // Loads the manifest of the previous output moved to PreviousDir, from PreviousZipPath if that can be opened or from
+  // loose files otherwise, plus the journal if the previous run was interrupted. No records means every mesh is
+  // processed
+  ParallaxGenIncremental(std::filesystem::path PreviousDir, const std::filesystem::path &PreviousZipPath);
+  // Only records this run, nothing is reused
+  ParallaxGenIncremental() = default;
+  ParallaxGenIncremental(const ParallaxGenIncremental &) = delete;
+  auto operator=(const ParallaxGenIncremental &) -> ParallaxGenIncremental & = delete;
+  ParallaxGenIncremental(ParallaxGenIncremental &&) = delete;
+  auto operator=(ParallaxGenIncremental &&) -> ParallaxGenIncremental & = delete;
+  ~ParallaxGenIncremental();
+
+  // name of the manifest written next to the diff JSON
+  [[nodiscard]] static auto getManifestName() -> std::filesystem::path;
+  // name of the journal kept in the output directory while a run is in progress
+  [[nodiscard]] static auto getJournalName() -> std::filesystem::path;
+
+  // record of a mesh from the previous run, nullptr if there is none
+  [[nodiscard]] auto findPrevious(const std::filesystem::path &NIFFile) const -> const MeshRecord *;
+
+  // bytes of a file in the previous output, empty if unavailable (thread safe)
+  auto getPreviousFile(const std::filesystem::path &RelPath) -> std::vector<std::byte>;
+
+  // records a mesh of this run (thread safe)
+  void addRecord(MeshRecord Record);
+
+  // serializes this run's manifest sorted by path
+  [[nodiscard]] auto serializeManifest() -> std::string;
+
+  // starts journaling records to JournalPath, they are written out in periodic checkpoints
+  void openJournal(const std::filesystem::path &JournalPath);
+  // writes the last checkpoint and closes the journal
+  void closeJournal();
+
+private:
+  void loadManifest(const std::string &ManifestStr);
+  void loadJournal(const std::filesystem::path &JournalPath);
+  void writeCheckpoint();
+
+  static auto parseRecord(const std::string &Key, const nlohmann::json &Entry) -> MeshRecord;
+  static auto serializeRecord(const MeshRecord &Record) -> std::string;
+};
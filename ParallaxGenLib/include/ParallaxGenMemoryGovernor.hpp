@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+
+// Keeps the memory held by in-flight work under a budget. Work reserves an estimate of its working set before it
+// starts (meshes, texture scratch images) and blocks while the budget would be exceeded, caches only take what is
+// left over. Reservations are estimates, the budget leaves headroom for everything that isn't tracked.
+class ParallaxGenMemoryGovernor {
+public:
+  // Bytes held until released or destroyed, move only
+  class Reservation {
+  private:
+    ParallaxGenMemoryGovernor *Governor = nullptr;
+    size_t Bytes = 0;
+    bool Admitted = false; // counted as in-flight work, caches are not
+
+  public:
+    Reservation() = default;
+    Reservation(ParallaxGenMemoryGovernor *Governor, const size_t &Bytes, const bool &Admitted)
+        : Governor(Governor), Bytes(Bytes), Admitted(Admitted) {}
+    Reservation(const Reservation &) = delete;
+    auto operator=(const Reservation &) -> Reservation & = delete;
+    Reservation(Reservation &&Other) noexcept;
+    auto operator=(Reservation &&Other) noexcept -> Reservation &;
+    ~Reservation() { release(); }
+
+    void release();
+
+    [[nodiscard]] auto getBytes() const -> size_t { return Bytes; }
+  };
+
+private:
+  // share of physical memory used as the default budget
+  static constexpr size_t DEFAULT_BUDGET_PERCENT = 50;
+  static constexpr size_t MIN_BUDGET = 1ULL << 30; // 1 GiB
+
+  std::mutex GovernorMutex;
+  std::condition_variable Released;
+  size_t Budget;
+  size_t Reserved = 0;
+  size_t Peak = 0;
+  size_t NumAdmitted = 0; // reservations of in-flight work
+  size_t NumWaits = 0;
+
+  static inline size_t ConfiguredBudget = 0; // 0 means derived from physical memory
+
+public:
+  explicit ParallaxGenMemoryGovernor(const size_t &Budget);
+
+  // sets the budget of the shared governor in bytes (0 for the default), has to be called before its first use
+  static void setBudget(const size_t &Budget);
+  // the shared governor, created on first use
+  static auto get() -> ParallaxGenMemoryGovernor &;
+  // budget used when none is configured, derived from physical memory
+  [[nodiscard]] static auto getDefaultBudget() -> size_t;
+
+  // blocks until Bytes fit in the budget. Work larger than the whole budget is admitted once nothing else is in flight,
+  // so it runs alone instead of waiting forever. Must not be called while holding another admitted reservation. Work
+  // holding a reservation can run parallelFor, the scheduler doesn't hand its waiting thread unrelated tasks
+  auto admit(const size_t &Bytes) -> Reservation;
+  // same, but also admits once CanOvercommit returns true. For work other in-flight work waits on (like the next item
+  // of a resequencer), CanOvercommit is checked under the governor's lock whenever memory is released
+  auto admit(const size_t &Bytes, const std::function<bool()> &CanOvercommit) -> Reservation;
+
+  // reserves Bytes only if they fit right now, for caches that can do without
+  auto tryReserve(const size_t &Bytes) -> std::optional<Reservation>;
+
+  [[nodiscard]] auto getBudget() const -> size_t { return Budget; }
+  [[nodiscard]] auto getPeak() -> size_t;
+
+  // logs the peak reservation and how often work had to wait
+  void printSummary();
+
+private:
+  void release(const size_t &Bytes, const bool &Admitted);
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <miniz.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ParallaxGenPipeline.hpp"
+
+// A generated file on its way to the output
+struct ParallaxGenOutputFile {
+  std::filesystem::path RelPath;
+  std::vector<std::byte> Bytes;
+  std::vector<std::byte> DeflatedBytes; // raw deflate stream of Bytes, empty if stored uncompressed
+  uint32_t CRC32 = 0;                   // CRC-32 of Bytes
+};
+
+// Destination for generated files. Sinks are only ever called from the output writer thread
+class ParallaxGenOutputSink {
+public:
+  ParallaxGenOutputSink() = default;
+  ParallaxGenOutputSink(const ParallaxGenOutputSink &) = delete;
+  auto operator=(const ParallaxGenOutputSink &) -> ParallaxGenOutputSink & = delete;
+  ParallaxGenOutputSink(ParallaxGenOutputSink &&) = delete;
+  auto operator=(ParallaxGenOutputSink &&) -> ParallaxGenOutputSink & = delete;
+  virtual ~ParallaxGenOutputSink() = default;
+
+  // Stores a file at a path relative to the output root
+  virtual auto write(const ParallaxGenOutputFile &File) -> bool = 0;
+  // Completes the output once all files have been written
+  virtual auto finalize() -> bool { return true; }
+};
+
+// Writes loose files under a directory
+class LooseOutputSink : public ParallaxGenOutputSink {
+private:
+  std::filesystem::path OutputDir;
+
+public:
+  explicit LooseOutputSink(std::filesystem::path OutputDir);
+
+  auto write(const ParallaxGenOutputFile &File) -> bool override;
+};
+
+// Appends files straight into a zip archive, nothing is staged on disk. Files that were deflated beforehand are
+// copied in as is, so the writer thread never compresses. Entries carry a fixed modification time instead of the
+// current one, the archive only depends on the files written to it
+class ZipOutputSink : public ParallaxGenOutputSink {
+private:
+  std::filesystem::path ZipPath;
+  mz_zip_archive Zip{};
+  MZ_TIME_T EntryTime;
+  bool Open = false;
+
+public:
+  // Throws if the archive cannot be created
+  explicit ZipOutputSink(std::filesystem::path ZipPath);
+  ZipOutputSink(const ZipOutputSink &) = delete;
+  auto operator=(const ZipOutputSink &) -> ZipOutputSink & = delete;
+  ZipOutputSink(ZipOutputSink &&) = delete;
+  auto operator=(ZipOutputSink &&) -> ZipOutputSink & = delete;
+  ~ZipOutputSink() override;
+
+  auto write(const ParallaxGenOutputFile &File) -> bool override;
+  auto finalize() -> bool override;
+};
+
+// Keeps files in memory so output can be inspected in process
+class MemoryOutputSink : public ParallaxGenOutputSink {
+private:
+  std::map<std::filesystem::path, std::vector<std::byte>> Files;
+
+public:
+  auto write(const ParallaxGenOutputFile &File) -> bool override;
+
+  [[nodiscard]] auto getFiles() const -> const std::map<std::filesystem::path, std::vector<std::byte>> &;
+};
+
+// Funnels files from any number of worker threads into the sinks through a single writer thread
+class ParallaxGenOutput {
+private:
+  static constexpr size_t DEFAULT_QUEUE_SIZE = 64;
+
+  std::vector<std::unique_ptr<ParallaxGenOutputSink>> Sinks;
+  int CompressionLevel; // 0 stores files uncompressed
+  ParallaxGenPipeline::BoundedQueue<ParallaxGenOutputFile> Queue;
+  size_t NumFailed = 0; // only touched by the writer thread until it is joined
+  bool Finished = false;
+  std::thread Writer;
+
+public:
+  explicit ParallaxGenOutput(std::vector<std::unique_ptr<ParallaxGenOutputSink>> Sinks,
+                             const int &CompressionLevel = 0, const size_t &QueueSize = DEFAULT_QUEUE_SIZE);
+  ParallaxGenOutput(const ParallaxGenOutput &) = delete;
+  auto operator=(const ParallaxGenOutput &) -> ParallaxGenOutput & = delete;
+  ParallaxGenOutput(ParallaxGenOutput &&) = delete;
+  auto operator=(ParallaxGenOutput &&) -> ParallaxGenOutput & = delete;
+  ~ParallaxGenOutput();
+
+  // Builds an output file, deflating it if compression is enabled. Thread safe, call it from worker threads so
+  // compression scales with the number of workers instead of running on the writer
+  [[nodiscard]] auto makeFile(std::filesystem::path RelPath, std::vector<std::byte> Bytes) const
+      -> ParallaxGenOutputFile;
+
+  // Queues a file for writing, blocks while the writer is behind. Thread safe
+  void addFile(ParallaxGenOutputFile File);
+  void addFile(std::filesystem::path RelPath, std::vector<std::byte> Bytes);
+
+  // Writes all queued files and finalizes every sink. Returns false if anything failed
+  auto finish() -> bool;
+};
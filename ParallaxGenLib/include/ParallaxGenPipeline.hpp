@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Building blocks for staged pipelines. Stages are connected by bounded queues so a fast producer blocks instead of
+// buffering unbounded work, which keeps peak memory proportional to the queue sizes.
+namespace ParallaxGenPipeline {
+
+// Blocking FIFO with a fixed capacity
+template <typename T> class BoundedQueue {
+private:
+  std::mutex QueueMutex;
+  std::condition_variable NotFull;
+  std::condition_variable NotEmpty;
+  std::deque<T> Items;
+  size_t Capacity;
+  bool Closed = false;
+
+public:
+  explicit BoundedQueue(const size_t &Capacity) : Capacity(Capacity > 0 ? Capacity : 1) {}
+
+  // Blocks while the queue is full. Returns false if the queue has been closed
+  auto push(T Item) -> bool {
+    std::unique_lock Lock(QueueMutex);
+    NotFull.wait(Lock, [this] { return Closed || Items.size() < Capacity; });
+    if (Closed) {
+      return false;
+    }
+
+    Items.push_back(std::move(Item));
+    Lock.unlock();
+    NotEmpty.notify_one();
+    return true;
+  }
+
+  // Blocks until an item is available. Returns nullopt once the queue is closed and drained
+  auto pop() -> std::optional<T> {
+    std::unique_lock Lock(QueueMutex);
+    NotEmpty.wait(Lock, [this] { return Closed || !Items.empty(); });
+    if (Items.empty()) {
+      return std::nullopt;
+    }
+
+    std::optional<T> Item(std::move(Items.front()));
+    Items.pop_front();
+    Lock.unlock();
+    NotFull.notify_one();
+    return Item;
+  }
+
+  // Signals that no more items will be pushed
+  void close() {
+    {
+      const std::lock_guard Lock(QueueMutex);
+      Closed = true;
+    }
+    NotEmpty.notify_all();
+    NotFull.notify_all();
+  }
+};
+
+// Restores sequence order for items that finish out of order. Every sequence number from 0 must be submitted or
+// skipped exactly once. Items are passed to Emit in order while holding the lock, so Emit never runs concurrently.
+template <typename T> class Resequencer {
+private:
+  std::mutex ResequencerMutex;
+  std::map<size_t, std::optional<T>> Pending;
+  std::atomic<size_t> NextSeq = 0; // written under the lock, readable without it
+  std::function<void(T &&)> Emit;
+
+public:
+  explicit Resequencer(std::function<void(T &&)> Emit) : Emit(std::move(Emit)) {}
+
+  // sequence number the next emitted item needs, items before it are done
+  [[nodiscard]] auto getNextSeq() const -> size_t { return NextSeq; }
+
+  void submit(const size_t &Seq, T Item) {
+    const std::lock_guard Lock(ResequencerMutex);
+    Pending.emplace(Seq, std::move(Item));
+    release();
+  }
+
+  void skip(const size_t &Seq) {
+    const std::lock_guard Lock(ResequencerMutex);
+    Pending.emplace(Seq, std::nullopt);
+    release();
+  }
+
+private:
+  void release() {
+    while (!Pending.empty() && Pending.begin()->first == NextSeq) {
+      auto Node = Pending.extract(Pending.begin());
+      if (Node.mapped().has_value()) {
+        Emit(std::move(*Node.mapped()));
+      }
+      NextSeq++;
+    }
+  }
+};
+
+// Owns the threads of every stage in a pipeline
+class WorkerGroup {
+private:
+  std::vector<std::thread> Workers;
+
+public:
+  WorkerGroup() = default;
+  WorkerGroup(const WorkerGroup &) = delete;
+  auto operator=(const WorkerGroup &) -> WorkerGroup & = delete;
+  WorkerGroup(WorkerGroup &&) = delete;
+  auto operator=(WorkerGroup &&) -> WorkerGroup & = delete;
+  ~WorkerGroup() { join(); }
+
+  template <typename Func> void add(Func &&Function) { Workers.emplace_back(std::forward<Func>(Function)); }
+
+  void join() {
+    for (auto &Worker : Workers) {
+      if (Worker.joinable()) {
+        Worker.join();
+      }
+    }
+    Workers.clear();
+  }
+};
+
+// Starts NumWorkers threads that map items from Input to Output. Function takes an In&& and returns std::optional<Out>,
+// returning nullopt drops the item. Output is closed when the last worker exits so the next stage can drain.
+// Function must not throw.
+template <typename In, typename Out, typename Func>
+void runStage(WorkerGroup &Group, BoundedQueue<In> &Input, BoundedQueue<Out> &Output, const size_t &NumWorkers,
+              Func Function) {
+  const size_t NumStageWorkers = NumWorkers > 0 ? NumWorkers : 1;
+  auto RemainingWorkers = std::make_shared<std::atomic<size_t>>(NumStageWorkers);
+
+  for (size_t I = 0; I < NumStageWorkers; I++) {
+    Group.add([&Input, &Output, Function, RemainingWorkers]() mutable {
+      while (auto Item = Input.pop()) {
+        auto Result = Function(std::move(*Item));
+        if (Result.has_value()) {
+          Output.push(std::move(*Result));
+        }
+      }
+
+      if (RemainingWorkers->fetch_sub(1) == 1) {
+        Output.close();
+      }
+    });
+  }
+}
+
+// Starts NumWorkers threads that consume Input through Function. Function takes an In&& and must not throw.
+template <typename In, typename Func>
+void runSink(WorkerGroup &Group, BoundedQueue<In> &Input, const size_t &NumWorkers, Func Function) {
+  const size_t NumSinkWorkers = NumWorkers > 0 ? NumWorkers : 1;
+
+  for (size_t I = 0; I < NumSinkWorkers; I++) {
+    Group.add([&Input, Function]() mutable {
+      while (auto Item = Input.pop()) {
+        Function(std::move(*Item));
+      }
+    });
+  }
+}
+
+} // namespace ParallaxGenPipeline
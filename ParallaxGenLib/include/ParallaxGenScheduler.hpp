@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ParallaxGenTaskGroup;
+
+// Work-stealing thread pool shared by every stage. Each worker has its own deque, tasks it submits go to the back and
+// it works from the back (newest, still in cache), idle workers steal from the front of the other deques. Threads
+// waiting on a task group run queued tasks meanwhile, so groups can be nested without starving the pool. A task waiting
+// on a nested group only runs tasks of that group, picking up unrelated work could block it on something the waiting
+// task holds (like a memory reservation).
+class ParallaxGenScheduler {
+public:
+  using Task = std::function<void()>;
+
+private:
+  // splits a parallelFor into this many chunks per thread unless a grain is given
+  static constexpr size_t CHUNKS_PER_THREAD = 8;
+
+  struct QueuedTask {
+    Task Function;
+    const ParallaxGenTaskGroup *Group = nullptr; // group the task belongs to, if any
+  };
+
+  struct WorkerQueue {
+    std::mutex QueueMutex;
+    std::deque<QueuedTask> Tasks;
+  };
+
+  // one deque per worker, the last one takes tasks submitted from outside the pool
+  std::vector<std::unique_ptr<WorkerQueue>> Queues;
+  std::vector<std::thread> Workers;
+
+  std::mutex WakeMutex;
+  std::condition_variable WakeUp;
+  std::atomic<size_t> NumQueued = 0;
+  bool Stopping = false;
+
+  static inline size_t ConfiguredThreads = 0; // 0 means one per core
+
+public:
+  explicit ParallaxGenScheduler(const size_t &NumThreads);
+  ParallaxGenScheduler(const ParallaxGenScheduler &) = delete;
+  auto operator=(const ParallaxGenScheduler &) -> ParallaxGenScheduler & = delete;
+  ParallaxGenScheduler(ParallaxGenScheduler &&) = delete;
+  auto operator=(ParallaxGenScheduler &&) -> ParallaxGenScheduler & = delete;
+  ~ParallaxGenScheduler();
+
+  // sets the thread count of the shared scheduler (0 for one per core), has to be called before its first use
+  static void setNumThreads(const size_t &NumThreads);
+  // the shared scheduler, created on first use
+  static auto get() -> ParallaxGenScheduler &;
+
+  [[nodiscard]] auto getNumThreads() const -> size_t { return Workers.size(); }
+
+  // runs one queued task on the calling thread, false if nothing was queued. With a group only its tasks are run
+  auto runPendingTask(const ParallaxGenTaskGroup *Group = nullptr) -> bool;
+
+  // true while the calling thread runs a task of any scheduler
+  [[nodiscard]] static auto isRunningTask() -> bool;
+
+  // calls Function(I) for every I in [Begin, End), Grain indices per task (0 picks a few chunks per thread).
+  // Exceptions are rethrown after the remaining chunks were cancelled
+  template <typename Func> void parallelFor(const size_t &Begin, const size_t &End, Func Function, size_t Grain = 0);
+
+private:
+  friend class ParallaxGenTaskGroup;
+
+  // queues a task, tasks must not throw
+  void submit(Task NewTask, const ParallaxGenTaskGroup *Group = nullptr);
+
+  auto popTask(const size_t &QueueIndex, Task &Out) -> bool;
+  // takes a queued task of Group, newest first from the caller's own deque since that is where its tasks are queued
+  auto popGroupTask(const size_t &QueueIndex, const ParallaxGenTaskGroup *Group, Task &Out) -> bool;
+  static void runTask(Task &CurTask);
+  void workerLoop(const size_t &WorkerIndex);
+  // index of the calling thread's deque
+  [[nodiscard]] auto getQueueIndex() const -> size_t;
+};
+
+// Tasks that are waited on together. The first exception thrown by a task is kept and rethrown by wait(), it also
+// cancels the tasks of the group that haven't started yet.
+class ParallaxGenTaskGroup {
+private:
+  ParallaxGenScheduler &Scheduler;
+
+  std::mutex DoneMutex;
+  std::condition_variable Done;
+  size_t NumPending = 0; // guarded by DoneMutex
+  size_t NumQueued = 0;  // tasks of NumPending that haven't started, guarded by DoneMutex
+  std::atomic<bool> Cancelled = false;
+  std::exception_ptr FirstException; // guarded by DoneMutex
+
+public:
+  explicit ParallaxGenTaskGroup(ParallaxGenScheduler &Scheduler = ParallaxGenScheduler::get());
+  ParallaxGenTaskGroup(const ParallaxGenTaskGroup &) = delete;
+  auto operator=(const ParallaxGenTaskGroup &) -> ParallaxGenTaskGroup & = delete;
+  ParallaxGenTaskGroup(ParallaxGenTaskGroup &&) = delete;
+  auto operator=(ParallaxGenTaskGroup &&) -> ParallaxGenTaskGroup & = delete;
+  // waits for the remaining tasks, exceptions are dropped if wait() wasn't called
+  ~ParallaxGenTaskGroup();
+
+  void run(std::function<void()> Function);
+
+  // tasks that haven't started are skipped, running tasks can poll isCancelled()
+  void cancel() { Cancelled = true; }
+  [[nodiscard]] auto isCancelled() const -> bool { return Cancelled; }
+
+  // runs queued tasks until every task of the group is done, then rethrows the first exception of the group
+  void wait();
+
+private:
+  void waitAll();
+};
+
+template <typename Func>
+void ParallaxGenScheduler::parallelFor(const size_t &Begin, const size_t &End, Func Function, size_t Grain) {
+  if (End <= Begin) {
+    return;
+  }
+
+  if (Grain == 0) {
+    Grain = std::max<size_t>(1, (End - Begin) / (getNumThreads() * CHUNKS_PER_THREAD));
+  }
+
+  ParallaxGenTaskGroup Group(*this);
+  for (size_t ChunkBegin = Begin; ChunkBegin < End; ChunkBegin += Grain) {
+    const size_t ChunkEnd = std::min(End, ChunkBegin + Grain);
+    Group.run([&Function, &Group, ChunkBegin, ChunkEnd]() {
+      for (size_t I = ChunkBegin; I < ChunkEnd && !Group.isCancelled(); I++) {
+        Function(I);
+      }
+    });
+  }
+  Group.wait();
+}
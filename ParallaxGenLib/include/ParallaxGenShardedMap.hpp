@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+// Hash map for caches shared by every worker thread. Keys are spread over independently locked shards so lookups from
+// different threads rarely wait on each other, and lookups only take a shared lock.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, size_t NumShards = 64>
+class ParallaxGenShardedMap {
+private:
+  struct Shard {
+    std::shared_mutex Mutex;
+    std::unordered_map<Key, Value, Hash> Map;
+    std::unordered_map<Key, std::shared_future<Value>, Hash> InFlight; // keys getOrComputeOnce is computing
+  };
+
+  std::array<Shard, NumShards> Shards;
+  Hash Hasher;
+
+  auto getShard(const Key &K) -> Shard & { return Shards[Hasher(K) % NumShards]; }
+
+public:
+  // Returns a copy of the value for K, nullopt if there is none
+  auto find(const Key &K) -> std::optional<Value> {
+    auto &S = getShard(K);
+    const std::shared_lock Lock(S.Mutex);
+    const auto It = S.Map.find(K);
+    if (It == S.Map.end()) {
+      return std::nullopt;
+    }
+
+    return It->second;
+  }
+
+  // Inserts or replaces the value for K
+  void insertOrAssign(const Key &K, Value V) {
+    auto &S = getShard(K);
+    const std::unique_lock Lock(S.Mutex);
+    S.Map.insert_or_assign(K, std::move(V));
+  }
+
+  // Returns the value for K, computing it with Compute() if missing. Compute runs without holding a lock, if two
+  // threads race on the same key the first value stored wins and both return it
+  template <typename Func> auto getOrCompute(const Key &K, Func Compute) -> Value {
+    if (auto Existing = find(K)) {
+      return std::move(*Existing);
+    }
+
+    Value Computed = Compute();
+
+    auto &S = getShard(K);
+    const std::unique_lock Lock(S.Mutex);
+    return S.Map.try_emplace(K, std::move(Computed)).first->second;
+  }
+
+  // getOrCompute, but Compute runs once per key. Threads asking for a key that is being computed wait for that result
+  // instead of computing it again, so Compute must not wait on anything that can ask for the same key. If Compute throws,
+  // the waiting threads get the exception and nothing is stored
+  template <typename Func> auto getOrComputeOnce(const Key &K, Func Compute) -> Value {
+    if (auto Existing = find(K)) {
+      return std::move(*Existing);
+    }
+
+    auto &S = getShard(K);
+    std::promise<Value> Promise;
+    std::shared_future<Value> Pending;
+    {
+      const std::unique_lock Lock(S.Mutex);
+      if (const auto It = S.Map.find(K); It != S.Map.end()) {
+        return It->second;
+      }
+
+      const auto [It, Inserted] = S.InFlight.try_emplace(K);
+      if (Inserted) {
+        It->second = Promise.get_future().share();
+      } else {
+        Pending = It->second;
+      }
+    }
+
+    if (Pending.valid()) {
+      return Pending.get();
+    }
+
+    try {
+      Value Computed = Compute();
+      {
+        const std::unique_lock Lock(S.Mutex);
+        S.Map.try_emplace(K, Computed);
+        S.InFlight.erase(K);
+      }
+      Promise.set_value(Computed);
+      return Computed;
+    } catch (...) {
+      {
+        const std::unique_lock Lock(S.Mutex);
+        S.InFlight.erase(K);
+      }
+      Promise.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+  void clear() {
+    for (auto &S : Shards) {
+      const std::unique_lock Lock(S.Mutex);
+      S.Map.clear();
+    }
+  }
+
+  [[nodiscard]] auto size() -> size_t {
+    size_t Size = 0;
+    for (auto &S : Shards) {
+      const std::shared_lock Lock(S.Mutex);
+      Size += S.Map.size();
+    }
+    return Size;
+  }
+};
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <chrono>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 #define FULL_PERCENTAGE 100
@@ -20,6 +22,11 @@ private:
 
   std::unordered_map<PGResult, size_t> NumJobsCompleted;
 
+  // Worker timing, used to report how long each worker sat idle during the task
+  std::chrono::steady_clock::time_point StartTime;
+  std::mutex WorkerBusyTimeMutex;
+  std::unordered_map<std::thread::id, std::chrono::nanoseconds> WorkerBusyTime;
+
   std::unordered_map<PGResult, std::string> PGResultStr = {{PGResult::SUCCESS, "COMPLETED"},
                                                            {PGResult::SUCCESS_WITH_WARNINGS, "COMPLETED WITH WARNINGS"},
                                                            {PGResult::FAILURE, "FAILED"}};
@@ -33,6 +40,12 @@ public:
   void printJobSummary();
   [[nodiscard]] auto getCompletedJobs() -> size_t;
 
+  // Adds time spent on a job to the calling worker thread
+  void addWorkerBusyTime(const std::chrono::nanoseconds &BusyTime);
+  // Prints idle time of each worker since the task started, has to be called from the thread that waited on the task.
+  // That thread counts as one more worker if it ran jobs
+  void printWorkerIdleSummary(const size_t &NumWorkers);
+
   static void updatePGResult(PGResult &Result, const PGResult &CurrentResult,
                              const PGResult &Threshold = PGResult::FAILURE);
 };
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "DDSUtil.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Texture analysis kept between runs, DDS metadata and complex material verdicts. A record only describes the bytes
+// it was made from, so it is keyed by where the texture is read from, its size and its modification time on top of
+// its path.
+class ParallaxGenTextureDB {
+public:
+  // Identifies the bytes of a texture without reading them
+  struct Source {
+    std::wstring Archive; // BSA file name, empty for loose files
+    uint64_t Size = 0;
+    int64_t ModifiedTime = 0; // of the loose file or the BSA
+
+    auto operator==(const Source &Other) const -> bool = default;
+  };
+
+  struct Record {
+    Source TextureSource;
+    std::optional<DDSUtil::DDSHeaderInfo> Metadata;
+    std::optional<bool> IsComplexMaterial;
+  };
+
+private:
+  std::filesystem::path DBPath;
+
+  std::mutex RecordsMutex;
+  std::unordered_map<std::wstring, Record> Records; // by path relative to the data directory
+  bool Changed = false;
+
+public:
+  explicit ParallaxGenTextureDB(std::filesystem::path DBPath);
+
+  // name of the database file
+  [[nodiscard]] static auto getDBName() -> std::filesystem::path;
+
+  // Records saved by a previous run, empty if there are none or they are from another version. Nothing is kept, the
+  // caller puts back the ones that are still current with restore()
+  auto load() -> std::vector<std::pair<std::filesystem::path, Record>>;
+  // Writes the records if any changed since loading
+  void save();
+
+  // all functions below are thread safe
+  void restore(const std::filesystem::path &Path, Record Existing);
+  [[nodiscard]] auto find(const std::filesystem::path &Path) -> std::optional<Record>;
+
+  // Adds to the record of Path, a record made from another source is replaced
+  void setMetadata(const std::filesystem::path &Path, const Source &TextureSource,
+                   const DDSUtil::DDSHeaderInfo &Metadata);
+  void setComplexMaterial(const std::filesystem::path &Path, const Source &TextureSource,
+                          const bool &IsComplexMaterial);
+
+private:
+  // record of Path made from TextureSource, created if missing. Needs RecordsMutex
+  auto getRecord(const std::filesystem::path &Path, const Source &TextureSource) -> Record &;
+};
@@ -3,8 +3,12 @@
 #include <windows.h>
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <span>
 #include <unordered_set>
+#include <vector>
 
 namespace ParallaxGenUtil {
 
@@ -12,8 +16,32 @@ namespace ParallaxGenUtil {
 auto strToWstr(const std::string &Str) -> std::wstring;
 auto wstrToStr(const std::wstring &Str) -> std::string;
 
-// Get the file bytes of a file
-auto getFileBytes(const std::filesystem::path &FilePath) -> std::vector<std::byte>;
+// Get the file bytes of a file, at most MaxBytes from its start
+auto getFileBytes(const std::filesystem::path &FilePath,
+                  const size_t &MaxBytes = SIZE_MAX) -> std::vector<std::byte>;
+
+// Write bytes to a file in a single call, creating parent directories if needed. Returns false on failure
+auto writeFileBytes(const std::filesystem::path &FilePath, std::span<const std::byte> Bytes) -> bool;
+
+// Read-only memory map of a whole file, parsed in place instead of being read into a buffer
+class MappedFile {
+private:
+  const std::byte *View = nullptr;
+  size_t Size = 0;
+
+public:
+  MappedFile() = default;
+  // maps FilePath, the map is empty if the file can't be opened or is empty
+  explicit MappedFile(const std::filesystem::path &FilePath);
+  MappedFile(const MappedFile &) = delete;
+  auto operator=(const MappedFile &) -> MappedFile & = delete;
+  MappedFile(MappedFile &&Other) noexcept;
+  auto operator=(MappedFile &&Other) noexcept -> MappedFile &;
+  ~MappedFile();
+
+  [[nodiscard]] auto isOpen() const -> bool { return View != nullptr; }
+  [[nodiscard]] auto getBytes() const -> std::span<const std::byte> { return {View, Size}; }
+};
 
 // Template Functions
 template <typename T> auto isInVector(const std::vector<T> &Vec, const T &Test) -> bool {
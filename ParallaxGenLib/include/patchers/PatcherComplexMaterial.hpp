@@ -31,15 +31,14 @@ public:
                          ParallaxGenD3D *PGD3D);
 
   // check if complex material should be enabled on shape
-  auto shouldApply(nifly::NiShape *NIFShape, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots,
-                   bool &EnableResult, bool &EnableDynCubemaps,
+  auto shouldApply(const NIFUtil::ShapeMaterialView &View, bool &EnableResult, bool &EnableDynCubemaps,
                    std::wstring &MatchedPath) const -> ParallaxGenTask::PGResult;
 
   static auto shouldApplySlots(const std::array<std::wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots,
                         std::wstring &MatchedPath, bool &EnableDynCubemaps, const std::wstring &NIFPath) -> bool;
 
   // enables complex material on a shape in a NIF
-  auto applyPatch(nifly::NiShape *NIFShape, const std::wstring &MatchedPath, const bool &ApplyDynCubemaps,
+  auto applyPatch(const NIFUtil::ShapeMaterialView &View, const std::wstring &MatchedPath, const bool &ApplyDynCubemaps,
                   bool &NIFModified) const -> ParallaxGenTask::PGResult;
 
   static auto applyPatchSlots(const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots, const std::wstring &MatchedPath, const bool &ApplyDynCubemaps) -> std::array<std::wstring, NUM_TEXTURE_SLOTS>;
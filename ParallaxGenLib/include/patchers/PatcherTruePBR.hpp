@@ -48,15 +48,14 @@ public:
   static void loadPatcherBuffers(const std::vector<std::filesystem::path> &PBRJSONs, ParallaxGenDirectory *PGD);
 
   // check if truepbr should be enabled on shape
-  auto shouldApply(nifly::NiShape *NIFShape, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes,
-                   bool &EnableResult,
+  auto shouldApply(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
                    std::map<size_t, std::tuple<nlohmann::json, std::wstring>> &TruePBRData) -> ParallaxGenTask::PGResult;
 
   static auto shouldApplySlots(const std::wstring &LogPrefix, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::wstring &NIFPath, std::map<size_t, std::tuple<nlohmann::json, std::wstring>> &TruePBRData) -> bool;
 
   // applies truepbr config on a shape in a NIF (always applies with config, but
   // maybe PBR is disabled)
-  auto applyPatch(nifly::NiShape *NIFShape, nlohmann::json &TruePBRData, const std::wstring &MatchedPath,
+  auto applyPatch(const NIFUtil::ShapeMaterialView &View, nlohmann::json &TruePBRData, const std::wstring &MatchedPath,
                   bool &NIFModified, bool &ShapeDeleted) const -> ParallaxGenTask::PGResult;
 
   static auto applyPatchSlots(const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots, const nlohmann::json &TruePBRData, const std::wstring &MatchedPath) -> std::array<std::wstring, NUM_TEXTURE_SLOTS>;
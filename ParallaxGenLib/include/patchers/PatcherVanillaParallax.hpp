@@ -27,14 +27,21 @@ public:
                          ParallaxGenConfig *PGC, ParallaxGenD3D *PGD3D);
 
   // check if vanilla parallax should be enabled on shape
-  auto shouldApply(nifly::NiShape *NIFShape, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots,
-                   bool &EnableResult, std::wstring &MatchedPath) const -> ParallaxGenTask::PGResult;
+  auto shouldApply(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
+                   std::wstring &MatchedPath) const -> ParallaxGenTask::PGResult;
+
+  // checks of the shape itself (havok, skinning), these can't be shared between shapes
+  [[nodiscard]] auto shouldApplyShape(const NIFUtil::ShapeMaterialView &View) const -> bool;
+
+  // checks that only depend on the shape's material and textures, shapes with the same material get the same result
+  auto shouldApplyMaterial(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
+                           std::wstring &MatchedPath) const -> ParallaxGenTask::PGResult;
 
   static auto shouldApplySlots(const std::array<std::wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots,
                         std::wstring &MatchedPath) -> bool;
 
   // enables parallax on a shape in a NIF
-  auto applyPatch(nifly::NiShape *NIFShape, const std::wstring &MatchedPath,
+  auto applyPatch(const NIFUtil::ShapeMaterialView &View, const std::wstring &MatchedPath,
                   bool &NIFModified) -> ParallaxGenTask::PGResult;
 
   static auto applyPatchSlots(const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots, const std::wstring &MatchedPath) -> std::array<std::wstring, NUM_TEXTURE_SLOTS>;
@@ -1,6 +1,7 @@
 #include "BethesdaDirectory.hpp"
 
 #include "BethesdaGame.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
 #include "ParallaxGenUtil.hpp"
 
 #include <bsa/tes4.hpp>
@@ -10,6 +11,9 @@
 #include <binary_io/memory_stream.hpp>
 #include <binary_io/any_stream.hpp>
 
+#include <lz4frame.h>
+#include <zlib.h>
+
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -28,6 +32,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -45,6 +50,9 @@
 using namespace std;
 using namespace ParallaxGenUtil;
 
+// Share of the memory budget the file cache may hold, the rest is left for work in flight
+constexpr size_t FILE_CACHE_BUDGET_PERCENT = 50;
+
 BethesdaDirectory::BethesdaDirectory(BethesdaGame &BG, const bool &Logging) : Logging(Logging), BG(BG) {
   // Assign instance vars
   DataDir = filesystem::path(this->BG.getGameDataPath());
@@ -87,9 +95,17 @@ auto BethesdaDirectory::checkGlob(const wstring &Str, const vector<wstring> &Glo
   return std::ranges::any_of(GlobListCstr, [&](LPCWSTR Glob) { return PathMatchSpecW(StrCstr, Glob); });
 }
 
+void BethesdaDirectory::enableLowMemoryFileMap(const filesystem::path &TablePath) { FileTablePath = TablePath; }
+
 void BethesdaDirectory::populateFileMap(bool IncludeBSAs) {
   // clear map before populating
   FileMap.clear();
+  FileTable.close();
+  FileTableSources.clear();
+
+  if (!FileTablePath.empty()) {
+    FileTableBuilder = make_unique<ParallaxGenFileTable::Builder>();
+  }
 
   if (IncludeBSAs) {
     // add BSA files to file map
@@ -98,9 +114,50 @@ void BethesdaDirectory::populateFileMap(bool IncludeBSAs) {
 
   // add loose files to file map
   addLooseFilesToMap();
+
+  if (FileTableBuilder == nullptr) {
+    return;
+  }
+
+  const size_t NumFiles = FileTableBuilder->size();
+  const bool TableReady = FileTableBuilder->write(FileTablePath) && FileTable.open(FileTablePath);
+  FileTableBuilder.reset();
+
+  if (!TableReady) {
+    if (Logging) {
+      spdlog::warn("Unable to keep the file map on disk, it will be kept in memory instead");
+    }
+
+    FileTablePath.clear();
+    populateFileMap(IncludeBSAs);
+    return;
+  }
+
+  if (Logging) {
+    spdlog::info(L"File map with {} files is kept on disk: {}", NumFiles, FileTablePath.wstring());
+  }
 }
 
-auto BethesdaDirectory::getFileMap() const -> const map<filesystem::path, BethesdaDirectory::BethesdaFile>& { return FileMap; }
+void BethesdaDirectory::forEachFile(const wstring &Prefix,
+                                    const function<void(const filesystem::path &, const BethesdaFile &)> &Visitor) const {
+  if (FileTable.isOpen()) {
+    for (size_t I = FileTable.lowerBound(Prefix); I < FileTable.size(); I++) {
+      const auto Entry = FileTable.at(I);
+      if (!Entry.Key.starts_with(Prefix)) {
+        break;
+      }
+
+      Visitor(filesystem::path(Entry.Key), getFileFromTableEntry(Entry));
+    }
+    return;
+  }
+
+  // Paths compare by component, the first file in a directory is the lower bound of the directory itself
+  for (auto It = FileMap.lower_bound(filesystem::path(Prefix));
+       It != FileMap.end() && boost::istarts_with(It->first.wstring(), Prefix); ++It) {
+    Visitor(It->first, It->second);
+  }
+}
 
 auto BethesdaDirectory::getFile(const filesystem::path &RelPath, const bool &CacheFile) -> vector<std::byte> {
   // find bsa/loose file to open
@@ -122,7 +179,7 @@ auto BethesdaDirectory::getFile(const filesystem::path &RelPath, const bool &Cac
         spdlog::trace(L"Reading file from cache: {}", RelPath.wstring());
       }
 
-      return FileCache[LowerRelPath];
+      return *FileCache[LowerRelPath];
     }
   }
 
@@ -145,7 +202,7 @@ auto BethesdaDirectory::getFile(const filesystem::path &RelPath, const bool &Cac
 
     // this is a bsa archive file
     const bsa::tes4::version BSAVersion = BSAStruct->Version;
-    const bsa::tes4::archive BSAObj = BSAStruct->Archive;
+    const bsa::tes4::archive &BSAObj = BSAStruct->Archive;
 
     string ParentPath = wstrToStr(RelPath.parent_path().wstring());
     string Filename = wstrToStr(RelPath.filename().wstring());
@@ -177,18 +234,226 @@ auto BethesdaDirectory::getFile(const filesystem::path &RelPath, const bool &Cac
     return {};
   }
 
-  // cache file if flag is set
+  // cache file if flag is set and the cache is within its share of the memory budget
   if (CacheFile) {
     const lock_guard<mutex> Lock(FileCacheMutex);
-    FileCache[LowerRelPath] = OutFileBytes;
+    auto &Governor = ParallaxGenMemoryGovernor::get();
+    if (FileCache.find(LowerRelPath) == FileCache.end() &&
+        FileCacheBytes + OutFileBytes.size() <= Governor.getBudget() / 100 * FILE_CACHE_BUDGET_PERCENT) {
+      if (auto Memory = Governor.tryReserve(OutFileBytes.size())) {
+        FileCacheBytes += OutFileBytes.size();
+        FileCacheMemory.push_back(std::move(*Memory));
+        FileCache[LowerRelPath] = make_shared<const vector<std::byte>>(OutFileBytes);
+      }
+    }
   }
 
   return OutFileBytes;
 }
 
+auto BethesdaDirectory::getFileView(const filesystem::path &RelPath) -> FileView {
+  FileView View;
+
+  const BethesdaFile File = getFileFromMap(RelPath);
+  if (File.Path.empty()) {
+    if (Logging) {
+      spdlog::error(L"File not found in file map: {}", RelPath.wstring());
+      return View;
+    }
+
+    throw runtime_error("File not found in file map");
+  }
+
+  // A cached file is already in memory
+  {
+    const lock_guard<mutex> Lock(FileCacheMutex);
+    const auto It = FileCache.find(getPathLower(RelPath));
+    if (It != FileCache.end()) {
+      View.CachedBytes = It->second;
+      View.Bytes = *View.CachedBytes;
+      return View;
+    }
+  }
+
+  if (File.BSAFile == nullptr) {
+    if (Logging) {
+      spdlog::trace(L"Mapping loose file from BethesdaDirectory: {}", RelPath.wstring());
+    }
+
+    View.Mapping = ParallaxGenUtil::MappedFile(DataDir / RelPath);
+    View.Bytes = View.Mapping.getBytes();
+    return View;
+  }
+
+  const bsa::tes4::archive &BSAObj = File.BSAFile->Archive;
+  const auto BSAEntry = BSAObj[wstrToStr(RelPath.parent_path().wstring())][wstrToStr(RelPath.filename().wstring())];
+  if (BSAEntry && !BSAEntry->compressed()) {
+    // Stored bytes are a view into the mapped archive
+    View.Archive = File.BSAFile;
+    View.Bytes = BSAEntry->as_bytes();
+    return View;
+  }
+
+  View.ExtractedBytes = getFile(RelPath);
+  return View;
+}
+
+auto BethesdaDirectory::readFilePrefix(const filesystem::path &RelPath,
+                                       const size_t &NumBytes) -> vector<std::byte> {
+  const BethesdaFile File = getFileFromMap(RelPath);
+  if (File.Path.empty()) {
+    if (Logging) {
+      spdlog::error(L"File not found in file map: {}", RelPath.wstring());
+    } else {
+      throw runtime_error("File not found in file map");
+    }
+  }
+
+  // A cached file is already in memory
+  {
+    const lock_guard<mutex> Lock(FileCacheMutex);
+    const auto It = FileCache.find(getPathLower(RelPath));
+    if (It != FileCache.end()) {
+      const auto &Cached = *It->second;
+      return {Cached.begin(), Cached.begin() + static_cast<ptrdiff_t>(min(NumBytes, Cached.size()))};
+    }
+  }
+
+  const shared_ptr<BSAFile> BSAStruct = File.BSAFile;
+  if (BSAStruct == nullptr) {
+    return getFileBytes(DataDir / RelPath, NumBytes);
+  }
+
+  const bsa::tes4::archive &BSAObj = BSAStruct->Archive;
+  const auto BSAEntry = BSAObj[wstrToStr(RelPath.parent_path().wstring())][wstrToStr(RelPath.filename().wstring())];
+  if (!BSAEntry) {
+    if (Logging) {
+      spdlog::error(L"File not found in BSA archive: {}", RelPath.wstring());
+      return {};
+    }
+
+    throw runtime_error("File not found in BSA archive");
+  }
+
+  // Stored bytes are a view into the mapped archive
+  const auto Stored = BSAEntry->as_bytes();
+  if (!BSAEntry->compressed()) {
+    return {Stored.begin(), Stored.begin() + static_cast<ptrdiff_t>(min(NumBytes, Stored.size()))};
+  }
+
+  vector<std::byte> OutFileBytes(min(NumBytes, BSAEntry->decompressed_size()));
+  if (!decompressPrefix(Stored, BSAStruct->Version, OutFileBytes)) {
+    // Extract the whole file instead
+    if (Logging) {
+      spdlog::trace(L"Partial decompression failed, reading all of {}", RelPath.wstring());
+    }
+
+    OutFileBytes = getFile(RelPath);
+    OutFileBytes.resize(min(NumBytes, OutFileBytes.size()));
+  }
+
+  return OutFileBytes;
+}
+
+auto BethesdaDirectory::decompressPrefix(span<const std::byte> Compressed, const bsa::tes4::version &Version,
+                                         span<std::byte> Out) -> bool {
+  if (Out.empty()) {
+    return true;
+  }
+
+  if (Version == bsa::tes4::version::sse) {
+    LZ4F_dctx *Context = nullptr;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&Context, LZ4F_VERSION)) != 0U) {
+      return false;
+    }
+
+    size_t InPos = 0;
+    size_t OutPos = 0;
+    while (OutPos < Out.size() && InPos < Compressed.size()) {
+      size_t OutSize = Out.size() - OutPos;
+      size_t InSize = Compressed.size() - InPos;
+      const size_t Hint =
+          LZ4F_decompress(Context, Out.data() + OutPos, &OutSize, Compressed.data() + InPos, &InSize, nullptr);
+      if (LZ4F_isError(Hint) != 0U || (OutSize == 0 && InSize == 0)) {
+        break;
+      }
+
+      OutPos += OutSize;
+      InPos += InSize;
+      if (Hint == 0) {
+        // end of frame
+        break;
+      }
+    }
+
+    LZ4F_freeDecompressionContext(Context);
+    return OutPos == Out.size();
+  }
+
+  z_stream Stream{};
+  if (inflateInit(&Stream) != Z_OK) {
+    return false;
+  }
+
+  // zlib doesn't write through next_in
+  Stream.next_in = reinterpret_cast<Bytef *>(const_cast<std::byte *>(Compressed.data())); // NOLINT
+  Stream.avail_in = static_cast<uInt>(Compressed.size());
+  Stream.next_out = reinterpret_cast<Bytef *>(Out.data()); // NOLINT
+  Stream.avail_out = static_cast<uInt>(Out.size());
+
+  int Result = Z_OK;
+  while (Result == Z_OK && Stream.avail_out > 0) {
+    Result = inflate(&Stream, Z_SYNC_FLUSH);
+  }
+
+  inflateEnd(&Stream);
+  return Stream.avail_out == 0;
+}
+
+auto BethesdaDirectory::getFileSize(const filesystem::path &RelPath) const -> size_t {
+  return getFileFromMap(RelPath).Size;
+}
+
+auto BethesdaDirectory::getFilesBySizeDesc(const unordered_set<filesystem::path> &Files) const
+    -> vector<filesystem::path> {
+  // Look up sizes once before sorting
+  vector<pair<size_t, filesystem::path>> SizedFiles;
+  SizedFiles.reserve(Files.size());
+  for (const auto &File : Files) {
+    SizedFiles.emplace_back(getFileSize(File), File);
+  }
+
+  // Largest first, ties broken by path so the order is deterministic
+  sort(SizedFiles.begin(), SizedFiles.end(), [](const auto &A, const auto &B) {
+    if (A.first != B.first) {
+      return A.first > B.first;
+    }
+    return A.second < B.second;
+  });
+
+  vector<filesystem::path> OutFiles;
+  OutFiles.reserve(SizedFiles.size());
+  for (auto &[Size, File] : SizedFiles) {
+    OutFiles.push_back(std::move(File));
+  }
+
+  return OutFiles;
+}
+
 auto BethesdaDirectory::clearCache() -> void {
   const lock_guard<mutex> Lock(FileCacheMutex);
   FileCache.clear();
+  FileCacheMemory.clear();
+  FileCacheBytes = 0;
+}
+
+auto BethesdaDirectory::getFileSource(const filesystem::path &RelPath) const -> filesystem::path {
+  const BethesdaFile File = getFileFromMap(RelPath);
+  if (File.BSAFile == nullptr) {
+    return {};
+  }
+
+  return File.BSAFile->Path;
 }
 
 auto BethesdaDirectory::isLooseFile(const filesystem::path &RelPath) const -> bool {
@@ -207,6 +472,13 @@ auto BethesdaDirectory::isFile(const filesystem::path &RelPath) const -> bool {
 }
 
 auto BethesdaDirectory::isPrefix(const filesystem::path &RelPath) const -> bool {
+  if (FileTable.isOpen()) {
+    // Every key starting with the prefix is sorted right at its lower bound
+    const wstring Prefix = getPathLower(RelPath).wstring();
+    const size_t Index = FileTable.lowerBound(Prefix);
+    return Index < FileTable.size() && FileTable.at(Index).Key.starts_with(Prefix);
+  }
+
   auto It = FileMap.lower_bound(RelPath);
   if (It == FileMap.end()) {
     return false;
@@ -238,7 +510,7 @@ auto BethesdaDirectory::findFiles(const bool &Lower, const vector<wstring> &Glob
   LPCWSTR LastWinningGlobArchiveDeny = L"";
 
   // loop through filemap and match keys
-  for (const auto &[key, value] : FileMap) {
+  forEachFile(L"", [&](const filesystem::path &key, const BethesdaFile &value) {
     const filesystem::path CurFilePath = value.Path;
 
     // Check globs
@@ -247,12 +519,12 @@ auto BethesdaDirectory::findFiles(const bool &Lower, const vector<wstring> &Glob
 
     // Check allowlist
     if (!GlobListAllowCstr.empty() && !checkGlob(KeyCstr, LastWinningGlobAllow, GlobListAllowCstr)) {
-      continue;
+      return;
     }
 
     // Check denylist
     if (!GlobListDenyCstr.empty() && checkGlob(KeyCstr, LastWinningGlobDeny, GlobListDenyCstr)) {
-      continue;
+      return;
     }
 
     // Verify BSA blocklist
@@ -262,7 +534,7 @@ auto BethesdaDirectory::findFiles(const bool &Lower, const vector<wstring> &Glob
       LPCWSTR BSAFile = BSAFileWstr.c_str();
 
       if (checkGlob(BSAFile, LastWinningGlobArchiveDeny, ArchiveListDenyCstr)) {
-        continue;
+        return;
       }
     }
 
@@ -271,7 +543,7 @@ auto BethesdaDirectory::findFiles(const bool &Lower, const vector<wstring> &Glob
       if (Logging) {
         spdlog::warn(L"Skipping file with non-ASCII characters: {}", key.wstring());
       }
-      continue;
+      return;
     }
 
     // If not allowed, skip
@@ -288,7 +560,7 @@ auto BethesdaDirectory::findFiles(const bool &Lower, const vector<wstring> &Glob
     } else {
       FoundFiles.push_back(CurFilePath);
     }
-  }
+  });
 
   return FoundFiles;
 }
@@ -336,7 +608,7 @@ void BethesdaDirectory::addLooseFilesToMap() {
           spdlog::trace(L"Adding loose file to map: {}", RelativePath.wstring());
         }
 
-        updateFileMap(RelativePath, nullptr);
+        updateFileMap(RelativePath, nullptr, Entry.file_size());
       }
     } catch (const std::exception &E) {
       if (Logging) {
@@ -386,6 +658,9 @@ void BethesdaDirectory::addBSAToFileMap(const wstring &BSAName) {
         const string_view CurEntry = Entry.first.name();
         const filesystem::path CurPath = FolderName / CurEntry;
 
+        // size is stored in the entry header, no need to extract
+        const size_t CurSize = Entry.second.compressed() ? Entry.second.decompressed_size() : Entry.second.size();
+
         // chekc if we should ignore this file
         if (!isFileAllowed(CurPath)) {
           continue;
@@ -396,7 +671,7 @@ void BethesdaDirectory::addBSAToFileMap(const wstring &BSAName) {
         }
 
         // add to filemap
-        updateFileMap(CurPath, BSAStructPtr);
+        updateFileMap(CurPath, BSAStructPtr, CurSize);
       }
     } catch (const std::exception &E) {
       if (Logging) {
@@ -587,6 +862,15 @@ auto BethesdaDirectory::isPathAscii(const filesystem::path &Path) -> bool {
 auto BethesdaDirectory::getFileFromMap(const filesystem::path &FilePath) const -> BethesdaDirectory::BethesdaFile {
   const filesystem::path LowerPath = getPathLower(FilePath);
 
+  if (FileTable.isOpen()) {
+    const auto Entry = FileTable.find(LowerPath.wstring());
+    if (!Entry.has_value()) {
+      return BethesdaFile{filesystem::path(), nullptr};
+    }
+
+    return getFileFromTableEntry(*Entry);
+  }
+
   if (FileMap.find(LowerPath) == FileMap.end()) {
     return BethesdaFile{filesystem::path(), nullptr};
   }
@@ -595,14 +879,34 @@ auto BethesdaDirectory::getFileFromMap(const filesystem::path &FilePath) const -
 }
 
 void BethesdaDirectory::updateFileMap(const filesystem::path &FilePath,
-                                      shared_ptr<BethesdaDirectory::BSAFile> BSAFile) {
+                                      shared_ptr<BethesdaDirectory::BSAFile> BSAFile, const size_t &FileSize) {
   const filesystem::path LowerPath = getPathLower(FilePath);
 
-  const BethesdaFile NewBFile = {FilePath, std::move(BSAFile)};
+  if (FileTableBuilder != nullptr) {
+    // BSAs are added one after another, so only the last source can repeat
+    uint32_t Source = ParallaxGenFileTable::NO_SOURCE;
+    if (BSAFile != nullptr) {
+      if (FileTableSources.empty() || FileTableSources.back() != BSAFile) {
+        FileTableSources.push_back(BSAFile);
+      }
+      Source = static_cast<uint32_t>(FileTableSources.size() - 1);
+    }
+
+    FileTableBuilder->add(LowerPath.wstring(), FilePath.wstring(), Source, FileSize);
+    return;
+  }
+
+  const BethesdaFile NewBFile = {FilePath, std::move(BSAFile), FileSize};
 
   FileMap[LowerPath] = NewBFile;
 }
 
+auto BethesdaDirectory::getFileFromTableEntry(const ParallaxGenFileTable::Entry &Entry) const
+    -> BethesdaDirectory::BethesdaFile {
+  const auto BSAFile = Entry.Source == ParallaxGenFileTable::NO_SOURCE ? nullptr : FileTableSources[Entry.Source];
+  return {filesystem::path(Entry.Path), BSAFile, static_cast<size_t>(Entry.Size)};
+}
+
 auto BethesdaDirectory::isFileInBSA(const filesystem::path &File, const std::unordered_set<std::wstring> &BSAFiles) -> bool {
   if (isBSAFile(File)) {
     BethesdaFile const BethFile = getFileFromMap(File);
@@ -0,0 +1,216 @@
+#include "DDSUtil.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+namespace {
+constexpr uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+constexpr uint32_t DDS_HEADER_SIZE = 124;
+constexpr uint32_t DDS_PIXELFORMAT_SIZE = 32;
+constexpr size_t DDS_LEGACY_HEADER_END = 4 + DDS_HEADER_SIZE;
+
+// byte offsets from the start of the file
+constexpr size_t OFFSET_HEADER_SIZE = 4;
+constexpr size_t OFFSET_FLAGS = 8;
+constexpr size_t OFFSET_HEIGHT = 12;
+constexpr size_t OFFSET_WIDTH = 16;
+constexpr size_t OFFSET_DEPTH = 24;
+constexpr size_t OFFSET_MIP_COUNT = 28;
+constexpr size_t OFFSET_PF_SIZE = 76;
+constexpr size_t OFFSET_PF_FLAGS = 80;
+constexpr size_t OFFSET_PF_FOURCC = 84;
+constexpr size_t OFFSET_PF_BIT_COUNT = 88;
+constexpr size_t OFFSET_PF_MASKS = 92; // R, G, B, A
+constexpr size_t OFFSET_CAPS2 = 112;
+constexpr size_t OFFSET_DX10_FORMAT = DDS_LEGACY_HEADER_END;
+constexpr size_t OFFSET_DX10_DIMENSION = DDS_LEGACY_HEADER_END + 4;
+constexpr size_t OFFSET_DX10_MISC_FLAG = DDS_LEGACY_HEADER_END + 8;
+constexpr size_t OFFSET_DX10_ARRAY_SIZE = DDS_LEGACY_HEADER_END + 12;
+constexpr size_t OFFSET_DX10_MISC_FLAGS2 = DDS_LEGACY_HEADER_END + 16;
+
+constexpr uint32_t DDS_HEADER_FLAGS_VOLUME = 0x00800000;
+constexpr uint32_t DDS_FOURCC = 0x00000004;
+constexpr uint32_t DDS_RGB = 0x00000040;
+constexpr uint32_t DDS_CUBEMAP = 0x00000200;
+constexpr uint32_t DDS_CUBEMAP_ALLFACES = 0x0000FC00;
+
+// D3D11_RESOURCE_DIMENSION / TEX_DIMENSION share these values
+constexpr uint32_t DIMENSION_TEXTURE1D = 2;
+constexpr uint32_t DIMENSION_TEXTURE2D = 3;
+constexpr uint32_t DIMENSION_TEXTURE3D = 4;
+
+constexpr uint32_t TEX_MISC_TEXTURECUBE = 0x4;
+constexpr uint32_t TEX_ALPHA_MODE_PREMULTIPLIED = 2;
+
+// DXGI_FORMAT values
+constexpr uint32_t DXGI_R32G32B32A32_FLOAT = 2;
+constexpr uint32_t DXGI_R16G16B16A16_FLOAT = 10;
+constexpr uint32_t DXGI_R16G16B16A16_UNORM = 11;
+constexpr uint32_t DXGI_R8G8B8A8_UNORM = 28;
+constexpr uint32_t DXGI_BC1_UNORM = 71;
+constexpr uint32_t DXGI_BC2_UNORM = 74;
+constexpr uint32_t DXGI_BC3_UNORM = 77;
+constexpr uint32_t DXGI_BC4_UNORM = 80;
+constexpr uint32_t DXGI_BC4_SNORM = 81;
+constexpr uint32_t DXGI_BC5_UNORM = 83;
+constexpr uint32_t DXGI_BC5_SNORM = 84;
+constexpr uint32_t DXGI_B8G8R8A8_UNORM = 87;
+constexpr uint32_t DXGI_LAST_FORMAT = 115; // B4G4R4A4_UNORM
+
+constexpr size_t MAX_MIP_LEVELS = 15; // D3D11 limit, 16384 pixels
+
+constexpr auto makeFourCC(const char (&Code)[5]) -> uint32_t {
+  return static_cast<uint32_t>(static_cast<uint8_t>(Code[0])) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(Code[1])) << 8U) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(Code[2])) << 16U) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(Code[3])) << 24U);
+}
+
+auto readU32(span<const std::byte> Bytes, const size_t &Offset) -> uint32_t {
+  uint32_t Value = 0;
+  memcpy(&Value, Bytes.data() + Offset, sizeof(Value));
+  return Value;
+}
+
+struct LegacyFormat {
+  uint32_t Format = 0;
+  bool Premultiplied = false;
+};
+
+// The common legacy pixel formats, anything else returns format 0
+auto getLegacyFormat(span<const std::byte> Bytes) -> LegacyFormat {
+  const uint32_t Flags = readU32(Bytes, OFFSET_PF_FLAGS);
+
+  if ((Flags & DDS_FOURCC) != 0U) {
+    const uint32_t FourCC = readU32(Bytes, OFFSET_PF_FOURCC);
+    static const array<pair<uint32_t, LegacyFormat>, 14> FourCCFormats = {{
+        {makeFourCC("DXT1"), {DXGI_BC1_UNORM, false}},
+        {makeFourCC("DXT2"), {DXGI_BC2_UNORM, true}},
+        {makeFourCC("DXT3"), {DXGI_BC2_UNORM, false}},
+        {makeFourCC("DXT4"), {DXGI_BC3_UNORM, true}},
+        {makeFourCC("DXT5"), {DXGI_BC3_UNORM, false}},
+        {makeFourCC("ATI1"), {DXGI_BC4_UNORM, false}},
+        {makeFourCC("BC4U"), {DXGI_BC4_UNORM, false}},
+        {makeFourCC("BC4S"), {DXGI_BC4_SNORM, false}},
+        {makeFourCC("ATI2"), {DXGI_BC5_UNORM, false}},
+        {makeFourCC("BC5U"), {DXGI_BC5_UNORM, false}},
+        {makeFourCC("BC5S"), {DXGI_BC5_SNORM, false}},
+        // D3DFORMAT values stored as the FourCC
+        {36, {DXGI_R16G16B16A16_UNORM, false}},
+        {113, {DXGI_R16G16B16A16_FLOAT, false}},
+        {116, {DXGI_R32G32B32A32_FLOAT, false}},
+    }};
+
+    const auto *It = find_if(FourCCFormats.begin(), FourCCFormats.end(),
+                             [&FourCC](const auto &Entry) { return Entry.first == FourCC; });
+    return It != FourCCFormats.end() ? It->second : LegacyFormat{};
+  }
+
+  if ((Flags & DDS_RGB) != 0U && readU32(Bytes, OFFSET_PF_BIT_COUNT) == 32) {
+    const array<uint32_t, 4> Masks = {readU32(Bytes, OFFSET_PF_MASKS), readU32(Bytes, OFFSET_PF_MASKS + 4),
+                                      readU32(Bytes, OFFSET_PF_MASKS + 8), readU32(Bytes, OFFSET_PF_MASKS + 12)};
+    if (Masks == array<uint32_t, 4>{0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000}) {
+      return {DXGI_R8G8B8A8_UNORM, false};
+    }
+    if (Masks == array<uint32_t, 4>{0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000}) {
+      return {DXGI_B8G8R8A8_UNORM, false};
+    }
+  }
+
+  return {};
+}
+
+// Mips in a full chain down to 1x1x1
+auto getMaxMipLevels(size_t Width, size_t Height, size_t Depth) -> size_t {
+  size_t Levels = 1;
+  while (Width > 1 || Height > 1 || Depth > 1) {
+    Width = max<size_t>(1, Width / 2);
+    Height = max<size_t>(1, Height / 2);
+    Depth = max<size_t>(1, Depth / 2);
+    Levels++;
+  }
+
+  return Levels;
+}
+} // namespace
+
+auto DDSUtil::parseDDSHeader(span<const std::byte> Bytes) -> optional<DDSHeaderInfo> {
+  if (Bytes.size() < DDS_LEGACY_HEADER_END || readU32(Bytes, 0) != DDS_MAGIC ||
+      readU32(Bytes, OFFSET_HEADER_SIZE) != DDS_HEADER_SIZE || readU32(Bytes, OFFSET_PF_SIZE) != DDS_PIXELFORMAT_SIZE) {
+    return nullopt;
+  }
+
+  DDSHeaderInfo Info;
+  Info.Width = readU32(Bytes, OFFSET_WIDTH);
+  Info.Height = readU32(Bytes, OFFSET_HEIGHT);
+  Info.MipLevels = max<size_t>(1, readU32(Bytes, OFFSET_MIP_COUNT));
+  const uint32_t HeaderFlags = readU32(Bytes, OFFSET_FLAGS);
+
+  const bool IsDX10 = (readU32(Bytes, OFFSET_PF_FLAGS) & DDS_FOURCC) != 0U &&
+                      readU32(Bytes, OFFSET_PF_FOURCC) == makeFourCC("DX10");
+  if (IsDX10) {
+    if (Bytes.size() < DDS_HEADER_MAX_SIZE) {
+      return nullopt;
+    }
+
+    Info.Format = readU32(Bytes, OFFSET_DX10_FORMAT);
+    Info.ArraySize = readU32(Bytes, OFFSET_DX10_ARRAY_SIZE);
+    Info.MiscFlags2 = readU32(Bytes, OFFSET_DX10_MISC_FLAGS2);
+    Info.Dimension = readU32(Bytes, OFFSET_DX10_DIMENSION);
+    if (Info.Format == 0 || Info.Format > DXGI_LAST_FORMAT || Info.ArraySize == 0) {
+      return nullopt;
+    }
+
+    switch (Info.Dimension) {
+    case DIMENSION_TEXTURE1D:
+      Info.Height = 1;
+      break;
+    case DIMENSION_TEXTURE2D:
+      if ((readU32(Bytes, OFFSET_DX10_MISC_FLAG) & TEX_MISC_TEXTURECUBE) != 0U) {
+        Info.MiscFlags |= TEX_MISC_TEXTURECUBE;
+        Info.ArraySize *= 6;
+      }
+      break;
+    case DIMENSION_TEXTURE3D:
+      if ((HeaderFlags & DDS_HEADER_FLAGS_VOLUME) == 0U || Info.ArraySize > 1) {
+        return nullopt;
+      }
+      Info.Depth = readU32(Bytes, OFFSET_DEPTH);
+      break;
+    default:
+      return nullopt;
+    }
+  } else {
+    const auto Legacy = getLegacyFormat(Bytes);
+    if (Legacy.Format == 0) {
+      return nullopt;
+    }
+
+    Info.Format = Legacy.Format;
+    Info.MiscFlags2 = Legacy.Premultiplied ? TEX_ALPHA_MODE_PREMULTIPLIED : 0;
+    Info.Dimension = DIMENSION_TEXTURE2D;
+
+    if ((HeaderFlags & DDS_HEADER_FLAGS_VOLUME) != 0U) {
+      Info.Dimension = DIMENSION_TEXTURE3D;
+      Info.Depth = readU32(Bytes, OFFSET_DEPTH);
+    } else if ((readU32(Bytes, OFFSET_CAPS2) & DDS_CUBEMAP) != 0U) {
+      // partial cubemaps aren't supported by DirectXTex either
+      if ((readU32(Bytes, OFFSET_CAPS2) & DDS_CUBEMAP_ALLFACES) != DDS_CUBEMAP_ALLFACES) {
+        return nullopt;
+      }
+      Info.MiscFlags |= TEX_MISC_TEXTURECUBE;
+      Info.ArraySize = 6;
+    }
+  }
+
+  if (Info.Width == 0 || Info.Height == 0 || Info.Depth == 0 || Info.MipLevels > MAX_MIP_LEVELS ||
+      Info.MipLevels > getMaxMipLevels(Info.Width, Info.Height, Info.Depth)) {
+    return nullopt;
+  }
+
+  return Info;
+}
@@ -8,14 +8,17 @@
 
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/iostreams/device/array.hpp>
-#include <boost/iostreams/stream.hpp>
 
+#include <algorithm>
 #include <array>
 #include <filesystem>
+#include <istream>
+#include <ostream>
 #include <map>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -23,6 +26,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 using namespace std;
 
@@ -49,29 +53,283 @@ auto NIFUtil::getDefaultTextureType(const TextureSlots &Slot) -> TextureType {
   }
 }
 
+namespace {
+struct TexSuffix {
+  std::wstring_view Suffix;
+  NIFUtil::TextureSlots Slot;
+  NIFUtil::TextureType Type;
+};
+
+// Known texture suffixes, when one suffix ends with another the longest one wins
+constexpr std::array<TexSuffix, 17> TEX_SUFFIXES = {{
+    {L"_bl", NIFUtil::TextureSlots::BACKLIGHT, NIFUtil::TextureType::BACKLIGHT},
+    {L"_b", NIFUtil::TextureSlots::BACKLIGHT, NIFUtil::TextureType::BACKLIGHT},
+    {L"_cnr", NIFUtil::TextureSlots::TINT, NIFUtil::TextureType::COATNORMAL},
+    {L"_s", NIFUtil::TextureSlots::TINT, NIFUtil::TextureType::SUBSURFACE}, // TODO verify this
+    {L"_i", NIFUtil::TextureSlots::TINT, NIFUtil::TextureType::INNERLAYER},
+    {L"_rmaos", NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::RMAOS},
+    {L"_envmask", NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::ENVIRONMENTMASK},
+    {L"_em", NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::ENVIRONMENTMASK},
+    {L"_m", NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::ENVIRONMENTMASK},
+    {L"_e", NIFUtil::TextureSlots::CUBEMAP, NIFUtil::TextureType::CUBEMAP},
+    {L"_p", NIFUtil::TextureSlots::PARALLAX, NIFUtil::TextureType::HEIGHT},
+    {L"_sk", NIFUtil::TextureSlots::GLOW, NIFUtil::TextureType::EMISSIVE}, // TODO this aint right
+    {L"_g", NIFUtil::TextureSlots::GLOW, NIFUtil::TextureType::EMISSIVE},
+    {L"_msn", NIFUtil::TextureSlots::NORMAL, NIFUtil::TextureType::NORMAL},
+    {L"_n", NIFUtil::TextureSlots::NORMAL, NIFUtil::TextureType::NORMAL},
+    {L"_d", NIFUtil::TextureSlots::DIFFUSE, NIFUtil::TextureType::DIFFUSE},
+    {L"mask", NIFUtil::TextureSlots::DIFFUSE, NIFUtil::TextureType::DIFFUSE},
+}};
+
+// Suffixes only use '_' and a-z, everything else is symbol 0 (no transition)
+constexpr size_t SUFFIX_ALPHABET_SIZE = 28;
+constexpr size_t SUFFIX_MAX_NODES = 64;
+
+constexpr auto getSuffixSymbol(const wchar_t &Char) -> size_t {
+  if (Char >= L'a' && Char <= L'z') {
+    return static_cast<size_t>(Char - L'a') + 2;
+  }
+  if (Char >= L'A' && Char <= L'Z') {
+    return static_cast<size_t>(Char - L'A') + 2;
+  }
+  if (Char == L'_') {
+    return 1;
+  }
+
+  return 0;
+}
+
+// Trie of the reversed suffixes, walked from the end of a path towards the start
+struct TexSuffixAutomaton {
+  std::array<std::array<uint8_t, SUFFIX_ALPHABET_SIZE>, SUFFIX_MAX_NODES> Next{}; // 0 means no transition
+  std::array<int8_t, SUFFIX_MAX_NODES> Accept{};                                 // index into TEX_SUFFIXES or -1
+  size_t NumNodes = 1;
+};
+
+constexpr auto buildTexSuffixAutomaton() -> TexSuffixAutomaton {
+  TexSuffixAutomaton Automaton{};
+  Automaton.Accept.fill(-1);
+
+  for (size_t I = 0; I < TEX_SUFFIXES.size(); I++) {
+    size_t Node = 0;
+    const auto &Suffix = TEX_SUFFIXES[I].Suffix;
+    for (auto It = Suffix.rbegin(); It != Suffix.rend(); ++It) {
+      const auto Symbol = getSuffixSymbol(*It);
+      if (Symbol == 0 || Automaton.NumNodes >= SUFFIX_MAX_NODES) {
+        throw std::logic_error("Invalid texture suffix table"); // fails compilation when evaluated at compile time
+      }
+
+      if (Automaton.Next[Node][Symbol] == 0) {
+        Automaton.Next[Node][Symbol] = static_cast<uint8_t>(Automaton.NumNodes++);
+      }
+      Node = Automaton.Next[Node][Symbol];
+    }
+
+    Automaton.Accept[Node] = static_cast<int8_t>(I);
+  }
+
+  return Automaton;
+}
+
+constexpr TexSuffixAutomaton TEX_SUFFIX_AUTOMATON = buildTexSuffixAutomaton();
+
+// Length of a path without its extension, follows std::filesystem::path::stem() rules for the filename
+constexpr auto getLengthWithoutExtension(std::wstring_view Path) -> size_t {
+  const size_t SeparatorPos = Path.find_last_of(L"\\/");
+  const size_t FilenameStart = SeparatorPos == std::wstring_view::npos ? 0 : SeparatorPos + 1;
+  const auto Filename = Path.substr(FilenameStart);
+  if (Filename == L"." || Filename == L"..") {
+    return Path.size();
+  }
+
+  const size_t DotPos = Filename.find_last_of(L'.');
+  if (DotPos == std::wstring_view::npos || DotPos == 0) {
+    return Path.size();
+  }
+
+  return FilenameStart + DotPos;
+}
+
+// Separators std::filesystem::path recognizes on this platform
+#ifdef _WIN32
+constexpr std::wstring_view PATH_SEPARATORS = L"\\/";
+#else
+constexpr std::wstring_view PATH_SEPARATORS = L"/";
+#endif
+
+// Joins the directory and the filename of Path with one preferred separator, which is what parent_path() / stem()
+// gave for texture bases. A root directory is kept as is
+void normalizeFilenameSeparator(std::wstring &Path) {
+  const size_t SeparatorEnd = Path.find_last_of(PATH_SEPARATORS);
+  if (SeparatorEnd == std::wstring::npos) {
+    return;
+  }
+
+  const size_t DirectoryEnd = Path.find_last_not_of(PATH_SEPARATORS, SeparatorEnd);
+  if (DirectoryEnd == std::wstring::npos) {
+    return;
+  }
+
+  Path.replace(DirectoryEnd + 1, SeparatorEnd - DirectoryEnd, 1,
+               static_cast<wchar_t>(std::filesystem::path::preferred_separator));
+}
+
+// Read-only streambuf over a contiguous buffer. The whole buffer is the get area, so reads are bounds checked bulk
+// copies and never need to refill
+class SpanStreamBuf : public std::streambuf {
+public:
+  explicit SpanStreamBuf(std::span<const std::byte> Bytes) {
+    // streambuf requires non-const pointers, the buffer is never written to
+    auto *Begin = const_cast<char *>(reinterpret_cast<const char *>(Bytes.data())); // NOLINT
+    setg(Begin, Begin, Begin + Bytes.size());                                         // NOLINT
+  }
+
+protected:
+  auto xsgetn(char *Dest, std::streamsize Count) -> std::streamsize override {
+    const auto ToCopy = std::min(Count, static_cast<std::streamsize>(egptr() - gptr()));
+    if (ToCopy <= 0) {
+      return 0;
+    }
+
+    std::memcpy(Dest, gptr(), static_cast<size_t>(ToCopy));
+    setg(eback(), gptr() + ToCopy, egptr()); // NOLINT
+    return ToCopy;
+  }
+
+  auto underflow() -> int_type override {
+    return gptr() < egptr() ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+  }
+
+  auto showmanyc() -> std::streamsize override {
+    const auto Available = static_cast<std::streamsize>(egptr() - gptr());
+    return Available > 0 ? Available : -1;
+  }
+
+  auto seekoff(off_type Offset, std::ios_base::seekdir Dir, std::ios_base::openmode Which) -> pos_type override {
+    if ((Which & std::ios_base::in) == 0) {
+      return {off_type(-1)};
+    }
+
+    off_type Base = 0;
+    if (Dir == std::ios_base::cur) {
+      Base = gptr() - eback();
+    } else if (Dir == std::ios_base::end) {
+      Base = egptr() - eback();
+    }
+
+    const off_type NewPos = Base + Offset;
+    if (NewPos < 0 || NewPos > egptr() - eback()) {
+      return {off_type(-1)};
+    }
+
+    setg(eback(), eback() + NewPos, egptr()); // NOLINT
+    return {NewPos};
+  }
+
+  auto seekpos(pos_type Pos, std::ios_base::openmode Which) -> pos_type override {
+    return seekoff(off_type(Pos), std::ios_base::beg, Which);
+  }
+};
+
+// Write-only streambuf appending to a growable byte vector. Seeking back and overwriting is supported since nifly
+// patches block sizes into the header after writing the blocks
+class VectorStreamBuf : public std::streambuf {
+private:
+  std::vector<std::byte> &Buffer;
+  size_t Pos = 0;
+
+public:
+  explicit VectorStreamBuf(std::vector<std::byte> &Buffer) : Buffer(Buffer) {}
+
+protected:
+  auto xsputn(const char *Src, std::streamsize Count) -> std::streamsize override {
+    if (Count <= 0) {
+      return 0;
+    }
+
+    const auto NumBytes = static_cast<size_t>(Count);
+    if (Pos + NumBytes > Buffer.size()) {
+      Buffer.resize(Pos + NumBytes);
+    }
+
+    std::memcpy(Buffer.data() + Pos, Src, NumBytes);
+    Pos += NumBytes;
+    return Count;
+  }
+
+  auto overflow(int_type Ch) -> int_type override {
+    if (traits_type::eq_int_type(Ch, traits_type::eof())) {
+      return traits_type::not_eof(Ch);
+    }
+
+    const char Byte = traits_type::to_char_type(Ch);
+    xsputn(&Byte, 1);
+    return Ch;
+  }
+
+  auto seekoff(off_type Offset, std::ios_base::seekdir Dir, std::ios_base::openmode Which) -> pos_type override {
+    if ((Which & std::ios_base::out) == 0) {
+      return {off_type(-1)};
+    }
+
+    off_type Base = 0;
+    if (Dir == std::ios_base::cur) {
+      Base = static_cast<off_type>(Pos);
+    } else if (Dir == std::ios_base::end) {
+      Base = static_cast<off_type>(Buffer.size());
+    }
+
+    const off_type NewPos = Base + Offset;
+    if (NewPos < 0 || NewPos > static_cast<off_type>(Buffer.size())) {
+      return {off_type(-1)};
+    }
+
+    Pos = static_cast<size_t>(NewPos);
+    return {NewPos};
+  }
+
+  auto seekpos(pos_type Target, std::ios_base::openmode Which) -> pos_type override {
+    return seekoff(off_type(Target), std::ios_base::beg, Which);
+  }
+};
+} // namespace
+
 auto NIFUtil::getTexSuffixMap() -> map<wstring, tuple<NIFUtil::TextureSlots, NIFUtil::TextureType>> {
-  static const map<wstring, tuple<NIFUtil::TextureSlots, NIFUtil::TextureType>> TextureSuffixMap = {
-      {L"_bl", {NIFUtil::TextureSlots::BACKLIGHT, NIFUtil::TextureType::BACKLIGHT}},
-      {L"_b", {NIFUtil::TextureSlots::BACKLIGHT, NIFUtil::TextureType::BACKLIGHT}},
-      {L"_cnr", {NIFUtil::TextureSlots::TINT, NIFUtil::TextureType::COATNORMAL}},
-      {L"_s", {NIFUtil::TextureSlots::TINT, NIFUtil::TextureType::SUBSURFACE}}, // TODO verify this
-      {L"_i", {NIFUtil::TextureSlots::TINT, NIFUtil::TextureType::INNERLAYER}},
-      {L"_rmaos", {NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::RMAOS}},
-      {L"_envmask", {NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::ENVIRONMENTMASK}},
-      {L"_em", {NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::ENVIRONMENTMASK}},
-      {L"_m", {NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::ENVIRONMENTMASK}},
-      {L"_e", {NIFUtil::TextureSlots::CUBEMAP, NIFUtil::TextureType::CUBEMAP}},
-      {L"_p", {NIFUtil::TextureSlots::PARALLAX, NIFUtil::TextureType::HEIGHT}},
-      {L"_sk", {NIFUtil::TextureSlots::GLOW, NIFUtil::TextureType::EMISSIVE}}, // TODO this aint right
-      {L"_g", {NIFUtil::TextureSlots::GLOW, NIFUtil::TextureType::EMISSIVE}},
-      {L"_msn", {NIFUtil::TextureSlots::NORMAL, NIFUtil::TextureType::NORMAL}},
-      {L"_n", {NIFUtil::TextureSlots::NORMAL, NIFUtil::TextureType::NORMAL}},
-      {L"_d", {NIFUtil::TextureSlots::DIFFUSE, NIFUtil::TextureType::DIFFUSE}},
-      {L"mask", {NIFUtil::TextureSlots::DIFFUSE, NIFUtil::TextureType::DIFFUSE}}};
+  static const map<wstring, tuple<NIFUtil::TextureSlots, NIFUtil::TextureType>> TextureSuffixMap = [] {
+    map<wstring, tuple<NIFUtil::TextureSlots, NIFUtil::TextureType>> OutMap;
+    for (const auto &Suffix : TEX_SUFFIXES) {
+      OutMap[wstring(Suffix.Suffix)] = {Suffix.Slot, Suffix.Type};
+    }
+    return OutMap;
+  }();
 
   return TextureSuffixMap;
 }
 
+auto NIFUtil::matchTexSuffix(wstring_view Path) -> TexSuffixMatch {
+  const size_t StemLength = getLengthWithoutExtension(Path);
+
+  TexSuffixMatch Match{StemLength, TextureSlots::UNKNOWN, TextureType::UNKNOWN};
+
+  // Walk backwards from the end of the stem, remembering the last (longest) accepting state
+  size_t Node = 0;
+  for (size_t Pos = StemLength; Pos > 0; Pos--) {
+    Node = TEX_SUFFIX_AUTOMATON.Next[Node][getSuffixSymbol(Path[Pos - 1])];
+    if (Node == 0) {
+      break;
+    }
+
+    const auto Accept = TEX_SUFFIX_AUTOMATON.Accept[Node];
+    if (Accept >= 0) {
+      Match.BaseLength = Pos - 1;
+      Match.Slot = TEX_SUFFIXES[Accept].Slot;
+      Match.Type = TEX_SUFFIXES[Accept].Type;
+    }
+  }
+
+  return Match;
+}
+
 auto NIFUtil::getStrFromTexType(const TextureType &Type) -> string {
   static unordered_map<TextureType, string> StrFromTexMap = {{TextureType::DIFFUSE, "diffuse"},
                                                              {TextureType::NORMAL, "normal"},
@@ -148,23 +406,21 @@ auto NIFUtil::getSlotFromTexType(const TextureType &Type) -> TextureSlots {
 
 auto NIFUtil::getDefaultsFromSuffix(const std::filesystem::path &Path)
     -> tuple<NIFUtil::TextureSlots, NIFUtil::TextureType> {
-  const auto &SuffixMap = getTexSuffixMap();
-
-  // Get the texture suffix
-  const auto PathWithoutExtension = Path.parent_path() / Path.stem();
-  const auto &PathStr = PathWithoutExtension.wstring();
-
-  for (const auto &[Suffix, Slot] : SuffixMap) {
-    if (boost::iends_with(PathStr, Suffix)) {
-      return Slot;
-    }
-  }
+  const auto PathStr = Path.wstring();
+  return getDefaultsFromSuffix(wstring_view(PathStr));
+}
 
-  // Default return diffuse
-  return {TextureSlots::UNKNOWN, TextureType::UNKNOWN};
+auto NIFUtil::getDefaultsFromSuffix(wstring_view Path) -> tuple<NIFUtil::TextureSlots, NIFUtil::TextureType> {
+  // Defaults to unknown if no suffix matches
+  const auto Match = matchTexSuffix(Path);
+  return {Match.Slot, Match.Type};
 }
 
 auto NIFUtil::loadNIFFromBytes(const std::vector<std::byte> &NIFBytes) -> nifly::NifFile {
+  return loadNIFFromBytes(span<const std::byte>(NIFBytes));
+}
+
+auto NIFUtil::loadNIFFromBytes(span<const std::byte> NIFBytes) -> nifly::NifFile {
   // NIF file object
   NifFile NIF;
 
@@ -173,9 +429,9 @@ auto NIFUtil::loadNIFFromBytes(const std::vector<std::byte> &NIFBytes) -> nifly:
     throw runtime_error("File is empty");
   }
 
-  // Convert Byte Vector to Stream
-  boost::iostreams::array_source NIFArraySource(reinterpret_cast<const char *>(NIFBytes.data()), NIFBytes.size());
-  boost::iostreams::stream<boost::iostreams::array_source> NIFStream(NIFArraySource);
+  // Read straight from the buffer
+  SpanStreamBuf NIFBuf(NIFBytes);
+  istream NIFStream(&NIFBuf);
 
   NIF.Load(NIFStream);
   if (!NIF.IsValid()) {
@@ -185,6 +441,19 @@ auto NIFUtil::loadNIFFromBytes(const std::vector<std::byte> &NIFBytes) -> nifly:
   return NIF;
 }
 
+auto NIFUtil::saveNIFToBytes(NifFile &NIF, const NifSaveOptions &Options) -> vector<std::byte> {
+  vector<std::byte> NIFBytes;
+
+  VectorStreamBuf NIFBuf(NIFBytes);
+  ostream NIFStream(&NIFBuf);
+
+  if (NIF.Save(NIFStream, Options) != 0 || NIFStream.fail()) {
+    throw runtime_error("Unable to save NIF");
+  }
+
+  return NIFBytes;
+}
+
 auto NIFUtil::setShaderType(nifly::NiShader *NIFShader, const nifly::BSLightingShaderPropertyShaderType &Type,
                             bool &Changed) -> void {
   if (NIFShader->GetShaderType() != Type) {
@@ -313,19 +582,15 @@ auto NIFUtil::getTextureSlots(nifly::NifFile &NIF, nifly::NiShape *NIFShape) ->
 }
 
 auto NIFUtil::getTexBase(const std::filesystem::path &Path) -> std::wstring {
-  const auto &SuffixMap = getTexSuffixMap();
-
-  // Get the texture suffix
-  const auto PathWithoutExtension = Path.parent_path() / Path.stem();
-  const auto &PathStr = PathWithoutExtension.wstring();
-
-  for (const auto &[Suffix, Slot] : SuffixMap) {
-    if (boost::iends_with(PathStr, Suffix)) {
-      return PathStr.substr(0, PathStr.size() - Suffix.size());
-    }
-  }
+  const auto PathStr = Path.wstring();
+  return getTexBase(wstring_view(PathStr));
+}
 
-  return PathStr;
+auto NIFUtil::getTexBase(wstring_view Path) -> std::wstring {
+  // Bases are map keys, they keep the separator parent_path() / stem() used to put before the filename
+  wstring Base(Path.substr(0, matchTexSuffix(Path).BaseLength));
+  normalizeFilenameSeparator(Base);
+  return Base;
 }
 
 auto NIFUtil::getTexMatch(const wstring &Base, const wstring &ExistingSlot, const TextureType &DesiredType,
@@ -368,24 +633,7 @@ auto NIFUtil::getTexMatch(const wstring &Base, const wstring &ExistingSlot, cons
 }
 
 auto NIFUtil::getSearchPrefixes(NifFile &NIF, nifly::NiShape *NIFShape) -> array<wstring, NUM_TEXTURE_SLOTS> {
-  array<wstring, NUM_TEXTURE_SLOTS> OutPrefixes;
-
-  // Loop through each texture Slot
-  for (uint32_t I = 0; I < NUM_TEXTURE_SLOTS; I++) {
-    string Texture;
-    const uint32_t Result = NIF.GetTextureSlot(NIFShape, Texture, I);
-
-    if (Result == 0 || Texture.empty()) {
-      // no texture in Slot
-      continue;
-    }
-
-    // Get default suffixes
-    const auto TexBase = getTexBase(Texture);
-    OutPrefixes[I] = TexBase;
-  }
-
-  return OutPrefixes;
+  return getSearchPrefixes(getTextureSlots(NIF, NIFShape));
 }
 
 auto NIFUtil::getSearchPrefixes(const array<wstring, NUM_TEXTURE_SLOTS> &OldSlots)
@@ -403,3 +651,33 @@ auto NIFUtil::getSearchPrefixes(const array<wstring, NUM_TEXTURE_SLOTS> &OldSlot
 
   return OutSlots;
 }
+
+auto NIFUtil::getShapeMaterialView(NifFile &NIF, nifly::NiShape *NIFShape) -> ShapeMaterialView {
+  ShapeMaterialView View;
+  View.Shape = NIFShape;
+  View.ShapeBlockID = NIF.GetBlockID(NIFShape);
+
+  if (!NIFShape->HasShaderProperty()) {
+    return View;
+  }
+
+  View.Shader = NIF.GetShader(NIFShape);
+  View.ShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(View.Shader);
+  if (View.ShaderBSLSP == nullptr) {
+    return View;
+  }
+
+  View.ShaderType = static_cast<BSLightingShaderPropertyShaderType>(View.ShaderBSLSP->GetShaderType());
+  View.ShaderFlags1 = View.ShaderBSLSP->shaderFlags1;
+  View.ShaderFlags2 = View.ShaderBSLSP->shaderFlags2;
+
+  if (!View.ShaderBSLSP->HasTextureSet()) {
+    return View;
+  }
+
+  View.TextureSetBlockID = View.ShaderBSLSP->TextureSetRef()->index;
+  View.Slots = getTextureSlots(NIF, NIFShape);
+  View.SearchPrefixes = getSearchPrefixes(View.Slots);
+
+  return View;
+}
@@ -3,19 +3,28 @@
 #include <DirectXTex.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/asio.hpp>
 #include <boost/crc.hpp>
 #include <boost/iostreams/device/array.hpp>
 #include <boost/iostreams/stream.hpp>
-#include <boost/thread.hpp>
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <spdlog/spdlog.h>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "NIFUtil.hpp"
 #include "ParallaxGenDirectory.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
+#include "ParallaxGenPipeline.hpp"
 #include "ParallaxGenPlugin.hpp"
+#include "ParallaxGenScheduler.hpp"
 #include "ParallaxGenTask.hpp"
 #include "ParallaxGenUtil.hpp"
 
@@ -23,6 +32,15 @@ using namespace std;
 using namespace ParallaxGenUtil;
 using namespace nifly;
 
+// Threads for the I/O bound stages of the mesh pipeline
+constexpr size_t MESH_IO_THREADS = 2;
+// Read meshes buffered ahead of each patch thread
+constexpr size_t MESH_QUEUE_DEPTH = 2;
+// A mesh in flight holds its bytes, the parsed NIF and the patched output, a few times its file size
+constexpr size_t MESH_MEMORY_FACTOR = 4;
+// Height map and env mask plus the uncompressed RGBA output, height maps are often BC4 (half a byte per pixel)
+constexpr size_t COMPLEX_MATERIAL_MEMORY_FACTOR = 8;
+
 ParallaxGen::ParallaxGen(filesystem::path OutputDir, ParallaxGenDirectory *PGD, ParallaxGenConfig *PGC,
                          ParallaxGenD3D *PGD3D, const bool &OptimizeMeshes, const bool &IgnoreParallax,
                          const bool &IgnoreCM, const bool &IgnoreTruePBR)
@@ -35,86 +53,248 @@ ParallaxGen::ParallaxGen(filesystem::path OutputDir, ParallaxGenDirectory *PGD,
 }
 
 void ParallaxGen::upgradeShaders() {
-  // Get height maps (vanilla _p.dds files)
-  const auto &HeightMaps = PGD->getTextureMapConst(NIFUtil::TextureSlots::PARALLAX);
+  // Get height maps (vanilla _p.dds files), one per texture base since they all generate the same complex material
+  vector<filesystem::path> HeightMaps;
+  for (const auto &HeightSlot : PGD->getTextureMapConst(NIFUtil::TextureSlots::PARALLAX)) {
+    filesystem::path HeightMap;
+    for (const auto &Texture : HeightSlot.second) {
+      if (Texture.Type == NIFUtil::TextureType::HEIGHT && (HeightMap.empty() || Texture.Path < HeightMap)) {
+        HeightMap = Texture.Path;
+      }
+    }
+
+    if (!HeightMap.empty()) {
+      HeightMaps.push_back(HeightMap);
+    }
+  }
 
   // Define task parameters
   ParallaxGenTask TaskTracker("Shader Upgrades", HeightMaps.size());
 
-  for (const auto &HeightSlot : HeightMaps) {
-    for (const auto &HeightMap : HeightSlot.second) {
-      if (HeightMap.Type != NIFUtil::TextureType::HEIGHT) {
-        // not a height map
-        continue;
-      }
+  // Generated maps reach the output in height map order. They are only added to the texture maps once every task is
+  // done since tasks read them
+  vector<pair<wstring, filesystem::path>> NewComplexMaps;
+  ParallaxGenPipeline::Resequencer<ShaderUpgradeJob> OrderedOutput([this, &NewComplexMaps](ShaderUpgradeJob &&Job) {
+    // The map may only exist inside the zip, so patchers can't read its metadata back from disk
+    PGD3D->cacheDDSMetadata(Job.OutputFile.RelPath, Job.Metadata);
+    NewComplexMaps.emplace_back(Job.TexBase, Job.OutputFile.RelPath);
+    addFileToOutput(std::move(Job.OutputFile));
+  });
+
+  // One height map per task, each merges (GPU or CPU) and compresses one complex material
+  ParallaxGenScheduler::get().parallelFor(
+      0, HeightMaps.size(),
+      [this, &HeightMaps, &TaskTracker, &OrderedOutput](const size_t &Seq) {
+        ShaderUpgradeJob Job;
+        auto Result = ParallaxGenTask::PGResult::SUCCESS;
+        try {
+          Result = convertHeightMapToComplexMaterial(HeightMaps[Seq], Job);
+        } catch (const exception &E) {
+          spdlog::error(L"Exception in thread upgrading height map {}: {}", HeightMaps[Seq].wstring(),
+                        strToWstr(E.what()));
+          Result = ParallaxGenTask::PGResult::FAILURE;
+        }
 
-      TaskTracker.completeJob(convertHeightMapToComplexMaterial(HeightMap.Path));
-    }
+        if (Result == ParallaxGenTask::PGResult::FAILURE || Job.OutputFile.Bytes.empty()) {
+          OrderedOutput.skip(Seq);
+        } else {
+          OrderedOutput.submit(Seq, std::move(Job));
+        }
+
+        TaskTracker.completeJob(Result);
+      },
+      1);
+
+  // add newly created files to complexMaterialMaps for later processing
+  auto &CMBaseMap = PGD->getTextureMap(NIFUtil::TextureSlots::ENVMASK);
+  for (const auto &[TexBase, ComplexMap] : NewComplexMaps) {
+    CMBaseMap[TexBase].insert({ComplexMap, NIFUtil::TextureType::COMPLEXMATERIAL});
   }
 }
 
 void ParallaxGen::patchMeshes(const bool &MultiThread, const bool &PatchPlugin) {
-  auto Meshes = PGD->getMeshes();
+  // Largest meshes first (longest-processing-time-first) to avoid a long tail at the end of the stage
+  auto AllMeshes = PGD->getFilesBySizeDesc(PGD->getMeshes());
+  if (ShardCount > 1) {
+    erase_if(AllMeshes, [this](const filesystem::path &Mesh) { return !isInShard(Mesh, ShardIndex, ShardCount); });
+    spdlog::info("Shard {}/{}: patching {} meshes", ShardIndex + 1, ShardCount, AllMeshes.size());
+  }
 
   // Create task tracker
-  ParallaxGenTask TaskTracker("Mesh Patcher", Meshes.size());
+  ParallaxGenTask TaskTracker("Mesh Patcher", AllMeshes.size());
 
-  // Create thread group
-  const boost::thread_group ThreadGroup;
+  // Shape decisions are only valid for one set of configs
+  PBRNIFFilters.clear();
+  for (const auto &[Cfg, Config] : PatcherTruePBR::getTruePBRConfigs()) {
+    if (Config.contains("nif_filter")) {
+      PBRNIFFilters.insert(strToWstr(Config["nif_filter"].get<string>()));
+    }
+  }
+  ShapeDecisions.clear();
+
+  // Byte-identical copies are patched once, the copies are completed along with the mesh that was patched
+  const auto Meshes = findDuplicateMeshes(AllMeshes, MultiThread);
+
+  if (Incremental != nullptr || Resume != nullptr) {
+    DecisionSettingsKey = computeSettingsKey(PatchPlugin);
+  }
 
-  // Define diff JSON
-  nlohmann::json DiffJSON;
+  // Diff JSON entries, appended by the single ordered write step and serialized once all meshes are done
+  vector<MeshDiffEntry> DiffEntries;
 
   // Create threads
   if (MultiThread) {
-#ifdef _DEBUG
-    size_t NumThreads = 1;
-#else
-    const size_t NumThreads = boost::thread::hardware_concurrency();
-#endif
+    // Meshes flow through read -> parse/patch -> write stages. Reading and writing are I/O bound and block on their
+    // queues, so they get a few threads of their own. Parsing and patching runs as scheduler tasks on every core, one
+    // task per read mesh. The bounded read queue blocks the readers when patching falls behind, which caps how many raw
+    // meshes are held at once, and memory admitted per mesh caps the rest.
+    const size_t NumPatchThreads = ParallaxGenScheduler::get().getNumThreads();
+    const size_t NumIOThreads = min(MESH_IO_THREADS, NumPatchThreads);
+
+    ParallaxGenPipeline::BoundedQueue<pair<size_t, filesystem::path>> PathQueue(Meshes.size());
+    ParallaxGenPipeline::BoundedQueue<MeshReadJob> ReadQueue(NumPatchThreads * MESH_QUEUE_DEPTH);
+    // Patch tasks must never wait on it, the memory admitted for the meshes in it already bounds its size
+    ParallaxGenPipeline::BoundedQueue<MeshWriteJob> WriteQueue(Meshes.size());
+
+    for (size_t Seq = 0; Seq < Meshes.size(); Seq++) {
+      PathQueue.push({Seq, Meshes[Seq]});
+    }
+    PathQueue.close();
+
+    // Patched meshes reach the output in mesh list order no matter which worker finishes first, so the zip layout is
+    // the same on every run
+    ParallaxGenPipeline::Resequencer<MeshWriteJob> OrderedWrites(
+        [this, &TaskTracker, &DiffEntries, &PatchPlugin](MeshWriteJob &&WriteJob) {
+          const auto NIFFile = WriteJob.NIFFile;
+          auto Result = WriteJob.Result;
+          try {
+            // Duplicates first, writeNIF hands the output file off
+            finishDuplicateMeshes(NIFFile, WriteJob, Result, PatchPlugin, DiffEntries, TaskTracker);
+            ParallaxGenTask::updatePGResult(Result, writeNIF(WriteJob, DiffEntries));
+          } catch (const exception &E) {
+            spdlog::error(L"Exception in thread saving NIF {}: {}", NIFFile.wstring(), strToWstr(E.what()));
+            Result = ParallaxGenTask::PGResult::FAILURE;
+          }
+
+          TaskTracker.completeJob(Result);
+        });
+
+    // Parse and patch stage, each task takes one mesh from the read queue. A task is only queued after its mesh, so the
+    // queue never comes up empty
+    ParallaxGenTaskGroup PatchTasks;
+    const auto PatchMesh = [this, &TaskTracker, &OrderedWrites, &DiffEntries, &PatchPlugin, &ReadQueue,
+                            &WriteQueue]() {
+      auto ReadJob = ReadQueue.pop();
+      if (!ReadJob.has_value()) {
+        return;
+      }
 
-    boost::asio::thread_pool MeshPatchPool(NumThreads);
+      const auto JobStart = chrono::steady_clock::now();
 
-    for (const auto &Mesh : Meshes) {
-      boost::asio::post(MeshPatchPool, [this, &TaskTracker, &DiffJSON, &Mesh, &PatchPlugin] {
-        ParallaxGenTask::PGResult Result = ParallaxGenTask::PGResult::SUCCESS;
-        try {
-          Result = processNIF(Mesh, DiffJSON, PatchPlugin);
-        } catch (const exception &E) {
-          spdlog::error(L"Exception in thread patching NIF {}: {}", Mesh.wstring(), strToWstr(E.what()));
-          Result = ParallaxGenTask::PGResult::FAILURE;
-        }
+      MeshWriteJob WriteJob;
+      auto Result = ParallaxGenTask::PGResult::SUCCESS;
+      try {
+        Result = patchNIF(*ReadJob, WriteJob, PatchPlugin);
+      } catch (const exception &E) {
+        spdlog::error(L"Exception in thread patching NIF {}: {}", ReadJob->NIFFile.wstring(), strToWstr(E.what()));
+        Result = ParallaxGenTask::PGResult::FAILURE;
+      }
+
+      TaskTracker.addWorkerBusyTime(chrono::steady_clock::now() - JobStart);
 
+      if (Result == ParallaxGenTask::PGResult::FAILURE || WriteJob.OutputFile.Bytes.empty()) {
+        // Failed or nothing to save
+        OrderedWrites.skip(ReadJob->Seq);
+        finishDuplicateMeshes(ReadJob->NIFFile, WriteJob, Result, PatchPlugin, DiffEntries, TaskTracker);
         TaskTracker.completeJob(Result);
-      });
-    }
+        return;
+      }
 
-    // Wait for all threads to complete
-    MeshPatchPool.join();
+      WriteJob.Result = Result;
+      WriteJob.Memory = std::move(ReadJob->Memory);
+      WriteQueue.push(std::move(WriteJob));
+    };
+
+    // Read stage
+    ParallaxGenPipeline::WorkerGroup Readers;
+    ParallaxGenPipeline::runSink(
+        Readers, PathQueue, NumIOThreads,
+        [this, &TaskTracker, &OrderedWrites, &DiffEntries, &PatchPlugin, &ReadQueue, &PatchTasks,
+         &PatchMesh](pair<size_t, filesystem::path> &&Mesh) {
+          MeshReadJob ReadJob;
+          ReadJob.Seq = Mesh.first;
+          // The next mesh to be written is always let in, the meshes waiting for it in OrderedWrites hold the memory
+          ReadJob.Memory = ParallaxGenMemoryGovernor::get().admit(
+              PGD->getFileSize(Mesh.second) * MESH_MEMORY_FACTOR,
+              [&OrderedWrites, Seq = Mesh.first] { return OrderedWrites.getNextSeq() == Seq; });
+
+          auto Result = ParallaxGenTask::PGResult::SUCCESS;
+          try {
+            Result = readNIF(Mesh.second, ReadJob);
+          } catch (const exception &E) {
+            spdlog::error(L"Exception in thread reading NIF {}: {}", Mesh.second.wstring(), strToWstr(E.what()));
+            Result = ParallaxGenTask::PGResult::FAILURE;
+          }
+
+          if (Result == ParallaxGenTask::PGResult::FAILURE) {
+            OrderedWrites.skip(Mesh.first);
+            finishDuplicateMeshes(Mesh.second, MeshWriteJob(), Result, PatchPlugin, DiffEntries, TaskTracker);
+            TaskTracker.completeJob(Result);
+            return;
+          }
+
+          ReadQueue.push(std::move(ReadJob));
+          PatchTasks.run(PatchMesh);
+        });
+
+    // Write stage
+    ParallaxGenPipeline::WorkerGroup Writers;
+    ParallaxGenPipeline::runSink(Writers, WriteQueue, NumIOThreads, [&OrderedWrites](MeshWriteJob &&WriteJob) {
+      const auto Seq = WriteJob.Seq;
+      OrderedWrites.submit(Seq, std::move(WriteJob));
+    });
+
+    // Drain the stages in order, this thread helps patching while it waits on the tasks
+    Readers.join();
+    PatchTasks.wait();
+    WriteQueue.close();
+    Writers.join();
+    TaskTracker.printWorkerIdleSummary(NumPatchThreads);
 
   } else {
     for (const auto &Mesh : Meshes) {
-      TaskTracker.completeJob(processNIF(Mesh, DiffJSON));
+      TaskTracker.completeJob(processNIF(Mesh, DiffEntries, TaskTracker, PatchPlugin));
     }
   }
 
+  // Shards leave the plugin to the merge
+  if (PatchPlugin && ShardCount == 1) {
+    patchPlugin();
+  }
+
   // Write DiffJSON file
   spdlog::info("Saving diff JSON file...");
-  const filesystem::path DiffJSONPath = OutputDir / getDiffJSONName();
-  ofstream DiffJSONFile(DiffJSONPath);
-  DiffJSONFile << DiffJSON << endl;
-  DiffJSONFile.close();
+  const string DiffJSONStr = serializeDiffJSON(DiffEntries);
+  const auto *DiffJSONStart = reinterpret_cast<const std::byte *>(DiffJSONStr.data()); // NOLINT
+  addFileToOutput(getDiffJSONName(), vector<std::byte>(DiffJSONStart, DiffJSONStart + DiffJSONStr.size()));
+
+  if (Incremental != nullptr && WriteManifest) {
+    // Next incremental run starts from this manifest
+    const string ManifestStr = Incremental->serializeManifest();
+    const auto *ManifestStart = reinterpret_cast<const std::byte *>(ManifestStr.data()); // NOLINT
+    addFileToOutput(ParallaxGenIncremental::getManifestName(),
+                    vector<std::byte>(ManifestStart, ManifestStart + ManifestStr.size()));
+  }
 }
 
-auto ParallaxGen::convertHeightMapToComplexMaterial(const filesystem::path &HeightMap) -> ParallaxGenTask::PGResult {
+auto ParallaxGen::convertHeightMapToComplexMaterial(const filesystem::path &HeightMap,
+                                                    ShaderUpgradeJob &Job) const -> ParallaxGenTask::PGResult {
   spdlog::trace(L"Upgrading height map: {}", HeightMap.wstring());
 
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
-  const string HeightMapStr = HeightMap.string();
-
   // Get texture base (remove _p.dds)
-  const auto TexBase = NIFUtil::getTexBase(HeightMapStr);
+  const auto TexBase = NIFUtil::getTexBase(HeightMap);
   if (TexBase.empty()) {
     // no height map (this shouldn't happen)
     return Result;
@@ -137,24 +317,28 @@ auto ParallaxGen::convertHeightMapToComplexMaterial(const filesystem::path &Heig
   const filesystem::path ComplexMap = TexBase + L"_m.dds";
 
   // upgrade to complex material
+  const auto Memory = ParallaxGenMemoryGovernor::get().admit(
+      (PGD->getFileSize(HeightMap) + (EnvMask.empty() ? 0 : PGD->getFileSize(EnvMask))) *
+      COMPLEX_MATERIAL_MEMORY_FACTOR);
   const DirectX::ScratchImage NewComplexMap = PGD3D->upgradeToComplexMaterial(HeightMap, EnvMask);
 
-  // save to file
+  // save to output
   if (NewComplexMap.GetImageCount() > 0) {
-    const filesystem::path OutputPath = OutputDir / ComplexMap;
-    filesystem::create_directories(OutputPath.parent_path());
-
-    const HRESULT HR = DirectX::SaveToDDSFile(NewComplexMap.GetImages(), NewComplexMap.GetImageCount(),
-                                        NewComplexMap.GetMetadata(), DirectX::DDS_FLAGS_NONE, OutputPath.c_str());
+    DirectX::Blob DDSBlob;
+    const HRESULT HR = DirectX::SaveToDDSMemory(NewComplexMap.GetImages(), NewComplexMap.GetImageCount(),
+                                                NewComplexMap.GetMetadata(), DirectX::DDS_FLAGS_NONE, DDSBlob);
     if (FAILED(HR)) {
-      spdlog::error(L"Unable to save complex material {}: {}", OutputPath.wstring(),
+      spdlog::error(L"Unable to save complex material {}: {}", ComplexMap.wstring(),
                     strToWstr(ParallaxGenD3D::getHRESULTErrorMessage(HR)));
       Result = ParallaxGenTask::PGResult::FAILURE;
       return Result;
     }
 
-    // add newly created file to complexMaterialMaps for later processing
-    PGD->getTextureMap(NIFUtil::TextureSlots::ENVMASK)[TexBase].insert({ComplexMap, NIFUtil::TextureType::COMPLEXMATERIAL});
+    // Checksum (and deflate if the zip is compressed) on this thread
+    const auto *DDSStart = static_cast<const std::byte *>(DDSBlob.GetBufferPointer());
+    Job.TexBase = TexBase;
+    Job.OutputFile = Output->makeFile(ComplexMap, vector<std::byte>(DDSStart, DDSStart + DDSBlob.GetBufferSize()));
+    Job.Metadata = NewComplexMap.GetMetadata();
 
     spdlog::debug(L"Generated complex material map: {}", ComplexMap.wstring());
   } else {
@@ -164,46 +348,167 @@ auto ParallaxGen::convertHeightMapToComplexMaterial(const filesystem::path &Heig
   return Result;
 }
 
-void ParallaxGen::zipMeshes() const {
-  // Zip meshes
-  spdlog::info("Zipping meshes...");
-  zipDirectory(OutputDir, OutputDir / getOutputZipName());
+void ParallaxGen::initOutput(const bool &Zip, const bool &Loose, const bool &CompressZip) {
+  ZipOutput = Zip;
+  LooseOutput = Loose;
+
+  vector<unique_ptr<ParallaxGenOutputSink>> Sinks;
+  if (Loose) {
+    Sinks.push_back(make_unique<LooseOutputSink>(OutputDir));
+  }
+
+  if (Zip) {
+    try {
+      Sinks.push_back(make_unique<ZipOutputSink>(OutputDir / getOutputZipName()));
+    } catch (const exception &E) {
+      spdlog::critical("{}", E.what());
+      exit(1);
+    }
+  }
+
+  // Deflating happens on the threads adding files, the writer only copies precompressed entries into the zip
+  const int CompressionLevel = Zip && CompressZip ? MZ_DEFAULT_LEVEL : 0;
+  Output = make_unique<ParallaxGenOutput>(std::move(Sinks), CompressionLevel);
+}
+
+void ParallaxGen::addFileToOutput(const filesystem::path &RelPath, vector<std::byte> Bytes) {
+  addFileToOutput(Output->makeFile(RelPath, std::move(Bytes)));
 }
 
-void ParallaxGen::deleteMeshes() const {
-  // delete meshes
-  spdlog::info("Cleaning up meshes generated by ParallaxGen...");
-  // Iterate through the folder
-  for (const auto &Entry : filesystem::directory_iterator(OutputDir)) {
-    if (filesystem::is_directory(Entry.path())) {
-      // Remove the directory and all its contents
+void ParallaxGen::addFileToOutput(ParallaxGenOutputFile File) {
+  if (!File.RelPath.has_parent_path()) {
+    // Remember top level files so finishOutput doesn't add them to the zip twice
+    const lock_guard<mutex> Lock(TopLevelOutputFilesMutex);
+    TopLevelOutputFiles.insert(File.RelPath);
+  }
+
+  Output->addFile(std::move(File));
+}
+
+void ParallaxGen::finishOutput() {
+  // Nothing left to resume once the output is complete
+  if (Incremental != nullptr) {
+    Incremental->closeJournal();
+  }
+  try {
+    filesystem::remove(OutputDir / ParallaxGenIncremental::getJournalName());
+  } catch (const exception &E) {
+    spdlog::error(L"Error deleting journal: {}", strToWstr(E.what()));
+  }
+
+  // Files written to the output directory by other tools (the plugin) end up in the zip as well, sorted since the
+  // directory listing order is up to the file system
+  vector<filesystem::path> StrayFiles;
+  if (ZipOutput) {
+    for (const auto &Entry : filesystem::directory_iterator(OutputDir)) {
+      const auto FileName = Entry.path().filename();
+      if (!Entry.is_regular_file() || FileName == getOutputZipName() || TopLevelOutputFiles.contains(FileName)) {
+        continue;
+      }
+
+      StrayFiles.push_back(Entry.path());
+    }
+
+    sort(StrayFiles.begin(), StrayFiles.end());
+    for (const auto &StrayFile : StrayFiles) {
+      Output->addFile(StrayFile.filename(), getFileBytes(StrayFile));
+    }
+
+    spdlog::info("Finishing output zip...");
+  }
+
+  if (!Output->finish()) {
+    spdlog::critical("Unable to write ParallaxGen output");
+    exit(1);
+  }
+
+  if (!LooseOutput) {
+    // The zip now holds everything
+    for (const auto &StrayFile : StrayFiles) {
       try {
-        filesystem::remove_all(Entry.path());
-        spdlog::trace(L"Deleted directory {}", Entry.path().wstring());
+        filesystem::remove(StrayFile);
       } catch (const exception &E) {
-        spdlog::error(L"Error deleting directory {}: {}", Entry.path().wstring(), strToWstr(E.what()));
+        spdlog::error(L"Error deleting state file {}: {}", StrayFile.wstring(), strToWstr(E.what()));
       }
     }
+  }
 
-    // remove stray files except output
-    if (!boost::equals(Entry.path().filename().wstring(), getOutputZipName().wstring())) {
+  // The previous and interrupted outputs have been fully reused or replaced
+  if (Incremental != nullptr || Resume != nullptr) {
+    Incremental.reset();
+    Resume.reset();
+    for (const auto &KeptDir : {getPreviousOutputDirName(), getResumeDirName()}) {
       try {
-        filesystem::remove(Entry.path());
+        filesystem::remove_all(OutputDir / KeptDir);
       } catch (const exception &E) {
-        spdlog::error(L"Error deleting state file {}: {}", Entry.path().wstring(), strToWstr(E.what()));
+        spdlog::error(L"Error deleting {}: {}", (OutputDir / KeptDir).wstring(), strToWstr(E.what()));
       }
     }
   }
+
+  if (ZipOutput) {
+    spdlog::info(L"Please import this file into your mod manager: {}", (OutputDir / getOutputZipName()).wstring());
+  }
 }
 
-void ParallaxGen::deleteOutputDir() const {
+void ParallaxGen::deleteOutputDir(const bool &KeepPrevious, const bool &KeepPartial) const {
   // delete output directory
   if (filesystem::exists(OutputDir) && filesystem::is_directory(OutputDir)) {
     spdlog::info("Deleting existing ParallaxGen output...");
 
+    const auto PreviousDir = OutputDir / getPreviousOutputDirName();
+    const auto ResumeDir = OutputDir / getResumeDirName();
     try {
+      vector<filesystem::path> Entries;
       for (const auto &Entry : filesystem::directory_iterator(OutputDir)) {
-        filesystem::remove_all(Entry.path());
+        if (Entry.path().filename() != getPreviousOutputDirName() && Entry.path().filename() != getResumeDirName()) {
+          Entries.push_back(Entry.path());
+        }
+      }
+
+      if (KeepPartial) {
+        // An existing resume folder means a resumed run was interrupted too, its newer files replace the older ones
+        // and both journals are kept
+        filesystem::create_directories(ResumeDir);
+        for (const auto &Entry : Entries) {
+          const auto Target = ResumeDir / Entry.filename();
+          if (!filesystem::exists(Target)) {
+            filesystem::rename(Entry, Target);
+          } else if (Entry.filename() == ParallaxGenIncremental::getJournalName()) {
+            const auto JournalBytes = getFileBytes(Entry);
+            ofstream JournalFile(Target, ios::binary | ios::app);
+            JournalFile.write(reinterpret_cast<const char *>(JournalBytes.data()), // NOLINT
+                              static_cast<streamsize>(JournalBytes.size()));
+            filesystem::remove(Entry);
+          } else if (filesystem::is_directory(Entry)) {
+            filesystem::copy(Entry, Target,
+                             filesystem::copy_options::recursive | filesystem::copy_options::overwrite_existing);
+            filesystem::remove_all(Entry);
+          } else {
+            filesystem::remove(Target);
+            filesystem::rename(Entry, Target);
+          }
+        }
+        return;
+      }
+
+      // An existing previous output means the last incremental run didn't finish, what is in the output is partial
+      if (KeepPrevious && !filesystem::exists(PreviousDir)) {
+        filesystem::create_directories(PreviousDir);
+        for (const auto &Entry : Entries) {
+          filesystem::rename(Entry, PreviousDir / Entry.filename());
+        }
+        filesystem::remove_all(ResumeDir);
+        return;
+      }
+
+      for (const auto &Entry : Entries) {
+        filesystem::remove_all(Entry);
+      }
+
+      filesystem::remove_all(ResumeDir);
+      if (!KeepPrevious) {
+        filesystem::remove_all(PreviousDir);
       }
     } catch (const exception &E) {
       spdlog::critical(L"Error deleting output directory {}: {}", OutputDir.wstring(), strToWstr(E.what()));
@@ -212,34 +517,406 @@ void ParallaxGen::deleteOutputDir() const {
   }
 }
 
+void ParallaxGen::initIncremental(const string &RunSettings) {
+  const auto PreviousDir = OutputDir / getPreviousOutputDirName();
+  Incremental = make_unique<ParallaxGenIncremental>(PreviousDir, PreviousDir / getOutputZipName());
+  IncrementalRunSettings = RunSettings;
+  WriteManifest = true;
+}
+
+void ParallaxGen::initJournal(const string &RunSettings) {
+  if (Incremental == nullptr) {
+    Incremental = make_unique<ParallaxGenIncremental>();
+    IncrementalRunSettings = RunSettings;
+  }
+
+  Incremental->openJournal(OutputDir / ParallaxGenIncremental::getJournalName());
+}
+
+void ParallaxGen::initResume() {
+  const auto ResumeDir = OutputDir / getResumeDirName();
+  if (!filesystem::exists(ResumeDir)) {
+    spdlog::warn("No interrupted run to resume, all meshes will be processed");
+    return;
+  }
+
+  Resume = make_unique<ParallaxGenIncremental>(ResumeDir, ResumeDir / getOutputZipName());
+}
+
 auto ParallaxGen::getOutputZipName() -> filesystem::path { return "ParallaxGen_Output.zip"; }
 
 auto ParallaxGen::getDiffJSONName() -> filesystem::path { return "ParallaxGen_Diff.json"; }
 
-// shorten some enum names
-auto ParallaxGen::processNIF(const filesystem::path &NIFFile, nlohmann::json &DiffJSON, const bool &PatchPlugin) -> ParallaxGenTask::PGResult {
-  auto Result = ParallaxGenTask::PGResult::SUCCESS;
+auto ParallaxGen::getPreviousOutputDirName() -> filesystem::path { return "ParallaxGen_Previous"; }
+
+auto ParallaxGen::getResumeDirName() -> filesystem::path { return "ParallaxGen_Resume"; }
+
+void ParallaxGen::initShard(const size_t &Index, const size_t &Count, const string &RunSettings) {
+  ShardIndex = Index;
+  ShardCount = Count;
+
+  // The merge needs a record of every mesh, a record-only manifest is kept if incremental mode isn't on already
+  if (Incremental == nullptr) {
+    Incremental = make_unique<ParallaxGenIncremental>();
+    IncrementalRunSettings = RunSettings;
+  }
+  WriteManifest = true;
+}
+
+void ParallaxGen::initMerge(const vector<filesystem::path> &ShardDirs) {
+  ShardOutputs.clear();
+  for (const auto &ShardDir : ShardDirs) {
+    spdlog::info(L"Loading shard output {}", ShardDir.wstring());
+    ShardOutputs.push_back(make_unique<ParallaxGenIncremental>(ShardDir, ShardDir / getOutputZipName()));
+  }
+}
+
+auto ParallaxGen::isInShard(const filesystem::path &NIFFile, const size_t &Index, const size_t &Count) -> bool {
+  if (Count <= 1) {
+    return true;
+  }
+
+  ParallaxGenKeyHasher Hasher;
+  Hasher.add(boost::to_lower_copy(NIFFile.wstring()));
+  return Hasher.get() % Count == Index;
+}
+
+void ParallaxGen::addPluginShapes(const filesystem::path &NIFFile,
+                                  const vector<ParallaxGenIncremental::PluginShape> &Shapes) {
+  if (Shapes.empty()) {
+    return;
+  }
+
+  const lock_guard<mutex> Lock(PluginShapesMutex);
+  auto &MeshShapes = PluginShapes[NIFFile];
+  MeshShapes.insert(MeshShapes.end(), Shapes.begin(), Shapes.end());
+}
+
+void ParallaxGen::patchPlugin() {
+  spdlog::info("Patching plugin...");
+
+  const lock_guard<mutex> Lock(PluginShapesMutex);
+  for (const auto &[NIFFile, Shapes] : PluginShapes) {
+    for (const auto &Shape : Shapes) {
+      ParallaxGenPlugin::processShape(static_cast<NIFUtil::ShapeShader>(Shape.Shader), NIFFile.wstring(),
+                                      Shape.ShapeName, Shape.OldIndex, Shape.NewIndex);
+    }
+  }
+  PluginShapes.clear();
+}
+
+auto ParallaxGen::computeSettingsKey(const bool &PatchPlugin) const -> uint64_t {
+  ParallaxGenKeyHasher Hasher;
+  Hasher.add(IncrementalRunSettings);
+  Hasher.add(static_cast<uint64_t>(IgnoreParallax));
+  Hasher.add(static_cast<uint64_t>(IgnoreCM));
+  Hasher.add(static_cast<uint64_t>(IgnoreTruePBR));
+  Hasher.add(static_cast<uint64_t>(PatchPlugin));
+  Hasher.add(static_cast<uint64_t>(NIFSaveOptions.optimize));
+
+  // Config that decides CM details
+  const auto &DynCubemapBlocklist = PGC->getDynCubemapBlocklist();
+  vector<wstring> SortedBlocklist(DynCubemapBlocklist.begin(), DynCubemapBlocklist.end());
+  sort(SortedBlocklist.begin(), SortedBlocklist.end());
+  for (const auto &Entry : SortedBlocklist) {
+    Hasher.add(Entry);
+  }
+
+  // PBR configs match by texture name anywhere in the load order, so any PBR config change affects every mesh
+  for (const auto &PBRJSON : PGD->getPBRJSONs()) {
+    Hasher.add(PBRJSON.wstring());
+    const auto Bytes = PGD->getFile(PBRJSON);
+    Hasher.add(Bytes.data(), Bytes.size());
+  }
+
+  // Same for the PBR texture folders they check for
+  static const wstring PBRTexturePrefix = L"textures\\pbr\\";
+  PGD->forEachFile(PBRTexturePrefix, [&Hasher](const filesystem::path &Path, const auto &File) {
+    Hasher.add(Path.wstring());
+    Hasher.add(static_cast<uint64_t>(File.Size));
+  });
+
+  return Hasher.get();
+}
+
+auto ParallaxGen::computeDecisionKey(const vector<wstring> &TextureRefs) const -> uint64_t {
+  ParallaxGenKeyHasher Hasher;
+  Hasher.add(DecisionSettingsKey);
+
+  // Identifies the winning copy of a file, aspect ratio checks read its header
+  const auto AddFileState = [this, &Hasher](const filesystem::path &File) {
+    Hasher.add(static_cast<uint64_t>(PGD->getFileSize(File)));
+    const auto Source = PGD->getFileSource(File);
+    Hasher.add(Source.wstring());
+    if (Source.empty() && PGD->isLooseFile(File)) {
+      error_code EC;
+      const auto WriteTime = filesystem::last_write_time(PGD->getFullPath(File), EC);
+      Hasher.add(static_cast<uint64_t>(EC ? 0 : WriteTime.time_since_epoch().count()));
+    }
+  };
+
+  for (const auto &TextureRef : TextureRefs) {
+    Hasher.add(TextureRef);
+    AddFileState(TextureRef);
+
+    // Every candidate a patcher can match for this prefix, with its classification
+    for (unsigned Slot = 0; Slot < NUM_TEXTURE_SLOTS; Slot++) {
+      const auto &SlotMap = PGD->getTextureMapConst(static_cast<NIFUtil::TextureSlots>(Slot));
+      const auto It = SlotMap.find(TextureRef);
+      if (It == SlotMap.end()) {
+        continue;
+      }
+
+      vector<pair<wstring, int>> Candidates;
+      for (const auto &Texture : It->second) {
+        Candidates.emplace_back(Texture.Path.wstring(), static_cast<int>(Texture.Type));
+      }
+      sort(Candidates.begin(), Candidates.end());
+
+      Hasher.add(static_cast<uint64_t>(Slot));
+      for (const auto &[Path, Type] : Candidates) {
+        Hasher.add(Path);
+        Hasher.add(static_cast<uint64_t>(Type));
+        AddFileState(Path);
+      }
+    }
+  }
+
+  return Hasher.get();
+}
+
+auto ParallaxGen::tryReuseNIF(const ParallaxGenIncremental::MeshRecord &Previous, ParallaxGenIncremental &Source,
+                              const MeshReadJob &ReadJob, MeshWriteJob &WriteJob, const bool &PatchPlugin) -> bool {
+  const auto &NIFFile = ReadJob.NIFFile;
 
+  ParallaxGenOutputFile OutputFile;
+  if (Previous.Patched) {
+    OutputFile = Output->makeFile(NIFFile, Source.getPreviousFile(NIFFile));
+    if (OutputFile.Bytes.empty() || OutputFile.CRC32 != Previous.CRCAfter) {
+      spdlog::debug(L"NIF: {} | Previous output missing or modified, patching again", NIFFile.wstring());
+      return false;
+    }
+  }
+
+  spdlog::trace(L"NIF: {} | Inputs unchanged, reusing previous result", NIFFile.wstring());
+
+  if (PatchPlugin) {
+    addPluginShapes(NIFFile, Previous.PluginShapes);
+  }
+
+  if (Incremental != nullptr) {
+    Incremental->addRecord(Previous);
+  }
+  WriteJob.Record = Previous;
+
+  if (Previous.Patched) {
+    WriteJob.Seq = ReadJob.Seq;
+    WriteJob.NIFFile = NIFFile;
+    WriteJob.OutputFile = std::move(OutputFile);
+    WriteJob.CRCBefore = Previous.CRCBefore;
+  }
+
+  return true;
+}
+
+auto ParallaxGen::processNIF(const filesystem::path &NIFFile, vector<MeshDiffEntry> &DiffEntries,
+                             ParallaxGenTask &TaskTracker, const bool &PatchPlugin) -> ParallaxGenTask::PGResult {
+  MeshReadJob ReadJob;
+  auto Result = readNIF(NIFFile, ReadJob);
+  if (Result == ParallaxGenTask::PGResult::FAILURE) {
+    finishDuplicateMeshes(NIFFile, MeshWriteJob(), Result, PatchPlugin, DiffEntries, TaskTracker);
+    return Result;
+  }
+
+  MeshWriteJob WriteJob;
+  Result = patchNIF(ReadJob, WriteJob, PatchPlugin);
+  finishDuplicateMeshes(NIFFile, WriteJob, Result, PatchPlugin, DiffEntries, TaskTracker);
+  if (Result == ParallaxGenTask::PGResult::FAILURE || WriteJob.OutputFile.Bytes.empty()) {
+    return Result;
+  }
+
+  ParallaxGenTask::updatePGResult(Result, writeNIF(WriteJob, DiffEntries));
+  return Result;
+}
+
+auto ParallaxGen::findDuplicateMeshes(const vector<filesystem::path> &Meshes, const bool &MultiThread)
+    -> vector<filesystem::path> {
+  DuplicateMeshes.clear();
+
+  // Only meshes sharing a size can be identical, so only those are read and hashed
+  unordered_map<size_t, vector<size_t>> SizeBuckets;
+  for (size_t I = 0; I < Meshes.size(); I++) {
+    SizeBuckets[PGD->getFileSize(Meshes[I])].push_back(I);
+  }
+
+  vector<size_t> ToHash;
+  for (const auto &[Size, Bucket] : SizeBuckets) {
+    if (Bucket.size() > 1) {
+      ToHash.insert(ToHash.end(), Bucket.begin(), Bucket.end());
+    }
+  }
+
+  if (ToHash.empty()) {
+    return Meshes;
+  }
+
+  spdlog::info("Hashing {} meshes to find duplicates...", ToHash.size());
+
+  // Each task writes its own slots, no locking needed
+  vector<uint64_t> ContentHashes(Meshes.size(), 0);
+  const auto HashMesh = [this, &Meshes, &ContentHashes](const size_t &Index) {
+    try {
+      const auto Bytes = PGD->getFile(Meshes[Index]);
+      ParallaxGenKeyHasher Hasher;
+      Hasher.add(Bytes.data(), Bytes.size());
+      ContentHashes[Index] = Hasher.get();
+    } catch (const exception &E) {
+      // Left at 0, patched on its own
+      spdlog::debug(L"Unable to hash NIF {}: {}", Meshes[Index].wstring(), strToWstr(E.what()));
+    }
+  };
+
+  if (MultiThread) {
+    ParallaxGenScheduler::get().parallelFor(0, ToHash.size(),
+                                            [&ToHash, &HashMesh](const size_t &I) { HashMesh(ToHash[I]); });
+  } else {
+    for (const auto &Index : ToHash) {
+      HashMesh(Index);
+    }
+  }
+
+  // First mesh of every group (in mesh order) is patched, the others reuse its result
+  map<tuple<size_t, uint64_t, string>, size_t> Groups;
+  vector<filesystem::path> UniqueMeshes;
+  UniqueMeshes.reserve(Meshes.size());
+  size_t NumDuplicates = 0;
+  for (size_t I = 0; I < Meshes.size(); I++) {
+    if (ContentHashes[I] == 0) {
+      UniqueMeshes.push_back(Meshes[I]);
+      continue;
+    }
+
+    const auto Key = make_tuple(PGD->getFileSize(Meshes[I]), ContentHashes[I], getMeshPathSignature(Meshes[I]));
+    const auto [It, Inserted] = Groups.emplace(Key, I);
+    if (Inserted) {
+      UniqueMeshes.push_back(Meshes[I]);
+      continue;
+    }
+
+    spdlog::trace(L"NIF: {} | Identical to {}, reusing its result", Meshes[I].wstring(), Meshes[It->second].wstring());
+    DuplicateMeshes[Meshes[It->second]].push_back(Meshes[I]);
+    NumDuplicates++;
+  }
+
+  spdlog::info("Found {} duplicate meshes, {} meshes will be patched", NumDuplicates, UniqueMeshes.size());
+  return UniqueMeshes;
+}
+
+void ParallaxGen::finishDuplicateMeshes(const filesystem::path &NIFFile, const MeshWriteJob &WriteJob,
+                                        const ParallaxGenTask::PGResult &Result, const bool &PatchPlugin,
+                                        vector<MeshDiffEntry> &DiffEntries, ParallaxGenTask &TaskTracker) {
+  const auto It = DuplicateMeshes.find(NIFFile);
+  if (It == DuplicateMeshes.end()) {
+    return;
+  }
+
+  for (const auto &Duplicate : It->second) {
+    if (Result == ParallaxGenTask::PGResult::FAILURE) {
+      spdlog::error(L"NIF: {} | NIF Rejected: Identical mesh {} failed", Duplicate.wstring(), NIFFile.wstring());
+      TaskTracker.completeJob(Result);
+      continue;
+    }
+
+    if (PatchPlugin) {
+      addPluginShapes(Duplicate, WriteJob.Record.PluginShapes);
+    }
+
+    if (Incremental != nullptr) {
+      auto Record = WriteJob.Record;
+      Record.NIFFile = Duplicate;
+      Incremental->addRecord(std::move(Record));
+    }
+
+    if (!WriteJob.OutputFile.Bytes.empty()) {
+      // Same bytes (already deflated if compressing) under the duplicate's path
+      auto OutputFile = WriteJob.OutputFile;
+      OutputFile.RelPath = Duplicate;
+      addFileToOutput(std::move(OutputFile));
+      DiffEntries.push_back({wstrToStr(Duplicate.wstring()), WriteJob.CRCBefore, WriteJob.OutputFile.CRC32});
+    }
+
+    TaskTracker.completeJob(Result);
+  }
+}
+
+auto ParallaxGen::readNIF(const filesystem::path &NIFFile, MeshReadJob &ReadJob) const -> ParallaxGenTask::PGResult {
   spdlog::trace(L"NIF: {} | Starting processing", NIFFile.wstring());
 
   // Determine output path for patched NIF
   const filesystem::path OutputFile = OutputDir / NIFFile;
   if (filesystem::exists(OutputFile)) {
     spdlog::error(L"NIF: {} | NIF Rejected: File already exists", NIFFile.wstring());
-    Result = ParallaxGenTask::PGResult::FAILURE;
-    return Result;
+    return ParallaxGenTask::PGResult::FAILURE;
   }
 
-  // Load NIF file
-  const vector<std::byte> NIFFileData = PGD->getFile(NIFFile);
-  NifFile NIF;
+  ReadJob.NIFFile = NIFFile;
+  ReadJob.NIFFileData = PGD->getFile(NIFFile);
+
+  return ParallaxGenTask::PGResult::SUCCESS;
+}
+
+auto ParallaxGen::patchNIF(MeshReadJob &ReadJob, MeshWriteJob &WriteJob,
+                           const bool &PatchPlugin) -> ParallaxGenTask::PGResult {
+  auto Result = ParallaxGenTask::PGResult::SUCCESS;
+
+  const auto &NIFFile = ReadJob.NIFFile;
+
+  // Calculate CRC32 hash before, the output file carries the CRC32 after (and deflates if the zip is compressed)
+  boost::crc_32_type CRCBeforeResult{};
+  CRCBeforeResult.process_bytes(ReadJob.NIFFileData.data(), ReadJob.NIFFileData.size());
+  const uint32_t CRCBefore = CRCBeforeResult.checksum();
+
+  // Merge runs take the result of the shard that patched the mesh, patching is deterministic so that is the same
+  if (!ShardOutputs.empty()) {
+    const ParallaxGenIncremental::MeshRecord *ShardRecord = nullptr;
+    for (auto &Shard : ShardOutputs) {
+      ShardRecord = Shard->findPrevious(NIFFile);
+      if (ShardRecord != nullptr) {
+        if (ShardRecord->CRCBefore == CRCBefore && tryReuseNIF(*ShardRecord, *Shard, ReadJob, WriteJob, PatchPlugin)) {
+          return Result;
+        }
+        break;
+      }
+    }
+
+    spdlog::warn(L"NIF: {} | No usable result in the shard outputs, patching it", NIFFile.wstring());
+  }
+
+  // Resumed and incremental runs reuse an earlier result if neither the mesh nor anything its patching depended on
+  // changed
+  for (auto *Source : {Resume.get(), Incremental.get()}) {
+    if (Source == nullptr) {
+      continue;
+    }
+
+    const auto *Previous = Source->findPrevious(NIFFile);
+    if (Previous != nullptr && Previous->CRCBefore == CRCBefore &&
+        Previous->DecisionKey == computeDecisionKey(Previous->TextureRefs) &&
+        tryReuseNIF(*Previous, *Source, ReadJob, WriteJob, PatchPlugin)) {
+      return Result;
+    }
+  }
+
+  // Load NIF file (constructed in place, NifFile has no cheap move)
+  unique_ptr<NifFile> NIFPtr;
   try {
-    NIF = NIFUtil::loadNIFFromBytes(NIFFileData);
+    NIFPtr.reset(new NifFile(NIFUtil::loadNIFFromBytes(ReadJob.NIFFileData))); // NOLINT(cppcoreguidelines-owning-memory)
   } catch(const exception &E) {
     spdlog::error(L"NIF: {} | NIF Rejected: Unable to load NIF: {}", NIFFile.wstring(), strToWstr(E.what()));
     Result = ParallaxGenTask::PGResult::FAILURE;
     return Result;
   }
+  NifFile &NIF = *NIFPtr;
 
   // Stores whether the NIF has been modified throughout the patching process
   bool NIFModified = false;
@@ -250,11 +927,14 @@ auto ParallaxGen::processNIF(const filesystem::path &NIFFile, nlohmann::json &Di
   PatcherComplexMaterial PatchCM(NIFFile, &NIF, PGC, PGD3D);
   PatcherTruePBR PatchTPBR(NIFFile, &NIF);
 
+  const auto PathSignature = getMeshPathSignature(NIFFile);
+
   // Patch each shape in NIF
   size_t NumShapes = 0;
   int OldShapeIndex = 0;
   int NewShapeIndex = 0;
   bool OneShapeSuccess = false;
+  auto &Record = WriteJob.Record;
   for (NiShape *NIFShape : NIF.GetShapes()) {
     NumShapes++;
 
@@ -262,7 +942,8 @@ auto ParallaxGen::processNIF(const filesystem::path &NIFFile, nlohmann::json &Di
     bool ShapeDeleted = false;
     NIFUtil::ShapeShader ShaderApplied = NIFUtil::ShapeShader::NONE;
     ParallaxGenTask::updatePGResult(Result,
-                                    processShape(NIFFile, NIF, NIFShape, PatchVP, PatchCM, PatchTPBR, ShapeModified, ShapeDeleted, ShaderApplied),
+                                    processShape(NIFFile, NIF, NIFShape, PatchVP, PatchCM, PatchTPBR, ShapeModified,
+                                                 ShapeDeleted, ShaderApplied, Record.TextureRefs, PathSignature),
                                     ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
 
     // Update NIFModified if shape was modified
@@ -270,9 +951,9 @@ auto ParallaxGen::processNIF(const filesystem::path &NIFFile, nlohmann::json &Di
       NIFModified = true;
 
       if (PatchPlugin) {
-        // Process plugin
+        // Plugin is patched once all meshes are done
         auto ShapeName = strToWstr(NIFShape->name.get());
-        ParallaxGenPlugin::processShape(ShaderApplied, NIFFile.wstring(), ShapeName, OldShapeIndex, NewShapeIndex);
+        Record.PluginShapes.push_back({static_cast<int>(ShaderApplied), ShapeName, OldShapeIndex, NewShapeIndex});
       }
     }
 
@@ -293,49 +974,67 @@ auto ParallaxGen::processNIF(const filesystem::path &NIFFile, nlohmann::json &Di
     return Result;
   }
 
-  // Save patched NIF if it was modified
+  // Serialize patched NIF in memory for the write stage if it was modified
   if (NIFModified) {
-    // Calculate CRC32 hash before
-    boost::crc_32_type CRCBeforeResult{};
-    CRCBeforeResult.process_bytes(NIFFileData.data(), NIFFileData.size());
-    const auto CRCBefore = CRCBeforeResult.checksum();
-
-    // create directories if required
-    filesystem::create_directories(OutputFile.parent_path());
-
-    if (NIF.Save(OutputFile, NIFSaveOptions) != 0) {
-      spdlog::error(L"Unable to save NIF file: {}", NIFFile.wstring());
+    vector<std::byte> PatchedNIFData;
+    try {
+      PatchedNIFData = NIFUtil::saveNIFToBytes(NIF, NIFSaveOptions);
+    } catch (const exception &E) {
+      spdlog::error(L"Unable to save NIF file: {}: {}", NIFFile.wstring(), strToWstr(E.what()));
       Result = ParallaxGenTask::PGResult::FAILURE;
       return Result;
     }
 
-    spdlog::debug(L"NIF: {} | Saving patched NIF to output", NIFFile.wstring());
-
     // Clear NIF from memory (no longer needed)
-    NIF.Clear();
+    NIFPtr.reset();
+
+    WriteJob.Seq = ReadJob.Seq;
+    WriteJob.NIFFile = NIFFile;
+    WriteJob.OutputFile = Output->makeFile(NIFFile, std::move(PatchedNIFData));
+    WriteJob.CRCBefore = CRCBefore;
+  }
 
-    // Calculate CRC32 hash after
-    const auto OutputFileBytes = getFileBytes(OutputFile);
-    boost::crc_32_type CRCResultAfter{};
-    CRCResultAfter.process_bytes(OutputFileBytes.data(), OutputFileBytes.size());
-    const auto CRCAfter = CRCResultAfter.checksum();
+  sort(Record.TextureRefs.begin(), Record.TextureRefs.end());
+  Record.TextureRefs.erase(unique(Record.TextureRefs.begin(), Record.TextureRefs.end()), Record.TextureRefs.end());
+  Record.NIFFile = NIFFile;
+  Record.CRCBefore = CRCBefore;
+  Record.Patched = NIFModified;
+  Record.CRCAfter = NIFModified ? WriteJob.OutputFile.CRC32 : 0;
 
-    // Add to diff JSON
-    auto JSONKey = wstrToStr(NIFFile.wstring());
-    threadSafeJSONUpdate(
-        [&](nlohmann::json &JSON) {
-          JSON[JSONKey]["crc32original"] = CRCBefore;
-          JSON[JSONKey]["crc32patched"] = CRCAfter;
-        },
-        DiffJSON);
+  if (PatchPlugin) {
+    addPluginShapes(NIFFile, Record.PluginShapes);
+  }
+
+  if (Incremental != nullptr) {
+    Record.DecisionKey = computeDecisionKey(Record.TextureRefs);
+    Incremental->addRecord(Record);
   }
 
   return Result;
 }
 
+auto ParallaxGen::writeNIF(MeshWriteJob &WriteJob, vector<MeshDiffEntry> &DiffEntries) -> ParallaxGenTask::PGResult {
+  auto Result = ParallaxGenTask::PGResult::SUCCESS;
+
+  const auto &NIFFile = WriteJob.NIFFile;
+
+  // Hand the already serialized NIF to the output writer, the checksum was taken from the same buffer
+  const auto CRCAfter = WriteJob.OutputFile.CRC32;
+  addFileToOutput(std::move(WriteJob.OutputFile));
+
+  spdlog::debug(L"NIF: {} | Saving patched NIF to output", NIFFile.wstring());
+
+  // Add to diff JSON
+  DiffEntries.push_back({wstrToStr(NIFFile.wstring()), WriteJob.CRCBefore, CRCAfter});
+
+  return Result;
+}
+
 auto ParallaxGen::processShape(const filesystem::path &NIFPath, NifFile &NIF, NiShape *NIFShape,
                                PatcherVanillaParallax &PatchVP, PatcherComplexMaterial &PatchCM,
-                               PatcherTruePBR &PatchTPBR, bool &ShapeModified, bool &ShapeDeleted, NIFUtil::ShapeShader &ShaderApplied) const -> ParallaxGenTask::PGResult {
+                               PatcherTruePBR &PatchTPBR, bool &ShapeModified, bool &ShapeDeleted, NIFUtil::ShapeShader &ShaderApplied,
+                               vector<wstring> &TextureRefs, const string &PathSignature) const
+    -> ParallaxGenTask::PGResult {
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
   // Prep
@@ -356,155 +1055,165 @@ auto ParallaxGen::processShape(const filesystem::path &NIFPath, NifFile &NIF, Ni
     return Result;
   }
 
-  // get NIFShader from shape
-  NiShader *NIFShader = NIF.GetShader(NIFShape);
-  if (NIFShader == nullptr) {
+  // Read the shape's material state once for all patchers
+  const auto View = NIFUtil::getShapeMaterialView(NIF, NIFShape);
+  if (View.Shader == nullptr) {
     // skip if no NIFShader
     spdlog::trace(L"NIF: {} | Shape: {} | Rejecting: No NIFShader property", NIFPath.wstring(), ShapeBlockID);
     return Result;
   }
 
   // check that NIFShader is a BSLightingShaderProperty
-  string NIFShaderName = NIFShader->GetBlockName();
-  if (NIFShaderName != "BSLightingShaderProperty") {
+  if (View.ShaderBSLSP == nullptr) {
     spdlog::trace(L"NIF: {} | Shape: {} | Rejecting: Incorrect NIFShader block type", NIFPath.wstring(), ShapeBlockID);
     return Result;
   }
 
   // check that NIFShader has a texture set
-  if (!NIFShader->HasTextureSet()) {
+  if (!View.Shader->HasTextureSet()) {
     spdlog::trace(L"NIF: {} | Shape: {} | Rejecting: No texture set", NIFPath.wstring(), ShapeBlockID);
     return Result;
   }
 
-  // Find search prefixes
-  auto OldSlots = NIFUtil::getTextureSlots(NIF, NIFShape);
-  auto SearchPrefixes = NIFUtil::getSearchPrefixes(NIF, NIFShape);
-  wstring MatchedPath;
+  // Textures the patchers look up, their state decides whether an incremental run can reuse this mesh
+  for (unsigned Slot = 0; Slot < NUM_TEXTURE_SLOTS; Slot++) {
+    if (!View.Slots.at(Slot).empty()) {
+      TextureRefs.push_back(View.Slots.at(Slot));
+    }
+    if (!View.SearchPrefixes.at(Slot).empty()) {
+      TextureRefs.push_back(View.SearchPrefixes.at(Slot));
+    }
+  }
 
-  // TRUEPBR CONFIG
-  if (!IgnoreTruePBR) {
-    bool EnableTruePBR = false;
-    map<size_t, tuple<nlohmann::json, wstring>> TruePBRData;
-    ParallaxGenTask::updatePGResult(Result,
-                                    PatchTPBR.shouldApply(NIFShape, SearchPrefixes, EnableTruePBR, TruePBRData),
-                                    ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
-    if (EnableTruePBR) {
-      // Enable TruePBR on shape
-      for (auto &TruePBRCFG : TruePBRData) {
-        spdlog::trace(L"NIF: {} | Shape: {} | PBR | Applying PBR Config {}", NIFPath.wstring(), ShapeBlockID,
-                      TruePBRCFG.first);
-        ParallaxGenTask::updatePGResult(Result, PatchTPBR.applyPatch(NIFShape, get<0>(TruePBRCFG.second),
-                                                                     get<1>(TruePBRCFG.second), ShapeModified, ShapeDeleted));
-      }
+  const auto Decision = getShapeDecision(View, PathSignature, PatchVP, PatchCM, PatchTPBR);
+  ParallaxGenTask::updatePGResult(Result, Decision->Result, ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
 
-      if (!ShapeDeleted) {
-        ShaderApplied = NIFUtil::ShapeShader::TRUEPBR;
-      }
+  // TRUEPBR CONFIG
+  if (Decision->EnableTruePBR) {
+    // Enable TruePBR on shape
+    for (const auto &TruePBRCFG : Decision->TruePBRData) {
+      spdlog::trace(L"NIF: {} | Shape: {} | PBR | Applying PBR Config {}", NIFPath.wstring(), ShapeBlockID,
+                    TruePBRCFG.first);
+      auto TruePBRJSON = get<0>(TruePBRCFG.second);
+      ParallaxGenTask::updatePGResult(
+          Result, PatchTPBR.applyPatch(View, TruePBRJSON, get<1>(TruePBRCFG.second), ShapeModified, ShapeDeleted));
+    }
 
-      return Result;
+    if (!ShapeDeleted) {
+      ShaderApplied = NIFUtil::ShapeShader::TRUEPBR;
     }
+
+    return Result;
   }
 
   // COMPLEX MATERIAL
-  if (!IgnoreCM) {
-    bool EnableCM = false;
-    bool EnableDynCubemaps = false;
-    MatchedPath = L"";
+  if (Decision->EnableCM) {
+    // Enable complex material on shape
     ParallaxGenTask::updatePGResult(
-        Result, PatchCM.shouldApply(NIFShape, SearchPrefixes, OldSlots, EnableCM, EnableDynCubemaps, MatchedPath),
-        ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
-    if (EnableCM) {
-      // Enable complex material on shape
-      ParallaxGenTask::updatePGResult(Result,
-                                      PatchCM.applyPatch(NIFShape, MatchedPath, EnableDynCubemaps, ShapeModified));
+        Result, PatchCM.applyPatch(View, Decision->CMMatchedPath, Decision->EnableDynCubemaps, ShapeModified));
 
-      ShaderApplied = NIFUtil::ShapeShader::COMPLEXMATERIAL;
+    ShaderApplied = NIFUtil::ShapeShader::COMPLEXMATERIAL;
 
-      return Result;
-    }
+    return Result;
   }
 
   // VANILLA PARALLAX
-  if (!IgnoreParallax) {
-    bool EnableParallax = false;
-    MatchedPath = L"";
-    ParallaxGenTask::updatePGResult(Result, PatchVP.shouldApply(NIFShape, SearchPrefixes, OldSlots, EnableParallax, MatchedPath),
-                                    ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
-    if (EnableParallax) {
-      // Enable Parallax on shape
-      ParallaxGenTask::updatePGResult(Result, PatchVP.applyPatch(NIFShape, MatchedPath, ShapeModified));
+  if (Decision->EnableParallax && PatchVP.shouldApplyShape(View)) {
+    // Enable Parallax on shape
+    ParallaxGenTask::updatePGResult(Result, PatchVP.applyPatch(View, Decision->ParallaxMatchedPath, ShapeModified));
 
-      ShaderApplied = NIFUtil::ShapeShader::VANILLAPARALLAX;
+    ShaderApplied = NIFUtil::ShapeShader::VANILLAPARALLAX;
 
-      return Result;
-    }
+    return Result;
   }
 
   return Result;
 }
 
-void ParallaxGen::threadSafeJSONUpdate(const std::function<void(nlohmann::json &)> &Operation,
-                                       nlohmann::json &DiffJSON) {
-  const std::lock_guard<std::mutex> Lock(JSONUpdateMutex);
-  Operation(DiffJSON);
-}
+auto ParallaxGen::serializeDiffJSON(vector<MeshDiffEntry> &DiffEntries) -> string {
+  // Same layout nlohmann::json::dump() produced for the old DOM: compact, keys in byte order
+  sort(DiffEntries.begin(), DiffEntries.end(),
+       [](const MeshDiffEntry &A, const MeshDiffEntry &B) { return A.NIFFile < B.NIFFile; });
+
+  // Rough per entry size to avoid regrowing the buffer
+  constexpr size_t DIFF_ENTRY_OVERHEAD = 64;
+  string Out;
+  Out.reserve(DiffEntries.size() * DIFF_ENTRY_OVERHEAD + 3);
+
+  Out += '{';
+  for (size_t I = 0; I < DiffEntries.size(); I++) {
+    const auto &Entry = DiffEntries[I];
+    if (I > 0) {
+      Out += ',';
+    }
 
-void ParallaxGen::addFileToZip(mz_zip_archive &Zip, const filesystem::path &FilePath,
-                               const filesystem::path &ZipPath) const {
-  // ignore Zip file itself
-  if (FilePath == ZipPath) {
-    return;
+    // Only the key needs escaping, a single string value does not build a DOM
+    Out += nlohmann::json(Entry.NIFFile).dump();
+    Out += R"(:{"crc32original":)";
+    Out += to_string(Entry.CRCBefore);
+    Out += R"(,"crc32patched":)";
+    Out += to_string(Entry.CRCAfter);
+    Out += '}';
   }
+  Out += "}\n";
 
-  // open file stream
-  vector<std::byte> Buffer = getFileBytes(FilePath);
-
-  // get relative path
-  const filesystem::path ZipRelativePath = FilePath.lexically_relative(OutputDir);
-
-  const string ZipFilePath = wstrToStr(ZipRelativePath.wstring());
-
-  // add file to Zip
-  if (mz_zip_writer_add_mem(&Zip, ZipFilePath.c_str(), Buffer.data(), Buffer.size(), MZ_NO_COMPRESSION) == 0) {
-    spdlog::error(L"Error adding file to zip: {}", FilePath.wstring());
-    exit(1);
-  }
+  return Out;
 }
 
-void ParallaxGen::zipDirectory(const filesystem::path &DirPath, const filesystem::path &ZipPath) const {
-  mz_zip_archive Zip;
-
-  // init to 0
-  memset(&Zip, 0, sizeof(Zip));
-
-  // Check if file already exists and delete
-  if (filesystem::exists(ZipPath)) {
-    spdlog::info(L"Deleting existing output Zip file: {}", ZipPath.wstring());
-    filesystem::remove(ZipPath);
-  }
-
-  // initialize file
-  const string ZipPathString = wstrToStr(ZipPath);
-  if (mz_zip_writer_init_file(&Zip, ZipPathString.c_str(), 0) == 0) {
-    spdlog::critical(L"Error creating Zip file: {}", ZipPath.wstring());
-    exit(1);
+auto ParallaxGen::getMeshPathSignature(const filesystem::path &NIFFile) const -> string {
+  const auto NIFPath = NIFFile.wstring();
+  string Signature;
+  for (const auto &Filter : PBRNIFFilters) {
+    Signature += boost::icontains(NIFPath, Filter) ? '1' : '0';
   }
+  Signature += ParallaxGenDirectory::checkGlobMatchInSet(NIFPath, PGC->getDynCubemapBlocklist()) ? '1' : '0';
+  return Signature;
+}
 
-  // add each file in directory to Zip
-  for (const auto &Entry : filesystem::recursive_directory_iterator(DirPath)) {
-    if (filesystem::is_regular_file(Entry.path())) {
-      addFileToZip(Zip, Entry.path(), ZipPath);
+auto ParallaxGen::getShapeDecision(const NIFUtil::ShapeMaterialView &View, const string &PathSignature,
+                                   PatcherVanillaParallax &PatchVP, PatcherComplexMaterial &PatchCM,
+                                   PatcherTruePBR &PatchTPBR) const -> shared_ptr<const ShapeDecision> {
+  // Flags any patcher's decision looks at, the rest can differ between shapes sharing a decision
+  static constexpr uint32_t DecisionFlags1 = SLSF1_DECAL | SLSF1_DYNAMIC_DECAL;
+  static constexpr uint32_t DecisionFlags2 =
+      SLSF2_UNUSED01 | SLSF2_SOFT_LIGHTING | SLSF2_RIM_LIGHTING | SLSF2_BACK_LIGHTING;
+
+  ShapeDecisionKey Key;
+  Key.Slots = View.Slots;
+  Key.ShaderType = static_cast<uint32_t>(View.ShaderType);
+  Key.ShaderFlags1 = View.ShaderFlags1 & DecisionFlags1;
+  Key.ShaderFlags2 = View.ShaderFlags2 & DecisionFlags2;
+  Key.PathSignature = PathSignature;
+
+  return ShapeDecisions.getOrCompute(Key, [&]() {
+    auto Decision = make_shared<ShapeDecision>();
+
+    if (!IgnoreTruePBR) {
+      ParallaxGenTask::updatePGResult(Decision->Result,
+                                      PatchTPBR.shouldApply(View, Decision->EnableTruePBR, Decision->TruePBRData),
+                                      ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
+      if (Decision->EnableTruePBR) {
+        return shared_ptr<const ShapeDecision>(std::move(Decision));
+      }
     }
-  }
 
-  // finalize Zip
-  if (mz_zip_writer_finalize_archive(&Zip) == 0) {
-    spdlog::critical(L"Error finalizing Zip archive: {}", ZipPath.wstring());
-    exit(1);
-  }
+    if (!IgnoreCM) {
+      ParallaxGenTask::updatePGResult(
+          Decision->Result,
+          PatchCM.shouldApply(View, Decision->EnableCM, Decision->EnableDynCubemaps, Decision->CMMatchedPath),
+          ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
+      if (Decision->EnableCM) {
+        return shared_ptr<const ShapeDecision>(std::move(Decision));
+      }
+    }
 
-  mz_zip_writer_end(&Zip);
+    if (!IgnoreParallax) {
+      ParallaxGenTask::updatePGResult(
+          Decision->Result,
+          PatchVP.shouldApplyMaterial(View, Decision->EnableParallax, Decision->ParallaxMatchedPath),
+          ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
+    }
 
-  spdlog::info(L"Please import this file into your mod manager: {}", ZipPath.wstring());
+    return shared_ptr<const ShapeDecision>(std::move(Decision));
+  });
 }
@@ -0,0 +1,604 @@
+#include "ParallaxGenCPUCompute.hpp"
+
+#include "ParallaxGenScheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PARALLAXGEN_SSE2
+#endif
+
+using namespace std;
+
+namespace {
+constexpr size_t BYTES_PER_PIXEL = 4;
+constexpr uint8_t MAX_CHANNEL_VALUE = 255;
+constexpr uint8_t DEFAULT_ENV_VALUE = 0;
+constexpr uint8_t DEFAULT_PARALLAX_VALUE = MAX_CHANNEL_VALUE;
+
+void updateRange(ParallaxGenCPUCompute::MinMaxValues &Range, const uint32_t &Env, const uint32_t &Parallax) {
+  Range.MinEnvValue = min(Range.MinEnvValue, Env);
+  Range.MaxEnvValue = max(Range.MaxEnvValue, Env);
+  Range.MinParallaxValue = min(Range.MinParallaxValue, Parallax);
+  Range.MaxParallaxValue = max(Range.MaxParallaxValue, Parallax);
+}
+
+void mergeRange(ParallaxGenCPUCompute::MinMaxValues &Range, const ParallaxGenCPUCompute::MinMaxValues &Other) {
+  Range.MinEnvValue = min(Range.MinEnvValue, Other.MinEnvValue);
+  Range.MaxEnvValue = max(Range.MaxEnvValue, Other.MaxEnvValue);
+  Range.MinParallaxValue = min(Range.MinParallaxValue, Other.MinParallaxValue);
+  Range.MaxParallaxValue = max(Range.MaxParallaxValue, Other.MaxParallaxValue);
+}
+
+// Source index of every destination index, floor(Scale * I) like the shader computes it
+auto getSourceIndices(const size_t &SourceSize, const size_t &DestSize) -> vector<size_t> {
+  const float Scale = static_cast<float>(SourceSize) / static_cast<float>(DestSize);
+
+  vector<size_t> Indices(DestSize);
+  for (size_t I = 0; I < DestSize; I++) {
+    Indices[I] = min(SourceSize - 1, static_cast<size_t>(floor(Scale * static_cast<float>(I))));
+  }
+
+  return Indices;
+}
+
+// Rows are nullptr for missing maps
+void mergeRowScaled(const uint8_t *EnvRow, const vector<size_t> &EnvColumns, const uint8_t *ParallaxRow,
+                    const vector<size_t> &ParallaxColumns, const size_t &Width, uint8_t *OutRow,
+                    ParallaxGenCPUCompute::MinMaxValues &Range) {
+  for (size_t X = 0; X < Width; X++) {
+    const uint8_t Env = EnvRow != nullptr ? EnvRow[EnvColumns[X] * BYTES_PER_PIXEL] : DEFAULT_ENV_VALUE; // NOLINT
+    const uint8_t Parallax =
+        ParallaxRow != nullptr ? ParallaxRow[ParallaxColumns[X] * BYTES_PER_PIXEL] : DEFAULT_PARALLAX_VALUE; // NOLINT
+
+    uint8_t *Out = OutRow + (X * BYTES_PER_PIXEL); // NOLINT
+    Out[0] = Env;                                  // NOLINT
+    Out[1] = 0;                                    // NOLINT
+    Out[2] = 0;                                    // NOLINT
+    Out[3] = Parallax;                             // NOLINT
+    updateRange(Range, Env, Parallax);
+  }
+}
+
+// Same as mergeRowScaled when both maps are output sized
+void mergeRowUnscaled(const uint8_t *EnvRow, const uint8_t *ParallaxRow, const size_t &Width, uint8_t *OutRow,
+                      ParallaxGenCPUCompute::MinMaxValues &Range) {
+  size_t X = 0;
+
+#ifdef PARALLAXGEN_SSE2
+  // Four pixels at a time, only the red byte of every pixel is kept so the byte wise min/max work on whole registers
+  const __m128i RedMask = _mm_set1_epi32(MAX_CHANNEL_VALUE);
+  __m128i EnvMin = _mm_set1_epi8(-1);
+  __m128i EnvMax = _mm_setzero_si128();
+  __m128i ParallaxMin = _mm_set1_epi8(-1);
+  __m128i ParallaxMax = _mm_setzero_si128();
+
+  for (; X + 4 <= Width; X += 4) {
+    const size_t Offset = X * BYTES_PER_PIXEL;
+    const __m128i Env =
+        EnvRow != nullptr
+            ? _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(EnvRow + Offset)), RedMask) // NOLINT
+            : _mm_setzero_si128();
+    const __m128i Parallax =
+        ParallaxRow != nullptr
+            ? _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ParallaxRow + Offset)), RedMask) // NOLINT
+            : RedMask;
+
+    // red stays in place, parallax moves to the alpha byte
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(OutRow + Offset), // NOLINT
+                     _mm_or_si128(Env, _mm_slli_epi32(Parallax, 24)));
+
+    EnvMin = _mm_min_epu8(EnvMin, Env);
+    EnvMax = _mm_max_epu8(EnvMax, Env);
+    ParallaxMin = _mm_min_epu8(ParallaxMin, Parallax);
+    ParallaxMax = _mm_max_epu8(ParallaxMax, Parallax);
+  }
+
+  if (X > 0) {
+    alignas(16) uint8_t Lanes[4][16]; // NOLINT
+    _mm_store_si128(reinterpret_cast<__m128i *>(Lanes[0]), EnvMin);      // NOLINT
+    _mm_store_si128(reinterpret_cast<__m128i *>(Lanes[1]), EnvMax);      // NOLINT
+    _mm_store_si128(reinterpret_cast<__m128i *>(Lanes[2]), ParallaxMin); // NOLINT
+    _mm_store_si128(reinterpret_cast<__m128i *>(Lanes[3]), ParallaxMax); // NOLINT
+    for (size_t Lane = 0; Lane < 4; Lane++) {
+      const size_t RedByte = Lane * BYTES_PER_PIXEL;
+      updateRange(Range, Lanes[0][RedByte], Lanes[2][RedByte]); // NOLINT
+      updateRange(Range, Lanes[1][RedByte], Lanes[3][RedByte]); // NOLINT
+    }
+  }
+#endif
+
+  for (; X < Width; X++) {
+    const size_t Offset = X * BYTES_PER_PIXEL;
+    const uint8_t Env = EnvRow != nullptr ? EnvRow[Offset] : DEFAULT_ENV_VALUE;                     // NOLINT
+    const uint8_t Parallax = ParallaxRow != nullptr ? ParallaxRow[Offset] : DEFAULT_PARALLAX_VALUE; // NOLINT
+
+    OutRow[Offset] = Env;          // NOLINT
+    OutRow[Offset + 1] = 0;        // NOLINT
+    OutRow[Offset + 2] = 0;        // NOLINT
+    OutRow[Offset + 3] = Parallax; // NOLINT
+    updateRange(Range, Env, Parallax);
+  }
+}
+
+auto countAlphaValuesRow(const uint8_t *Row, const size_t &Width) -> size_t {
+  size_t Count = 0;
+  size_t X = 0;
+
+#ifdef PARALLAXGEN_SSE2
+  const __m128i AlphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000U));
+  for (; X + 4 <= Width; X += 4) {
+    const __m128i Pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Row + (X * BYTES_PER_PIXEL))); // NOLINT
+    const __m128i Opaque = _mm_cmpeq_epi32(_mm_and_si128(Pixels, AlphaMask), AlphaMask);
+    Count += popcount(static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(Opaque))));
+  }
+#endif
+
+  for (; X < Width; X++) {
+    if (Row[(X * BYTES_PER_PIXEL) + 3] == MAX_CHANNEL_VALUE) { // NOLINT
+      Count++;
+    }
+  }
+
+  return Count;
+}
+//
+// Block compressed alpha
+//
+
+constexpr size_t BLOCK_SIZE = 4;
+constexpr size_t BLOCK_BYTES = 16;
+constexpr uint16_t ALL_TEXELS = 0xFFFF;
+
+// Bit 0 of each of the 16 nibbles / 3 bit fields in a block's alpha data
+constexpr uint64_t NIBBLE_LOW_BITS = 0x1111111111111111ULL;
+constexpr uint64_t TRIPLET_LOW_BITS = 0x249249249249ULL;
+
+// Texels of a block inside the image, row major like the blocks store them
+auto getValidTexels(const size_t &ValidColumns, const size_t &ValidRows) -> uint16_t {
+  const auto RowMask = static_cast<uint16_t>((1U << ValidColumns) - 1);
+  uint16_t Valid = 0;
+  for (size_t Row = 0; Row < ValidRows; Row++) {
+    Valid |= static_cast<uint16_t>(RowMask << (Row * BLOCK_SIZE));
+  }
+
+  return Valid;
+}
+
+// Moves bit T of Texels to bit T * FieldBits
+auto spreadTexels(const uint16_t &Texels, const size_t &FieldBits) -> uint64_t {
+  uint64_t Spread = 0;
+  for (size_t Texel = 0; Texel < BLOCK_SIZE * BLOCK_SIZE; Texel++) {
+    if (((Texels >> Texel) & 1U) != 0) {
+      Spread |= 1ULL << (Texel * FieldBits);
+    }
+  }
+
+  return Spread;
+}
+
+auto loadLittleEndian(const uint8_t *Bytes, const size_t &NumBytes) -> uint64_t {
+  uint64_t Value = 0;
+  for (size_t I = 0; I < NumBytes; I++) {
+    Value |= static_cast<uint64_t>(Bytes[I]) << (I * 8); // NOLINT
+  }
+
+  return Value;
+}
+
+// BC2: 4 bit explicit alpha, only 15 expands to 255
+auto countBC2Block(const uint8_t *Block, const uint64_t &ValidNibbles) -> size_t {
+  const uint64_t Alpha = loadLittleEndian(Block, 8);
+  const uint64_t Opaque = Alpha & (Alpha >> 1) & (Alpha >> 2) & (Alpha >> 3) & NIBBLE_LOW_BITS;
+  return popcount(Opaque & ValidNibbles);
+}
+
+// Palette entries of a BC3 alpha block that decode to 255. DirectXTex interpolates in float and rounds when storing
+// 8 bits, so an entry is 255 from 254.5 on. Sums are multiples of 1/7 or 1/5 so float error can't cross that
+auto getBC3OpaqueEntries(const uint32_t &Alpha0, const uint32_t &Alpha1) -> uint8_t {
+  uint8_t Opaque = 0;
+  Opaque |= Alpha0 == MAX_CHANNEL_VALUE ? 1U : 0U;
+  Opaque |= Alpha1 == MAX_CHANNEL_VALUE ? 2U : 0U;
+
+  if (Alpha0 > Alpha1) {
+    // 6 interpolated values, (Alpha0 * (7 - I) + Alpha1 * I) / 7 >= 254.5
+    for (uint32_t I = 1; I < 7; I++) {
+      if (((Alpha0 * (7 - I)) + (Alpha1 * I)) * 2 >= ((2U * MAX_CHANNEL_VALUE) - 1) * 7) {
+        Opaque |= static_cast<uint8_t>(1U << (I + 1));
+      }
+    }
+  } else {
+    // 4 interpolated values, then 0 and 255
+    for (uint32_t I = 1; I < 5; I++) {
+      if (((Alpha0 * (5 - I)) + (Alpha1 * I)) * 2 >= ((2U * MAX_CHANNEL_VALUE) - 1) * 5) {
+        Opaque |= static_cast<uint8_t>(1U << (I + 1));
+      }
+    }
+    Opaque |= 1U << 7;
+  }
+
+  return Opaque;
+}
+
+// BC3: two 8 bit endpoints and 3 bit palette indices
+auto countBC3Block(const uint8_t *Block, const uint64_t &ValidTriplets) -> size_t {
+  uint8_t OpaqueEntries = getBC3OpaqueEntries(Block[0], Block[1]); // NOLINT
+  if (OpaqueEntries == 0) {
+    return 0;
+  }
+
+  const uint64_t Indices = loadLittleEndian(Block + 2, 6); // NOLINT
+  size_t Count = 0;
+  while (OpaqueEntries != 0) {
+    const auto Entry = static_cast<uint64_t>(countr_zero(OpaqueEntries));
+    OpaqueEntries &= OpaqueEntries - 1;
+
+    // fields equal to Entry become all zero, their low bit is set after the or/not
+    const uint64_t Diff = Indices ^ (Entry * TRIPLET_LOW_BITS);
+    const uint64_t Matches = ~(Diff | (Diff >> 1) | (Diff >> 2)) & TRIPLET_LOW_BITS;
+    Count += popcount(Matches & ValidTriplets);
+  }
+
+  return Count;
+}
+
+// BC7 partitions for the two subset mode 7, bit T is set when texel T is in subset 1
+constexpr uint16_t BC7_PARTITIONS[64] = { // NOLINT
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8,
+    0xFF00, 0xFFF0, 0xF000, 0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110,
+    0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C, 0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696,
+    0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660, 0x0272, 0x04E4, 0x4E40, 0x2720,
+    0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22};
+
+// Anchor texel of subset 1 for each partition, subset 0 is anchored at texel 0
+constexpr uint8_t BC7_ANCHORS[64] = { // NOLINT
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 2,  8, 2,  2, 8,
+    8,  15, 2,  8,  2,  2,  8,  8,  2,  2,  15, 15, 6,  8,  2,  8,  15, 15, 2, 8,  2, 2,
+    2,  15, 15, 6,  6,  2,  6,  8,  15, 15, 2,  2,  15, 15, 15, 15, 15, 2,  2, 15};
+
+constexpr uint8_t BC7_WEIGHTS2[4] = {0, 21, 43, 64};                                          // NOLINT
+constexpr uint8_t BC7_WEIGHTS3[8] = {0, 9, 18, 27, 37, 46, 55, 64};                           // NOLINT
+constexpr uint8_t BC7_WEIGHTS4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64}; // NOLINT
+
+class BC7Bits {
+private:
+  uint64_t Low;
+  uint64_t High;
+
+public:
+  explicit BC7Bits(const uint8_t *Block)
+      : Low(loadLittleEndian(Block, 8)), High(loadLittleEndian(Block + 8, 8)) {} // NOLINT
+
+  [[nodiscard]] auto get(const size_t &Start, const size_t &Count) const -> uint32_t {
+    uint64_t Value = 0;
+    if (Start >= 64) {
+      Value = High >> (Start - 64);
+    } else if (Start + Count <= 64) {
+      Value = Low >> Start;
+    } else {
+      Value = (Low >> Start) | (High << (64 - Start));
+    }
+
+    return static_cast<uint32_t>(Value & ((1ULL << Count) - 1));
+  }
+};
+
+// Endpoint of N bits replicated to 8
+auto expandBC7Endpoint(const uint32_t &Value, const size_t &Bits) -> uint32_t {
+  return (Value << (8 - Bits)) | (Value >> ((2 * Bits) - 8));
+}
+
+// Index values whose interpolation between two endpoints is 255
+auto getBC7OpaqueIndices(const uint32_t &Endpoint0, const uint32_t &Endpoint1, const size_t &IndexBits) -> uint16_t {
+  const uint8_t *Weights = IndexBits == 2 ? BC7_WEIGHTS2 : (IndexBits == 3 ? BC7_WEIGHTS3 : BC7_WEIGHTS4);
+
+  uint16_t Opaque = 0;
+  for (size_t Index = 0; Index < (1U << IndexBits); Index++) {
+    const uint32_t Weight = Weights[Index]; // NOLINT
+    if ((((64 - Weight) * Endpoint0) + (Weight * Endpoint1) + 32) >> 6 == MAX_CHANNEL_VALUE) {
+      Opaque |= static_cast<uint16_t>(1U << Index);
+    }
+  }
+
+  return Opaque;
+}
+
+// Texels of a BC7 block whose alpha decodes to 255. Only the channel that ends up in alpha is decoded. Partition is the
+// subset 1 mask for two subset blocks, 0 otherwise
+auto getBC7OpaqueTexels(const BC7Bits &Bits, size_t IndexStart, const size_t &IndexBits,
+                        const uint16_t (&OpaqueIndices)[2], const uint16_t &Partition, // NOLINT
+                        const size_t &Anchor1) -> uint16_t {
+  uint16_t Opaque = 0;
+  for (size_t Texel = 0; Texel < BLOCK_SIZE * BLOCK_SIZE; Texel++) {
+    const size_t Subset = (Partition >> Texel) & 1U;
+    // anchors store their index with the top bit left out
+    const bool IsAnchor = Texel == 0 || (Subset == 1 && Texel == Anchor1);
+    const size_t NumBits = IsAnchor ? IndexBits - 1 : IndexBits;
+    const uint32_t Index = Bits.get(IndexStart, NumBits);
+    IndexStart += NumBits;
+
+    if (((OpaqueIndices[Subset] >> Index) & 1U) != 0) { // NOLINT
+      Opaque |= static_cast<uint16_t>(1U << Texel);
+    }
+  }
+
+  return Opaque;
+}
+
+auto getBC7OpaqueTexels(const uint8_t *Block) -> uint16_t {
+  if (Block[0] == 0) {
+    // reserved mode, decodes to transparent black
+    return 0;
+  }
+
+  const auto Mode = static_cast<size_t>(countr_zero(Block[0]));
+  if (Mode < 4) {
+    // modes without alpha
+    return ALL_TEXELS;
+  }
+
+  const BC7Bits Bits(Block);
+  uint16_t OpaqueIndices[2] = {0, 0}; // NOLINT
+
+  switch (Mode) {
+  case 4: {
+    // One subset, 5 bit color, 6 bit alpha. The index selection bit swaps which of the 2 and 3 bit index sets alpha
+    // uses, a rotation swaps alpha with a color channel which then ends up in alpha
+    const uint32_t Rotation = Bits.get(5, 2);
+    const bool AlphaUsesThreeBit = Bits.get(7, 1) == 0;
+    const bool ThreeBit = Rotation == 0 ? AlphaUsesThreeBit : !AlphaUsesThreeBit;
+
+    uint32_t Endpoint0 = 0;
+    uint32_t Endpoint1 = 0;
+    if (Rotation == 0) {
+      Endpoint0 = expandBC7Endpoint(Bits.get(38, 6), 6);
+      Endpoint1 = expandBC7Endpoint(Bits.get(44, 6), 6);
+    } else {
+      const size_t ChannelStart = 8 + ((Rotation - 1) * 10);
+      Endpoint0 = expandBC7Endpoint(Bits.get(ChannelStart, 5), 5);
+      Endpoint1 = expandBC7Endpoint(Bits.get(ChannelStart + 5, 5), 5);
+    }
+
+    const size_t IndexBits = ThreeBit ? 3 : 2;
+    OpaqueIndices[0] = getBC7OpaqueIndices(Endpoint0, Endpoint1, IndexBits);
+    return OpaqueIndices[0] == 0 ? 0 : getBC7OpaqueTexels(Bits, ThreeBit ? 81 : 50, IndexBits, OpaqueIndices, 0, 0);
+  }
+  case 5: {
+    // One subset, 7 bit color, 8 bit alpha, separate 2 bit index sets
+    const uint32_t Rotation = Bits.get(6, 2);
+
+    uint32_t Endpoint0 = 0;
+    uint32_t Endpoint1 = 0;
+    if (Rotation == 0) {
+      Endpoint0 = Bits.get(50, 8);
+      Endpoint1 = Bits.get(58, 8);
+    } else {
+      const size_t ChannelStart = 8 + ((Rotation - 1) * 14);
+      Endpoint0 = expandBC7Endpoint(Bits.get(ChannelStart, 7), 7);
+      Endpoint1 = expandBC7Endpoint(Bits.get(ChannelStart + 7, 7), 7);
+    }
+
+    OpaqueIndices[0] = getBC7OpaqueIndices(Endpoint0, Endpoint1, 2);
+    return OpaqueIndices[0] == 0 ? 0 : getBC7OpaqueTexels(Bits, Rotation == 0 ? 97 : 66, 2, OpaqueIndices, 0, 0);
+  }
+  case 6: {
+    // One subset, 7 bit RGBA plus a p-bit per endpoint, 4 bit indices
+    const uint32_t Endpoint0 = (Bits.get(49, 7) << 1) | Bits.get(63, 1);
+    const uint32_t Endpoint1 = (Bits.get(56, 7) << 1) | Bits.get(64, 1);
+
+    OpaqueIndices[0] = getBC7OpaqueIndices(Endpoint0, Endpoint1, 4);
+    return OpaqueIndices[0] == 0 ? 0 : getBC7OpaqueTexels(Bits, 65, 4, OpaqueIndices, 0, 0);
+  }
+  default: {
+    // Mode 7: two subsets, 5 bit RGBA plus a p-bit per endpoint, 2 bit indices
+    const uint32_t Partition = Bits.get(8, 6);
+    for (size_t Subset = 0; Subset < 2; Subset++) {
+      const size_t Endpoint = Subset * 2;
+      const uint32_t Endpoint0 = (Bits.get(74 + (Endpoint * 5), 5) << 1) | Bits.get(94 + Endpoint, 1);
+      const uint32_t Endpoint1 = (Bits.get(74 + ((Endpoint + 1) * 5), 5) << 1) | Bits.get(94 + Endpoint + 1, 1);
+      OpaqueIndices[Subset] = getBC7OpaqueIndices(expandBC7Endpoint(Endpoint0, 6), expandBC7Endpoint(Endpoint1, 6), 2); // NOLINT
+    }
+
+    if (OpaqueIndices[0] == 0 && OpaqueIndices[1] == 0) {
+      return 0;
+    }
+
+    return getBC7OpaqueTexels(Bits, 98, 2, OpaqueIndices, BC7_PARTITIONS[Partition], BC7_ANCHORS[Partition]); // NOLINT
+  }
+  }
+}
+
+auto countBCBlockRow(const uint8_t *Row, const size_t &Width, const size_t &ValidRows,
+                     const ParallaxGenCPUCompute::BlockFormat &Format) -> size_t {
+  const size_t NumBlocks = (Width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const uint16_t FullBlock = getValidTexels(BLOCK_SIZE, ValidRows);
+  const uint16_t LastBlock = getValidTexels(Width - ((NumBlocks - 1) * BLOCK_SIZE), ValidRows);
+
+  // per field masks for the formats with fixed size alpha fields
+  const size_t FieldBits = Format == ParallaxGenCPUCompute::BlockFormat::BC2 ? 4 : 3;
+  const uint64_t FullFields = spreadTexels(FullBlock, FieldBits);
+  const uint64_t LastFields = spreadTexels(LastBlock, FieldBits);
+
+  size_t Count = 0;
+  for (size_t BlockIndex = 0; BlockIndex < NumBlocks; BlockIndex++) {
+    const uint8_t *Block = Row + (BlockIndex * BLOCK_BYTES); // NOLINT
+    const bool IsLast = BlockIndex + 1 == NumBlocks;
+
+    switch (Format) {
+    case ParallaxGenCPUCompute::BlockFormat::BC2:
+      Count += countBC2Block(Block, IsLast ? LastFields : FullFields);
+      break;
+    case ParallaxGenCPUCompute::BlockFormat::BC3:
+      Count += countBC3Block(Block, IsLast ? LastFields : FullFields);
+      break;
+    case ParallaxGenCPUCompute::BlockFormat::BC7:
+      Count += popcount(static_cast<uint16_t>(getBC7OpaqueTexels(Block) & (IsLast ? LastBlock : FullBlock)));
+      break;
+    }
+  }
+
+  return Count;
+}
+} // namespace
+
+auto ParallaxGenCPUCompute::mergeToComplexMaterial(const RGBAImage *EnvMap, const RGBAImage *ParallaxMap,
+                                                   const size_t &Width, const size_t &Height, uint8_t *Output,
+                                                   const size_t &OutputRowPitch) -> MinMaxValues {
+  const auto IsOutputSized = [&](const RGBAImage *Map) {
+    return Map == nullptr || (Map->Width == Width && Map->Height == Height);
+  };
+  const bool Unscaled = IsOutputSized(EnvMap) && IsOutputSized(ParallaxMap);
+
+  vector<size_t> EnvColumns;
+  vector<size_t> EnvRows;
+  if (EnvMap != nullptr && !Unscaled) {
+    EnvColumns = getSourceIndices(EnvMap->Width, Width);
+    EnvRows = getSourceIndices(EnvMap->Height, Height);
+  }
+
+  vector<size_t> ParallaxColumns;
+  vector<size_t> ParallaxRows;
+  if (ParallaxMap != nullptr && !Unscaled) {
+    ParallaxColumns = getSourceIndices(ParallaxMap->Width, Width);
+    ParallaxRows = getSourceIndices(ParallaxMap->Height, Height);
+  }
+
+  const size_t NumTasks = (Height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+  vector<MinMaxValues> TaskRanges(NumTasks);
+
+  ParallaxGenScheduler::get().parallelFor(
+      0, NumTasks,
+      [&](const size_t &Task) {
+        const size_t EndRow = min(Height, (Task + 1) * ROWS_PER_TASK);
+        for (size_t Y = Task * ROWS_PER_TASK; Y < EndRow; Y++) {
+          uint8_t *OutRow = Output + (Y * OutputRowPitch); // NOLINT
+
+          if (Unscaled) {
+            const uint8_t *EnvRow = EnvMap != nullptr ? EnvMap->Pixels + (Y * EnvMap->RowPitch) : nullptr; // NOLINT
+            const uint8_t *ParallaxRow =
+                ParallaxMap != nullptr ? ParallaxMap->Pixels + (Y * ParallaxMap->RowPitch) : nullptr; // NOLINT
+            mergeRowUnscaled(EnvRow, ParallaxRow, Width, OutRow, TaskRanges[Task]);
+            continue;
+          }
+
+          const uint8_t *EnvRow =
+              EnvMap != nullptr ? EnvMap->Pixels + (EnvRows[Y] * EnvMap->RowPitch) : nullptr; // NOLINT
+          const uint8_t *ParallaxRow =
+              ParallaxMap != nullptr ? ParallaxMap->Pixels + (ParallaxRows[Y] * ParallaxMap->RowPitch) // NOLINT
+                                     : nullptr;
+          mergeRowScaled(EnvRow, EnvColumns, ParallaxRow, ParallaxColumns, Width, OutRow, TaskRanges[Task]);
+        }
+      },
+      1);
+
+  MinMaxValues Range;
+  for (const auto &TaskRange : TaskRanges) {
+    mergeRange(Range, TaskRange);
+  }
+
+  return Range;
+}
+
+auto ParallaxGenCPUCompute::countAlphaValues(const RGBAImage &Image) -> size_t {
+  return countAlphaValuesRGBA(Image, nullopt);
+}
+
+auto ParallaxGenCPUCompute::countAlphaValuesExceeds(const RGBAImage &Image, const size_t &Threshold) -> bool {
+  return countAlphaValuesRGBA(Image, Threshold) > Threshold;
+}
+
+auto ParallaxGenCPUCompute::countAlphaValuesBC(const uint8_t *Blocks, const size_t &Width, const size_t &Height,
+                                               const size_t &RowPitch, const BlockFormat &Format) -> size_t {
+  return countAlphaValuesBlocks(Blocks, Width, Height, RowPitch, Format, nullopt);
+}
+
+auto ParallaxGenCPUCompute::countAlphaValuesBCExceeds(const uint8_t *Blocks, const size_t &Width, const size_t &Height,
+                                                      const size_t &RowPitch, const BlockFormat &Format,
+                                                      const size_t &Threshold) -> bool {
+  return countAlphaValuesBlocks(Blocks, Width, Height, RowPitch, Format, Threshold) > Threshold;
+}
+
+auto ParallaxGenCPUCompute::showsOpaqueFraction(const size_t &OpaqueCount, const size_t &NumPixels,
+                                                const double &Fraction, const double &Margin) -> bool {
+  if (NumPixels == 0) {
+    return false;
+  }
+
+  return static_cast<double>(OpaqueCount) / static_cast<double>(NumPixels) > Fraction + Margin;
+}
+
+template <typename CountTaskFunc>
+auto ParallaxGenCPUCompute::sumTaskCounts(const size_t &NumTasks, const size_t &NumPixels,
+                                          const optional<size_t> &Threshold, CountTaskFunc CountTask) -> size_t {
+  atomic<size_t> Counted = 0;
+  atomic<size_t> Remaining = NumPixels;
+  atomic<bool> Decided = false;
+
+  ParallaxGenScheduler::get().parallelFor(
+      0, NumTasks,
+      [&](const size_t &Task) {
+        if (Decided) {
+          return;
+        }
+
+        const auto [Count, Pixels] = CountTask(Task);
+        Counted += Count;
+        if (!Threshold.has_value()) {
+          return;
+        }
+
+        // Counts are added before pixels are taken off, reading them in the opposite order can only overestimate
+        const size_t Left = Remaining -= Pixels;
+        const size_t Sum = Counted;
+        if (Sum > *Threshold || Sum + Left <= *Threshold) {
+          Decided = true;
+        }
+      },
+      1);
+
+  return Counted;
+}
+
+auto ParallaxGenCPUCompute::countAlphaValuesRGBA(const RGBAImage &Image, const optional<size_t> &Threshold) -> size_t {
+  const size_t NumTasks = (Image.Height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+
+  return sumTaskCounts(NumTasks, Image.Width * Image.Height, Threshold, [&Image](const size_t &Task) {
+    const size_t EndRow = min(Image.Height, (Task + 1) * ROWS_PER_TASK);
+    size_t Count = 0;
+    for (size_t Y = Task * ROWS_PER_TASK; Y < EndRow; Y++) {
+      Count += countAlphaValuesRow(Image.Pixels + (Y * Image.RowPitch), Image.Width); // NOLINT
+    }
+
+    return pair<size_t, size_t>{Count, (EndRow - (Task * ROWS_PER_TASK)) * Image.Width};
+  });
+}
+
+auto ParallaxGenCPUCompute::countAlphaValuesBlocks(const uint8_t *Blocks, const size_t &Width, const size_t &Height,
+                                                   const size_t &RowPitch, const BlockFormat &Format,
+                                                   const optional<size_t> &Threshold) -> size_t {
+  if (Width == 0 || Height == 0) {
+    return 0;
+  }
+
+  const size_t NumBlockRows = (Height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const size_t NumTasks = (NumBlockRows + BLOCK_ROWS_PER_TASK - 1) / BLOCK_ROWS_PER_TASK;
+
+  return sumTaskCounts(NumTasks, Width * Height, Threshold, [&](const size_t &Task) {
+    const size_t EndRow = min(NumBlockRows, (Task + 1) * BLOCK_ROWS_PER_TASK);
+    size_t Count = 0;
+    size_t Pixels = 0;
+    for (size_t BlockRow = Task * BLOCK_ROWS_PER_TASK; BlockRow < EndRow; BlockRow++) {
+      const size_t ValidRows = min(BLOCK_SIZE, Height - (BlockRow * BLOCK_SIZE));
+      Count += countBCBlockRow(Blocks + (BlockRow * RowPitch), Width, ValidRows, Format); // NOLINT
+      Pixels += ValidRows * Width;
+    }
+
+    return pair<size_t, size_t>{Count, Pixels};
+  });
+}
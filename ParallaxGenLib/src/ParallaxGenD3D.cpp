@@ -1,8 +1,13 @@
 #include "ParallaxGenD3D.hpp"
 
+#include "DDSUtil.hpp"
 #include "NIFUtil.hpp"
+#include "ParallaxGenCPUCompute.hpp"
 #include "ParallaxGenDirectory.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
+#include "ParallaxGenScheduler.hpp"
 #include "ParallaxGenTask.hpp"
+#include "ParallaxGenTextureDB.hpp"
 #include "ParallaxGenUtil.hpp"
 
 
@@ -29,9 +34,15 @@
 #include <dxcapi.h>
 
 #include <algorithm>
+#include <cmath>
 #include <filesystem>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
 
 #include <climits>
 #include <cstdlib>
@@ -41,40 +52,150 @@ using namespace std;
 using namespace ParallaxGenUtil;
 using Microsoft::WRL::ComPtr;
 
+// The loaded texture plus its RGBA copy, at most its own size. Compressed textures are read in place
+constexpr size_t CM_CHECK_MEMORY_FACTOR = 2;
+
+// Env masks with more than this fraction of opaque pixels are not complex material
+constexpr double CM_OPAQUE_FRACTION = 0.5;
+// Smallest mip used to estimate that fraction, and how far over the threshold an estimate has to be to be trusted
+constexpr size_t CM_ESTIMATE_MIN_PIXELS = 64 * 64;
+constexpr double CM_ESTIMATE_MARGIN = 0.15;
+
 ParallaxGenD3D::ParallaxGenD3D(ParallaxGenDirectory *PGD, filesystem::path OutputDir, filesystem::path ExePath,
                                const bool &UseGPU)
     : PGD(PGD), OutputDir(std::move(OutputDir)), ExePath(std::move(ExePath)), UseGPU(UseGPU) {}
 
+void ParallaxGenD3D::enableCMValidation() { ValidateCM = true; }
+
+void ParallaxGenD3D::loadTextureDB(const filesystem::path &DBPath) {
+  TextureDB = make_unique<ParallaxGenTextureDB>(DBPath);
+  const auto Loaded = TextureDB->load();
+
+  // Records are only used while their texture is read from the same place and unchanged, checked in parallel since
+  // loose files need a stat each
+  vector<char> IsCurrent(Loaded.size(), 0); // not vector<bool>, tasks write neighbouring entries
+  ParallaxGenScheduler::get().parallelFor(0, Loaded.size(), [this, &Loaded, &IsCurrent](const size_t &I) {
+    const auto Source = getTextureSource(Loaded[I].first);
+    IsCurrent[I] = Source.has_value() && *Source == Loaded[I].second.TextureSource ? 1 : 0;
+  });
+
+  size_t NumCurrent = 0;
+  for (size_t I = 0; I < Loaded.size(); I++) {
+    if (IsCurrent[I] == 0) {
+      continue;
+    }
+
+    const auto &[Path, Record] = Loaded[I];
+    if (Record.Metadata.has_value()) {
+      DDSMetaDataCache.insertOrAssign(Path, {ParallaxGenTask::PGResult::SUCCESS, toTexMetadata(*Record.Metadata)});
+    }
+    TextureDB->restore(Path, Record);
+    NumCurrent++;
+  }
+
+  spdlog::info("Loaded {} texture records from the texture database, {} were out of date", NumCurrent,
+               Loaded.size() - NumCurrent);
+}
+
+void ParallaxGenD3D::saveTextureDB() {
+  if (TextureDB) {
+    TextureDB->save();
+  }
+}
+
+auto ParallaxGenD3D::getTextureSource(const filesystem::path &DDSPath) -> optional<ParallaxGenTextureDB::Source> {
+  ParallaxGenTextureDB::Source Source;
+  error_code EC;
+  if (PGD->isBSAFile(DDSPath)) {
+    // Every texture of an archive shares its time, each archive is only checked once
+    const filesystem::path ArchivePath = PGD->getFileSource(DDSPath);
+    Source.Archive = ArchivePath.filename().wstring();
+    Source.ModifiedTime = ArchiveModifiedTimes.getOrCompute(ArchivePath, [&ArchivePath]() -> int64_t {
+      error_code TimeEC;
+      const auto Time = filesystem::last_write_time(ArchivePath, TimeEC);
+      return TimeEC ? 0 : static_cast<int64_t>(Time.time_since_epoch().count());
+    });
+    if (Source.ModifiedTime == 0) {
+      return nullopt;
+    }
+  } else if (PGD->isLooseFile(DDSPath)) {
+    const auto Time = filesystem::last_write_time(PGD->getFullPath(DDSPath), EC);
+    if (EC) {
+      return nullopt;
+    }
+    Source.ModifiedTime = static_cast<int64_t>(Time.time_since_epoch().count());
+  } else {
+    // generated this run
+    return nullopt;
+  }
+
+  Source.Size = PGD->getFileSize(DDSPath);
+  return Source;
+}
+
 auto ParallaxGenD3D::findCMMaps(const std::unordered_set<std::wstring> &BSAExcludes) -> ParallaxGenTask::PGResult {
   auto &EnvMasks = PGD->getTextureMap(NIFUtil::TextureSlots::ENVMASK);
 
   ParallaxGenTask::PGResult PGResult = ParallaxGenTask::PGResult::SUCCESS;
 
-  // loop through maps
-  for (auto &EnvSlot : EnvMasks) {
-    vector<NIFUtil::PGTexture> CMMaps;
-
+  // Gather env masks to check, the same texture can be listed under more than one base
+  vector<filesystem::path> Candidates;
+  unordered_set<filesystem::path> SeenEnvMasks;
+  for (const auto &EnvSlot : EnvMasks) {
     for (const auto &EnvMask : EnvSlot.second) {
-      if (EnvMask.Type != NIFUtil::TextureType::ENVIRONMENTMASK) {
+      if (EnvMask.Type != NIFUtil::TextureType::ENVIRONMENTMASK || !SeenEnvMasks.insert(EnvMask.Path).second) {
         continue;
       }
 
-      bool BFileInVanillaBSA = PGD->isFileInBSA(EnvMask.Path, BSAExcludes);
-
-      bool Result = false;
-      if (!BFileInVanillaBSA) {
-        ParallaxGenTask::updatePGResult(PGResult, checkIfCM(EnvMask.Path, Result),
-                                        ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
-      } else {
+      if (PGD->isFileInBSA(EnvMask.Path, BSAExcludes)) {
         spdlog::trace(L"Envmask {} is contained in excluded BSA - skipping complex material check",
                       EnvMask.Path.wstring());
+        continue;
       }
 
-      if (Result) {
-        // TODO we need to fill in alpha for non-CM stuff
-        // remove old env mask
+      Candidates.push_back(EnvMask.Path);
+    }
+  }
+
+  // One env mask per task. GPU dispatches go through the context mutex one at a time, loading and CPU counting run
+  // in parallel. Results are kept per candidate so the texture map isn't changed while tasks run
+  ParallaxGenTask TaskTracker("Finding Complex Material Maps", Candidates.size());
+  vector<ParallaxGenTask::PGResult> Results(Candidates.size(), ParallaxGenTask::PGResult::SUCCESS);
+  vector<char> IsCM(Candidates.size(), 0); // not vector<bool>, tasks write neighbouring entries
+  ParallaxGenScheduler::get().parallelFor(
+      0, Candidates.size(),
+      [this, &Candidates, &Results, &IsCM, &TaskTracker](const size_t &I) {
+        bool Result = false;
+        try {
+          Results[I] = checkIfCM(Candidates[I], Result);
+        } catch (const exception &E) {
+          spdlog::error(L"Exception in thread checking env mask {}: {}", Candidates[I].wstring(),
+                        strToWstr(E.what()));
+          Results[I] = ParallaxGenTask::PGResult::FAILURE;
+          Result = false;
+        }
+
+        IsCM[I] = Result ? 1 : 0;
+        TaskTracker.completeJob(Results[I]);
+      },
+      1);
+
+  unordered_set<filesystem::path> CMPaths;
+  for (size_t I = 0; I < Candidates.size(); I++) {
+    ParallaxGenTask::updatePGResult(PGResult, Results[I], ParallaxGenTask::PGResult::SUCCESS_WITH_WARNINGS);
+    if (IsCM[I] != 0) {
+      // TODO we need to fill in alpha for non-CM stuff
+      CMPaths.insert(Candidates[I]);
+      spdlog::trace(L"Found complex material env mask: {}", Candidates[I].wstring());
+    }
+  }
+
+  // Retype every found map in one pass
+  for (auto &EnvSlot : EnvMasks) {
+    vector<NIFUtil::PGTexture> CMMaps;
+    for (const auto &EnvMask : EnvSlot.second) {
+      if (EnvMask.Type == NIFUtil::TextureType::ENVIRONMENTMASK && CMPaths.contains(EnvMask.Path)) {
         CMMaps.push_back(EnvMask);
-        spdlog::trace(L"Found complex material env mask: {}", EnvMask.Path.wstring());
       }
     }
 
@@ -85,10 +206,26 @@ auto ParallaxGenD3D::findCMMaps(const std::unordered_set<std::wstring> &BSAExclu
     }
   }
 
-  return ParallaxGenTask::PGResult::SUCCESS;
+  spdlog::debug("Complex material detection decided {} env masks from lower mips, {} from the texture database",
+                CMDecidedFromMips.load(), CMFromTextureDB.load());
+  if (ValidateCM) {
+    spdlog::info("Complex material detection validation: {} env masks checked, {} disagree with a full count",
+                 CMValidationChecked.load(), CMValidationMismatches.load());
+  }
+
+  return PGResult;
 }
 
 auto ParallaxGenD3D::checkIfCM(const filesystem::path &DDSPath, bool &Result) -> ParallaxGenTask::PGResult {
+  // Verdict of a previous run on the same file, not used when validating
+  if (TextureDB && !ValidateCM) {
+    if (const auto Record = TextureDB->find(DDSPath); Record && Record->IsComplexMaterial.has_value()) {
+      CMFromTextureDB++;
+      Result = *Record->IsComplexMaterial;
+      return ParallaxGenTask::PGResult::SUCCESS;
+    }
+  }
+
   // get metadata (should only pull headers, which is much faster)
   DirectX::TexMetadata DDSImageMeta{};
   auto PGResult = getDDSMetadata(DDSPath, DDSImageMeta);
@@ -102,7 +239,6 @@ auto ParallaxGenD3D::checkIfCM(const filesystem::path &DDSPath, bool &Result) ->
     return ParallaxGenTask::PGResult::SUCCESS;
   }
 
-  bool BCCompressed = false;
   // Only check DDS with alpha channels
   switch (DDSImageMeta.format) {
   case DXGI_FORMAT_BC2_UNORM:
@@ -114,8 +250,6 @@ auto ParallaxGenD3D::checkIfCM(const filesystem::path &DDSPath, bool &Result) ->
   case DXGI_FORMAT_BC7_UNORM:
   case DXGI_FORMAT_BC7_UNORM_SRGB:
   case DXGI_FORMAT_BC7_TYPELESS:
-    BCCompressed = true;
-    [[fallthrough]];
   case DXGI_FORMAT_R32G32B32A32_TYPELESS:
   case DXGI_FORMAT_R32G32B32A32_FLOAT:
   case DXGI_FORMAT_R32G32B32A32_UINT:
@@ -142,6 +276,8 @@ auto ParallaxGenD3D::checkIfCM(const filesystem::path &DDSPath, bool &Result) ->
   }
 
   // Read image
+  const size_t MemoryFactor = DirectX::IsCompressed(DDSImageMeta.format) ? 1 : CM_CHECK_MEMORY_FACTOR;
+  const auto Memory = ParallaxGenMemoryGovernor::get().admit(PGD->getFileSize(DDSPath) * MemoryFactor);
   DirectX::ScratchImage Image;
   PGResult = getDDS(DDSPath, Image);
   if (PGResult != ParallaxGenTask::PGResult::SUCCESS) {
@@ -149,22 +285,107 @@ auto ParallaxGenD3D::checkIfCM(const filesystem::path &DDSPath, bool &Result) ->
     return PGResult;
   }
 
+  bool MostlyOpaque = false;
+  bool Estimated = false;
+  PGResult = isMostlyOpaque(Image, MostlyOpaque, Estimated);
+  if (PGResult != ParallaxGenTask::PGResult::SUCCESS) {
+    spdlog::error(L"Failed to count alpha values of DDS file (Skipping): {}", DDSPath.wstring());
+    Result = false;
+    return PGResult;
+  }
+
+  // Verdict from counting the top mip, if there is one
+  optional<bool> ExactResult;
+  if (!Estimated) {
+    ExactResult = !MostlyOpaque;
+  }
+
+  if (ValidateCM) {
+    // Compare against the exact count of the top mip
+    const int AlphaValues = UseGPU && !DirectX::IsCompressed(DDSImageMeta.format) ? countAlphaValuesGPU(Image)
+                                                                                   : countAlphaValuesCPU(Image);
+    const size_t NumPixels = DDSImageMeta.width * DDSImageMeta.height;
+    CMValidationChecked++;
+    if (AlphaValues >= 0) {
+      const bool ExactOpaque = static_cast<size_t>(AlphaValues) > NumPixels / 2;
+      ExactResult = !ExactOpaque;
+      if (ExactOpaque != MostlyOpaque) {
+        CMValidationMismatches++;
+        spdlog::warn(
+            L"Complex material detection disagrees with a full count for {}: detected {}, {} of {} pixels opaque",
+            DDSPath.wstring(), MostlyOpaque ? L"not complex material" : L"complex material", AlphaValues, NumPixels);
+      }
+    }
+  }
+
+  Result = !MostlyOpaque;
+
+  // Lower mip estimates are only good for this run, later runs get an exact verdict or none
+  if (TextureDB && ExactResult.has_value()) {
+    if (const auto Source = getTextureSource(DDSPath)) {
+      TextureDB->setComplexMaterial(DDSPath, *Source, *ExactResult);
+    }
+  }
+
+  return ParallaxGenTask::PGResult::SUCCESS;
+}
+
+auto ParallaxGenD3D::isMostlyOpaque(const DirectX::ScratchImage &Image, bool &MostlyOpaque,
+                                    bool &Estimated) -> ParallaxGenTask::PGResult {
+  const DirectX::TexMetadata &Meta = Image.GetMetadata();
+  const size_t Threshold = (Meta.width * Meta.height) / 2;
+
+  // Start at the smallest mip that still has enough pixels for an estimate
+  size_t Mip = 0;
+  while (Mip + 1 < Meta.mipLevels) {
+    const DirectX::Image *Next = Image.GetImage(Mip + 1, 0, 0);
+    if (Next == nullptr || Next->width * Next->height < CM_ESTIMATE_MIN_PIXELS) {
+      break;
+    }
+    Mip++;
+  }
+
+  // Lower mips are a heuristic. Scattered opaque pixels average away, so a low count says nothing and goes straight
+  // to the exact count. A high count usually means the top mip is opaque too, but filter rounding ({255, 255, 254,
+  // 254} averages to 255) and authored mips can raise alpha, hence the margin. Go up a mip while the estimate is over
+  // the threshold but inside the margin
+  for (; Mip > 0; Mip--) {
+    const DirectX::Image *MipImage = Image.GetImage(Mip, 0, 0);
+    const int AlphaValues = countAlphaValuesCPU(Image, Mip);
+    if (MipImage == nullptr || AlphaValues < 0) {
+      break;
+    }
+
+    const auto OpaqueCount = static_cast<size_t>(AlphaValues);
+    const size_t NumPixels = MipImage->width * MipImage->height;
+    if (ParallaxGenCPUCompute::showsOpaqueFraction(OpaqueCount, NumPixels, CM_OPAQUE_FRACTION, CM_ESTIMATE_MARGIN)) {
+      CMDecidedFromMips++;
+      MostlyOpaque = true;
+      Estimated = true;
+      return ParallaxGenTask::PGResult::SUCCESS;
+    }
+
+    if (!ParallaxGenCPUCompute::showsOpaqueFraction(OpaqueCount, NumPixels, CM_OPAQUE_FRACTION, 0)) {
+      break;
+    }
+  }
+
+  // Exact answer from the top mip
   int AlphaValues = -1;
-  if (UseGPU) {
-    // GPU
+  if (UseGPU && !DirectX::IsCompressed(Meta.format)) {
+    // GPU, compressed alpha is read straight from the blocks which is cheaper than uploading the texture
     AlphaValues = countAlphaValuesGPU(Image);
   } else {
-    // CPU
-    AlphaValues = countAlphaValuesCPU(Image, BCCompressed);
+    // CPU, stops once the rows counted decide it
+    AlphaValues = countAlphaValuesCPU(Image, 0, Threshold);
   }
 
-  const size_t NumPixels = DDSImageMeta.width * DDSImageMeta.height;
-  if (AlphaValues > NumPixels / 2) {
-    Result = false;
-    return ParallaxGenTask::PGResult::SUCCESS;
+  if (AlphaValues < 0) {
+    return ParallaxGenTask::PGResult::FAILURE;
   }
 
-  Result = true;
+  MostlyOpaque = static_cast<size_t>(AlphaValues) > Threshold;
+  Estimated = false;
   return ParallaxGenTask::PGResult::SUCCESS;
 }
 
@@ -209,6 +430,7 @@ auto ParallaxGenD3D::countAlphaValuesGPU(const DirectX::ScratchImage &Image) ->
   }
 
   // Dispatch shader
+  const lock_guard<mutex> GPULock(GPUContextMutex);
   PtrContext->CSSetShader(ShaderCountAlphaValues.Get(), nullptr, 0);
   PtrContext->CSSetShaderResources(0, 1, InputSRV.GetAddressOf());
   PtrContext->CSSetUnorderedAccessViews(0, 1, OutputBufferUAV.GetAddressOf(), nullptr);
@@ -243,47 +465,57 @@ auto ParallaxGenD3D::countAlphaValuesGPU(const DirectX::ScratchImage &Image) ->
   return static_cast<int>(Data[0]);
 }
 
-auto ParallaxGenD3D::countAlphaValuesCPU(const DirectX::ScratchImage &Image, const bool &BCCompressed) -> int {
-  // Decompress image if needed
-  HRESULT HR{};
-  DirectX::ScratchImage InImage;
-  if (BCCompressed) {
-    HR = DirectX::Decompress(Image.GetImages(), Image.GetImageCount(), Image.GetMetadata(), DXGI_FORMAT_R8G8B8A8_UNORM,
-                             InImage);
-    if (FAILED(HR)) {
-      spdlog::error("Failed to decompress DDS file (Skipping): {}", getHRESULTErrorMessage(HR));
-      return -1;
+auto ParallaxGenD3D::countAlphaValuesCPU(const DirectX::ScratchImage &Image, const size_t &Mip,
+                                         const optional<size_t> &Threshold) -> int {
+  const DirectX::Image *MipImage = Image.GetImage(Mip, 0, 0);
+  if (MipImage == nullptr) {
+    return -1;
+  }
+
+  // Alpha of BC2/BC3/BC7 is decoded per block without decompressing the image
+  const auto CountBlocks = [&](const ParallaxGenCPUCompute::BlockFormat &Format) -> int {
+    if (Threshold.has_value()) {
+      return static_cast<int>(ParallaxGenCPUCompute::countAlphaValuesBCExceeds(MipImage->pixels, MipImage->width,
+                                                                               MipImage->height, MipImage->rowPitch,
+                                                                               Format, *Threshold)
+                                  ? *Threshold + 1
+                                  : *Threshold);
     }
-  } else {
-    InImage.Initialize2D(Image.GetMetadata().format, Image.GetMetadata().width, Image.GetMetadata().height, 1, 1);
-    memcpy(InImage.GetPixels(), Image.GetPixels(), Image.GetPixelsSize());
+
+    return static_cast<int>(ParallaxGenCPUCompute::countAlphaValuesBC(MipImage->pixels, MipImage->width,
+                                                                      MipImage->height, MipImage->rowPitch, Format));
+  };
+
+  switch (MipImage->format) {
+  case DXGI_FORMAT_BC2_UNORM:
+  case DXGI_FORMAT_BC2_UNORM_SRGB:
+  case DXGI_FORMAT_BC2_TYPELESS:
+    return CountBlocks(ParallaxGenCPUCompute::BlockFormat::BC2);
+  case DXGI_FORMAT_BC3_UNORM:
+  case DXGI_FORMAT_BC3_UNORM_SRGB:
+  case DXGI_FORMAT_BC3_TYPELESS:
+    return CountBlocks(ParallaxGenCPUCompute::BlockFormat::BC3);
+  case DXGI_FORMAT_BC7_UNORM:
+  case DXGI_FORMAT_BC7_UNORM_SRGB:
+  case DXGI_FORMAT_BC7_TYPELESS:
+    return CountBlocks(ParallaxGenCPUCompute::BlockFormat::BC7);
+  default:
+    break;
   }
 
-  // Find Row Pitch
-  size_t RowPitch = 0;
-  size_t SlicePitch = 0;
-  HR = DirectX::ComputePitch(DXGI_FORMAT_R8G8B8A8_UNORM, InImage.GetMetadata().width, InImage.GetMetadata().height,
-                             RowPitch, SlicePitch);
-  if (FAILED(HR)) {
-    spdlog::error("Failed to compute pitch for DDS file (Skipping): {}", getHRESULTErrorMessage(HR));
+  DirectX::ScratchImage RGBAImage;
+  if (getRGBAImage(Image, RGBAImage, Mip) != ParallaxGenTask::PGResult::SUCCESS) {
     return -1;
   }
 
-  // Calculate Median of Alpha Layer
-  int AlphaValues = 0;
-
-  const auto *Pixels = InImage.GetPixels();
-  for (size_t Y = 0; Y < InImage.GetMetadata().height; ++Y) {
-    for (size_t X = 0; X < InImage.GetMetadata().width; ++X) {
-      const size_t PixelIndex = (Y * RowPitch) + (X * 4); // Assuming 4 bytes per pixel (RGBA)
-      uint8_t Alpha = Pixels[PixelIndex + 3];             // NOLINT
-      if (Alpha == 255) {                                 // NOLINT
-        AlphaValues++;
-      }
-    }
+  const DirectX::Image *Pixels = RGBAImage.GetImage(0, 0, 0);
+  const ParallaxGenCPUCompute::RGBAImage View = {Pixels->pixels, Pixels->width, Pixels->height, Pixels->rowPitch};
+  if (Threshold.has_value()) {
+    return static_cast<int>(ParallaxGenCPUCompute::countAlphaValuesExceeds(View, *Threshold) ? *Threshold + 1
+                                                                                            : *Threshold);
   }
 
-  return AlphaValues;
+  return static_cast<int>(ParallaxGenCPUCompute::countAlphaValues(View));
 }
 
 auto ParallaxGenD3D::checkIfAspectRatioMatches(const std::filesystem::path &DDSPath1,
@@ -340,12 +572,12 @@ void ParallaxGenD3D::initGPU() {
                          &PtrContext               // Sets the instance device immediate context
   );
 
-  // check if device was found successfully
+  // check if device was found successfully, the CPU versions of the shaders are used otherwise
   if (FAILED(HR)) {
-    spdlog::error("D3D11 device creation failure error: {}", getHRESULTErrorMessage(HR));
-    spdlog::critical("Unable to find any DX11 capable devices. Disable any GPU-accelerated "
-                     "features to continue.");
-    exit(1);
+    spdlog::warn("D3D11 device creation failure error: {}", getHRESULTErrorMessage(HR));
+    spdlog::warn("Unable to find any DX11 capable devices, texture operations will run on the CPU (slower)");
+    UseGPU = false;
+    return;
   }
 
   // Init Shaders
@@ -478,6 +710,10 @@ auto ParallaxGenD3D::upgradeToComplexMaterial(const std::filesystem::path &Paral
     return {};
   }
 
+  if (!UseGPU) {
+    return compressComplexMaterial(mergeToComplexMaterialCPU(ParallaxMapDDS, EnvMapDDS));
+  }
+
   // Create GPU Textures objects
   ComPtr<ID3D11Texture2D> ParallaxMapGPU;
   ComPtr<ID3D11ShaderResourceView> ParallaxMapSRV;
@@ -595,7 +831,8 @@ auto ParallaxGenD3D::upgradeToComplexMaterial(const std::filesystem::path &Paral
     return {};
   }
 
-  // Dispatch shader
+  // Dispatch shader, loading and compressing around this run in parallel
+  unique_lock<mutex> GPULock(GPUContextMutex);
   PtrContext->CSSetShader(ShaderMergeToComplexMaterial.Get(), nullptr, 0);
   PtrContext->CSSetConstantBuffers(0, 1, ConstantBuffer.GetAddressOf());
   PtrContext->CSSetShaderResources(0, 1, EnvMapSRV.GetAddressOf());
@@ -664,16 +901,83 @@ auto ParallaxGenD3D::upgradeToComplexMaterial(const std::filesystem::path &Paral
 
   // Flush GPU to avoid leaks
   PtrContext->Flush();
+  GPULock.unlock();
 
   // Import into directx scratchimage
   DirectX::ScratchImage OutputImage =
       loadRawPixelsToScratchImage(OutputTextureData, ResultWidth, ResultHeight, ResultMips, DXGI_FORMAT_R8G8B8A8_UNORM);
 
+  return compressComplexMaterial(OutputImage);
+}
+
+auto ParallaxGenD3D::mergeToComplexMaterialCPU(const DirectX::ScratchImage &ParallaxMapDDS,
+                                               const DirectX::ScratchImage &EnvMapDDS) -> DirectX::ScratchImage {
+  // The shaders read the textures as floats, which is the same as reading them as R8G8B8A8
+  DirectX::ScratchImage ParallaxMapRGBA;
+  const bool ParallaxExists = ParallaxMapDDS.GetImageCount() > 0;
+  if (ParallaxExists && getRGBAImage(ParallaxMapDDS, ParallaxMapRGBA) != ParallaxGenTask::PGResult::SUCCESS) {
+    return {};
+  }
+
+  DirectX::ScratchImage EnvMapRGBA;
+  const bool EnvExists = EnvMapDDS.GetImageCount() > 0;
+  if (EnvExists && getRGBAImage(EnvMapDDS, EnvMapRGBA) != ParallaxGenTask::PGResult::SUCCESS) {
+    return {};
+  }
+
+  const auto GetView = [](const DirectX::ScratchImage &Image) -> ParallaxGenCPUCompute::RGBAImage {
+    const DirectX::Image *Pixels = Image.GetImage(0, 0, 0);
+    return {Pixels->pixels, Pixels->width, Pixels->height, Pixels->rowPitch};
+  };
+
+  ParallaxGenCPUCompute::RGBAImage ParallaxView{};
+  ParallaxGenCPUCompute::RGBAImage EnvView{};
+  size_t ResultWidth = 0;
+  size_t ResultHeight = 0;
+  if (ParallaxExists) {
+    ParallaxView = GetView(ParallaxMapRGBA);
+    ResultWidth = ParallaxView.Width;
+    ResultHeight = ParallaxView.Height;
+  }
+  if (EnvExists) {
+    EnvView = GetView(EnvMapRGBA);
+    ResultWidth = max(ResultWidth, EnvView.Width);
+    ResultHeight = max(ResultHeight, EnvView.Height);
+  }
+
+  DirectX::ScratchImage OutputImage;
+  HRESULT HR = OutputImage.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, ResultWidth, ResultHeight, 1, 1);
+  if (FAILED(HR)) {
+    spdlog::error("Failed to initialize complex material image: {}", getHRESULTErrorMessage(HR));
+    return {};
+  }
+
+  const DirectX::Image *Output = OutputImage.GetImage(0, 0, 0);
+  ParallaxGenCPUCompute::mergeToComplexMaterial(EnvExists ? &EnvView : nullptr,
+                                                ParallaxExists ? &ParallaxView : nullptr, ResultWidth, ResultHeight,
+                                                Output->pixels, Output->rowPitch);
+
+  // Full mip chain with a box filter like GenerateMips on the GPU
+  DirectX::ScratchImage OutputImageMips;
+  HR = DirectX::GenerateMipMaps(*Output, DirectX::TEX_FILTER_BOX, 0, OutputImageMips);
+  if (FAILED(HR)) {
+    spdlog::error("Failed to generate mipmaps for complex material image: {}", getHRESULTErrorMessage(HR));
+    return {};
+  }
+
+  return OutputImageMips;
+}
+
+auto ParallaxGenD3D::compressComplexMaterial(const DirectX::ScratchImage &Image) -> DirectX::ScratchImage {
+  if (Image.GetImageCount() == 0) {
+    return {};
+  }
+
   // Compress DDS
   // BC3 works best with heightmaps
   DirectX::ScratchImage CompressedImage;
-  HRESULT HR = DirectX::Compress(OutputImage.GetImages(), OutputImage.GetImageCount(), OutputImage.GetMetadata(),
-                                 DXGI_FORMAT_BC3_UNORM, DirectX::TEX_COMPRESS_DEFAULT, 1.0F, CompressedImage);
+  HRESULT HR = DirectX::Compress(Image.GetImages(), Image.GetImageCount(), Image.GetMetadata(), DXGI_FORMAT_BC3_UNORM,
+                                 DirectX::TEX_COMPRESS_DEFAULT, 1.0F, CompressedImage);
   if (FAILED(HR)) {
     spdlog::error("Failed to compress output DDS file: {}", getHRESULTErrorMessage(HR));
     return {};
@@ -682,6 +986,33 @@ auto ParallaxGenD3D::upgradeToComplexMaterial(const std::filesystem::path &Paral
   return CompressedImage;
 }
 
+auto ParallaxGenD3D::getRGBAImage(const DirectX::ScratchImage &Image, DirectX::ScratchImage &Dest,
+                                  const size_t &Mip) -> ParallaxGenTask::PGResult {
+  // Only the one mip is used
+  const DirectX::Image *Top = Image.GetImage(Mip, 0, 0);
+  if (Top == nullptr) {
+    spdlog::error("Failed to get image data from DDS file");
+    return ParallaxGenTask::PGResult::FAILURE;
+  }
+
+  HRESULT HR{};
+  if (DirectX::IsCompressed(Top->format)) {
+    HR = DirectX::Decompress(*Top, DXGI_FORMAT_R8G8B8A8_UNORM, Dest);
+  } else if (Top->format != DXGI_FORMAT_R8G8B8A8_UNORM) {
+    HR = DirectX::Convert(*Top, DXGI_FORMAT_R8G8B8A8_UNORM, DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT,
+                          Dest);
+  } else {
+    HR = Dest.InitializeFromImage(*Top);
+  }
+
+  if (FAILED(HR)) {
+    spdlog::error("Failed to convert DDS file to RGBA: {}", getHRESULTErrorMessage(HR));
+    return ParallaxGenTask::PGResult::FAILURE;
+  }
+
+  return ParallaxGenTask::PGResult::SUCCESS;
+}
+
 //
 // GPU Helpers
 //
@@ -1031,50 +1362,103 @@ auto ParallaxGenD3D::getDDS(const filesystem::path &DDSPath,
 
 auto ParallaxGenD3D::getDDSMetadata(const filesystem::path &DDSPath,
                                     DirectX::TexMetadata &DDSMeta) -> ParallaxGenTask::PGResult {
-  // Use lock_guard to make this method thread-safe
-  lock_guard<mutex> Lock(DDSMetaDataMutex);
-
-  // Check if in cache
-  // TODO set cache to something on failure
-  if (DDSMetaDataCache.find(DDSPath) != DDSMetaDataCache.end()) {
-    DDSMeta = DDSMetaDataCache[DDSPath];
-    return ParallaxGenTask::PGResult::SUCCESS;
-  }
+  // Threads missing on the same texture share one read
+  DDSMetaDataLookups++;
+  const auto Entry = DDSMetaDataCache.getOrComputeOnce(DDSPath, [this, &DDSPath]() {
+    DDSMetaDataReads++;
+    DDSMetaDataEntry NewEntry;
+    NewEntry.Result = readDDSMetadata(DDSPath, NewEntry.Meta);
+    if (NewEntry.Result != ParallaxGenTask::PGResult::SUCCESS) {
+      DDSMetaDataFailures++;
+    } else if (TextureDB) {
+      if (const auto Source = getTextureSource(DDSPath)) {
+        TextureDB->setMetadata(DDSPath, *Source, toDDSHeaderInfo(NewEntry.Meta));
+      }
+    }
+    return NewEntry;
+  });
 
-  HRESULT HR{};
+  DDSMeta = Entry.Meta;
+  return Entry.Result;
+}
 
+auto ParallaxGenD3D::readDDSMetadata(const filesystem::path &DDSPath,
+                                     DirectX::TexMetadata &DDSMeta) const -> ParallaxGenTask::PGResult {
+  // Only the header is read, loose and BSA files alike
+  vector<std::byte> DDSHeader;
   if (PGD->isLooseFile(DDSPath)) {
     spdlog::trace(L"Reading DDS loose file metadata {}", DDSPath.wstring());
-    filesystem::path FullPath = PGD->getFullPath(DDSPath);
-
-    // Load DDS file
-    HR = DirectX::GetMetadataFromDDSFile(FullPath.c_str(), DirectX::DDS_FLAGS_NONE, DDSMeta);
+    DDSHeader = getFileBytes(PGD->getFullPath(DDSPath), DDSUtil::DDS_HEADER_MAX_SIZE);
   } else if (PGD->isBSAFile(DDSPath)) {
     spdlog::trace(L"Reading DDS BSA file metadata {}", DDSPath.wstring());
-    vector<std::byte> DDSBytes = PGD->getFile(DDSPath);
-
-    // Load DDS file
-    HR = DirectX::GetMetadataFromDDSMemory(DDSBytes.data(), DDSBytes.size(), DirectX::DDS_FLAGS_NONE, DDSMeta);
+    DDSHeader = PGD->readFilePrefix(DDSPath, DDSUtil::DDS_HEADER_MAX_SIZE);
   } else {
     spdlog::trace(L"Reading DDS file from output dir {}", DDSPath.wstring());
-    filesystem::path FullPath = OutputDir / DDSPath;
-
-    // Load DDS file
-    HR = DirectX::GetMetadataFromDDSFile(FullPath.c_str(), DirectX::DDS_FLAGS_NONE, DDSMeta);
+    DDSHeader = getFileBytes(OutputDir / DDSPath, DDSUtil::DDS_HEADER_MAX_SIZE);
   }
 
-  if (FAILED(HR)) {
-    spdlog::error(L"Failed to load DDS file metadata from {}: {}", DDSPath.wstring(),
-                  strToWstr(getHRESULTErrorMessage(HR)));
-    return ParallaxGenTask::PGResult::FAILURE;
-  }
+  if (const auto HeaderInfo = DDSUtil::parseDDSHeader(DDSHeader)) {
+    DDSMeta = toTexMetadata(*HeaderInfo);
+  } else {
+    // Legacy formats the parser doesn't map, DirectXTex only needs the header for these too
+    HRESULT HR = DirectX::GetMetadataFromDDSMemory(DDSHeader.data(), DDSHeader.size(), DirectX::DDS_FLAGS_NONE, DDSMeta);
+    if (FAILED(HR) && !DDSHeader.empty()) {
+      // Whole file in case DirectXTex wants more than the header
+      const vector<std::byte> DDSBytes = PGD->isLooseFile(DDSPath) || PGD->isBSAFile(DDSPath)
+                                             ? PGD->getFile(DDSPath)
+                                             : getFileBytes(OutputDir / DDSPath);
+      HR = DirectX::GetMetadataFromDDSMemory(DDSBytes.data(), DDSBytes.size(), DirectX::DDS_FLAGS_NONE, DDSMeta);
+    }
 
-  // update cache
-  DDSMetaDataCache[DDSPath] = DDSMeta;
+    if (FAILED(HR)) {
+      spdlog::error(L"Failed to load DDS file metadata from {}: {}", DDSPath.wstring(),
+                    strToWstr(getHRESULTErrorMessage(HR)));
+      return ParallaxGenTask::PGResult::FAILURE;
+    }
+  }
 
   return ParallaxGenTask::PGResult::SUCCESS;
 }
 
+void ParallaxGenD3D::cacheDDSMetadata(const filesystem::path &DDSPath, const DirectX::TexMetadata &DDSMeta) {
+  DDSMetaDataCache.insertOrAssign(DDSPath, {ParallaxGenTask::PGResult::SUCCESS, DDSMeta});
+}
+
+auto ParallaxGenD3D::toTexMetadata(const DDSUtil::DDSHeaderInfo &Info) -> DirectX::TexMetadata {
+  DirectX::TexMetadata Meta{};
+  Meta.width = Info.Width;
+  Meta.height = Info.Height;
+  Meta.depth = Info.Depth;
+  Meta.arraySize = Info.ArraySize;
+  Meta.mipLevels = Info.MipLevels;
+  Meta.miscFlags = Info.MiscFlags;
+  Meta.miscFlags2 = Info.MiscFlags2;
+  Meta.format = static_cast<DXGI_FORMAT>(Info.Format);
+  Meta.dimension = static_cast<DirectX::TEX_DIMENSION>(Info.Dimension);
+  return Meta;
+}
+
+auto ParallaxGenD3D::toDDSHeaderInfo(const DirectX::TexMetadata &Meta) -> DDSUtil::DDSHeaderInfo {
+  DDSUtil::DDSHeaderInfo Info;
+  Info.Width = Meta.width;
+  Info.Height = Meta.height;
+  Info.Depth = Meta.depth;
+  Info.ArraySize = Meta.arraySize;
+  Info.MipLevels = Meta.mipLevels;
+  Info.MiscFlags = Meta.miscFlags;
+  Info.MiscFlags2 = Meta.miscFlags2;
+  Info.Format = static_cast<uint32_t>(Meta.format);
+  Info.Dimension = static_cast<uint32_t>(Meta.dimension);
+  return Info;
+}
+
+void ParallaxGenD3D::printDDSMetadataCacheSummary() const {
+  const size_t Lookups = DDSMetaDataLookups;
+  const size_t Reads = DDSMetaDataReads;
+  spdlog::debug("DDS metadata cache: {} lookups, {} hits, {} header reads ({} failed)", Lookups, Lookups - Reads, Reads,
+                DDSMetaDataFailures.load());
+}
+
 auto ParallaxGenD3D::loadRawPixelsToScratchImage(const vector<unsigned char> &RawPixels, const size_t &Width,
                                                  const size_t &Height, const size_t &Mips,
                                                  DXGI_FORMAT Format) -> DirectX::ScratchImage {
@@ -6,8 +6,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/asio.hpp>
-#include <boost/thread.hpp>
+#include <chrono>
 #include <filesystem>
 #include <mutex>
 #include <shlwapi.h>
@@ -19,12 +18,17 @@
 
 #include "BethesdaDirectory.hpp"
 #include "NIFUtil.hpp"
+#include "ParallaxGenMemoryGovernor.hpp"
+#include "ParallaxGenScheduler.hpp"
 #include "ParallaxGenTask.hpp"
 #include "ParallaxGenUtil.hpp"
 
 using namespace std;
 using namespace ParallaxGenUtil;
 
+// A mesh being mapped holds its bytes and the parsed NIF, a few times its file size
+constexpr size_t NIF_MEMORY_FACTOR = 3;
+
 ParallaxGenDirectory::ParallaxGenDirectory(BethesdaGame BG) : BethesdaDirectory(BG, true) {}
 
 auto ParallaxGenDirectory::findFiles() -> void {
@@ -34,8 +38,7 @@ auto ParallaxGenDirectory::findFiles() -> void {
 
   // Populate unconfirmed maps
   spdlog::info("Finding Relevant Files");
-  const auto &FileMap = getFileMap();
-  for (const auto &[Path, File] : FileMap) {
+  forEachFile(L"", [this](const filesystem::path &Path, [[maybe_unused]] const BethesdaFile &File) {
     const auto &FirstPath = Path.begin()->wstring();
     if (boost::iequals(FirstPath, "textures") && boost::iequals(Path.extension().wstring(), L".dds")) {
       // Found a DDS
@@ -57,7 +60,7 @@ auto ParallaxGenDirectory::findFiles() -> void {
         PGJSONs.push_back(Path);
       }
     }
-  }
+  });
   spdlog::info("Finding files done");
 }
 
@@ -71,16 +74,11 @@ auto ParallaxGenDirectory::mapFiles(const unordered_set<wstring> &NIFBlocklist,
   // Create task tracker
   ParallaxGenTask TaskTracker("Loading NIFs", UnconfirmedMeshes.size(), MAPTEXTURE_PROGRESS_MODULO);
 
-  // Create thread pool
-#ifdef _DEBUG
-  size_t NumThreads = 1;
-#else
-  const size_t NumThreads = boost::thread::hardware_concurrency();
-#endif
-  boost::asio::thread_pool MapTextureFromMeshPool(NumThreads);
+  // Largest meshes come first so they don't end up as stragglers at the end
+  const auto SortedMeshes = getFilesBySizeDesc(UnconfirmedMeshes);
 
-  // Loop through each mesh to confirm textures
-  for (const auto &Mesh : UnconfirmedMeshes) {
+  vector<filesystem::path> MeshesToMap;
+  for (const auto &Mesh : SortedMeshes) {
     if (checkGlobMatchInSet(Mesh.wstring(), NIFBlocklist)) {
       // Skip mesh because it is on blocklist
       spdlog::trace(L"Loading NIFs | Skipping Mesh due to Blocklist | Mesh: {}", Mesh.wstring());
@@ -95,26 +93,38 @@ auto ParallaxGenDirectory::mapFiles(const unordered_set<wstring> &NIFBlocklist,
       continue;
     }
 
-    if (Multithreading) {
-      boost::asio::post(MapTextureFromMeshPool, [this, &TaskTracker, &Mesh, &CacheNIFs] {
-        ParallaxGenTask::PGResult Result = ParallaxGenTask::PGResult::SUCCESS;
-        try {
-          Result = mapTexturesFromNIF(Mesh, CacheNIFs);
-        } catch (const exception &E) {
-          spdlog::error(L"Exception in thread loading NIF \"{}\": {}", Mesh.wstring(), strToWstr(E.what()));
-          Result = ParallaxGenTask::PGResult::FAILURE;
-        }
-
-        TaskTracker.completeJob(Result);
-      });
-    } else {
-      TaskTracker.completeJob(mapTexturesFromNIF(Mesh, CacheNIFs));
-    }
+    MeshesToMap.push_back(Mesh);
   }
 
   if (Multithreading) {
-    // Wait for all threads to complete
-    MapTextureFromMeshPool.join();
+    auto &Scheduler = ParallaxGenScheduler::get();
+
+    // One mesh per task, chunks would undo the size ordering
+    Scheduler.parallelFor(
+        0, MeshesToMap.size(),
+        [this, &TaskTracker, &MeshesToMap, &CacheNIFs](const size_t &I) {
+          const auto &Mesh = MeshesToMap[I];
+          const auto Memory = ParallaxGenMemoryGovernor::get().admit(getFileSize(Mesh) * NIF_MEMORY_FACTOR);
+          const auto JobStart = chrono::steady_clock::now();
+
+          ParallaxGenTask::PGResult Result = ParallaxGenTask::PGResult::SUCCESS;
+          try {
+            Result = mapTexturesFromNIF(Mesh, CacheNIFs);
+          } catch (const exception &E) {
+            spdlog::error(L"Exception in thread loading NIF \"{}\": {}", Mesh.wstring(), strToWstr(E.what()));
+            Result = ParallaxGenTask::PGResult::FAILURE;
+          }
+
+          TaskTracker.addWorkerBusyTime(chrono::steady_clock::now() - JobStart);
+          TaskTracker.completeJob(Result);
+        },
+        1);
+
+    TaskTracker.printWorkerIdleSummary(Scheduler.getNumThreads());
+  } else {
+    for (const auto &Mesh : MeshesToMap) {
+      TaskTracker.completeJob(mapTexturesFromNIF(Mesh, CacheNIFs));
+    }
   }
 
   // Loop through unconfirmed textures to confirm them
@@ -191,12 +201,16 @@ auto ParallaxGenDirectory::mapTexturesFromNIF(const filesystem::path &NIFPath,
                                               const bool &CacheNIFs) -> ParallaxGenTask::PGResult {
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
-  // Load NIF
-  const auto NIFBytes = getFile(NIFPath, CacheNIFs);
+  // Load NIF, parsed in place from the loose file or BSA unless it's kept in the cache for later
   NifFile NIF;
   try {
     // Attempt to load NIF file
-    NIF = NIFUtil::loadNIFFromBytes(NIFBytes);
+    if (CacheNIFs) {
+      NIF = NIFUtil::loadNIFFromBytes(getFile(NIFPath, true));
+    } else {
+      const auto NIFView = getFileView(NIFPath);
+      NIF = NIFUtil::loadNIFFromBytes(NIFView.getBytes());
+    }
   } catch (const exception &E) {
     // Unable to read NIF, delete from Meshes set
     spdlog::error(L"Error reading NIF File \"{}\" (skipping): {}", NIFPath.wstring(), strToWstr(E.what()));
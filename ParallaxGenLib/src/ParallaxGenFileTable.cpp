@@ -0,0 +1,213 @@
+#include "ParallaxGenFileTable.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+using namespace std;
+
+namespace {
+// Same order std::filesystem::path gives keys: by component, which is plain string order with separators sorting
+// before every other character
+auto getKeyWeight(const wchar_t &C) -> wchar_t { return C == L'\\' || C == L'/' ? 0 : C; }
+} // namespace
+
+//
+// Builder
+//
+
+void ParallaxGenFileTable::Builder::add(const wstring &Key, const wstring &Path, const uint32_t &Source,
+                                        const uint64_t &Size) {
+  PendingRecord NewRecord{};
+  NewRecord.KeyOffset = Strings.size();
+  NewRecord.KeyLength = static_cast<uint32_t>(Key.size());
+  Strings.insert(Strings.end(), Key.begin(), Key.end());
+
+  // Paths that only differ from their key in case are common, but still need their own copy
+  NewRecord.PathOffset = Strings.size();
+  NewRecord.PathLength = static_cast<uint32_t>(Path.size());
+  Strings.insert(Strings.end(), Path.begin(), Path.end());
+
+  NewRecord.Source = Source;
+  NewRecord.Size = Size;
+  Records.push_back(NewRecord);
+}
+
+auto ParallaxGenFileTable::Builder::write(const filesystem::path &TablePath) -> bool {
+  const auto GetKey = [this](const PendingRecord &R) { return wstring_view(Strings.data() + R.KeyOffset, R.KeyLength); };
+
+  // Sort by key, equal keys keep insertion order so the last one added can win
+  vector<uint32_t> Order(Records.size());
+  iota(Order.begin(), Order.end(), 0);
+  stable_sort(Order.begin(), Order.end(),
+              [&](const uint32_t &A, const uint32_t &B) { return keyLess(GetKey(Records[A]), GetKey(Records[B])); });
+
+  vector<uint32_t> Winners;
+  Winners.reserve(Order.size());
+  for (size_t I = 0; I < Order.size(); I++) {
+    if (I + 1 < Order.size() && GetKey(Records[Order[I]]) == GetKey(Records[Order[I + 1]])) {
+      continue;
+    }
+    Winners.push_back(Order[I]);
+  }
+
+  ofstream Out(TablePath, ios::binary | ios::trunc);
+  if (!Out.is_open()) {
+    spdlog::error(L"Unable to create file table {}", TablePath.wstring());
+    return false;
+  }
+
+  const Header TableHeader{TABLE_MAGIC, Winners.size()};
+  Out.write(reinterpret_cast<const char *>(&TableHeader), sizeof(TableHeader)); // NOLINT
+
+  // Records first with offsets into the compacted string block, then the block itself
+  uint64_t NextOffset = 0;
+  for (const auto &Index : Winners) {
+    const auto &Pending = Records[Index];
+    Record OutRecord{};
+    OutRecord.KeyOffset = NextOffset;
+    OutRecord.KeyLength = Pending.KeyLength;
+    NextOffset += Pending.KeyLength;
+    OutRecord.PathOffset = NextOffset;
+    OutRecord.PathLength = Pending.PathLength;
+    NextOffset += Pending.PathLength;
+    OutRecord.Size = Pending.Size;
+    OutRecord.Source = Pending.Source;
+    Out.write(reinterpret_cast<const char *>(&OutRecord), sizeof(OutRecord)); // NOLINT
+  }
+
+  for (const auto &Index : Winners) {
+    const auto &Pending = Records[Index];
+    Out.write(reinterpret_cast<const char *>(Strings.data() + Pending.KeyOffset), // NOLINT
+              static_cast<streamsize>(Pending.KeyLength * sizeof(wchar_t)));
+    Out.write(reinterpret_cast<const char *>(Strings.data() + Pending.PathOffset), // NOLINT
+              static_cast<streamsize>(Pending.PathLength * sizeof(wchar_t)));
+  }
+
+  Out.close();
+  if (Out.fail()) {
+    spdlog::error(L"Unable to write file table {}", TablePath.wstring());
+    return false;
+  }
+
+  // Nothing is needed on the heap anymore
+  Strings = {};
+  Records = {};
+
+  return true;
+}
+
+//
+// ParallaxGenFileTable
+//
+
+ParallaxGenFileTable::~ParallaxGenFileTable() { close(); }
+
+auto ParallaxGenFileTable::open(const filesystem::path &TablePath) -> bool {
+  close();
+
+  File = CreateFileW(TablePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                     FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (File == INVALID_HANDLE_VALUE) {
+    spdlog::error(L"Unable to open file table {}", TablePath.wstring());
+    return false;
+  }
+
+  LARGE_INTEGER FileSize{};
+  if (GetFileSizeEx(File, &FileSize) == 0 || static_cast<uint64_t>(FileSize.QuadPart) < sizeof(Header)) {
+    spdlog::error(L"File table {} is truncated", TablePath.wstring());
+    close();
+    return false;
+  }
+
+  Mapping = CreateFileMappingW(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (Mapping == nullptr) {
+    spdlog::error(L"Unable to map file table {}", TablePath.wstring());
+    close();
+    return false;
+  }
+
+  View = static_cast<const std::byte *>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+  if (View == nullptr) {
+    spdlog::error(L"Unable to map file table {}", TablePath.wstring());
+    close();
+    return false;
+  }
+
+  const auto *TableHeader = reinterpret_cast<const Header *>(View); // NOLINT
+  const uint64_t RecordsEnd = sizeof(Header) + (TableHeader->NumRecords * sizeof(Record));
+  if (TableHeader->Magic != TABLE_MAGIC || RecordsEnd > static_cast<uint64_t>(FileSize.QuadPart)) {
+    spdlog::error(L"File table {} is invalid", TablePath.wstring());
+    close();
+    return false;
+  }
+
+  NumRecords = TableHeader->NumRecords;
+  Records = reinterpret_cast<const Record *>(View + sizeof(Header));  // NOLINT
+  StringBlock = reinterpret_cast<const wchar_t *>(View + RecordsEnd); // NOLINT
+
+  return true;
+}
+
+void ParallaxGenFileTable::close() {
+  if (View != nullptr) {
+    UnmapViewOfFile(View);
+    View = nullptr;
+  }
+
+  if (Mapping != nullptr) {
+    CloseHandle(Mapping);
+    Mapping = nullptr;
+  }
+
+  if (File != INVALID_HANDLE_VALUE) {
+    CloseHandle(File);
+    File = INVALID_HANDLE_VALUE;
+  }
+
+  Records = nullptr;
+  NumRecords = 0;
+  StringBlock = nullptr;
+}
+
+auto ParallaxGenFileTable::keyLess(wstring_view A, wstring_view B) -> bool {
+  return lexicographical_compare(A.begin(), A.end(), B.begin(), B.end(), [](const wchar_t &X, const wchar_t &Y) {
+    return getKeyWeight(X) < getKeyWeight(Y);
+  });
+}
+
+auto ParallaxGenFileTable::getKey(const size_t &Index) const -> wstring_view {
+  const auto &R = Records[Index];                                        // NOLINT
+  return {StringBlock + R.KeyOffset, static_cast<size_t>(R.KeyLength)}; // NOLINT
+}
+
+auto ParallaxGenFileTable::at(const size_t &Index) const -> Entry {
+  const auto &R = Records[Index]; // NOLINT
+  return {getKey(Index), wstring_view(StringBlock + R.PathOffset, R.PathLength), R.Source, R.Size}; // NOLINT
+}
+
+auto ParallaxGenFileTable::lowerBound(wstring_view Key) const -> size_t {
+  size_t Low = 0;
+  size_t High = NumRecords;
+  while (Low < High) {
+    const size_t Mid = Low + ((High - Low) / 2);
+    if (keyLess(getKey(Mid), Key)) {
+      Low = Mid + 1;
+    } else {
+      High = Mid;
+    }
+  }
+
+  return Low;
+}
+
+auto ParallaxGenFileTable::find(wstring_view Key) const -> optional<Entry> {
+  const size_t Index = lowerBound(Key);
+  if (Index == NumRecords || getKey(Index) != Key) {
+    return nullopt;
+  }
+
+  return at(Index);
+}
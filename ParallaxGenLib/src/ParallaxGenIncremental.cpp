@@ -0,0 +1,314 @@
+#include "ParallaxGenIncremental.hpp"
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <utility>
+
+#include "ParallaxGenUtil.hpp"
+
+using namespace std;
+using namespace ParallaxGenUtil;
+
+// Bump when the manifest layout or the meaning of the decision key changes
+constexpr int MANIFEST_VERSION = 1;
+
+// Journal lines are buffered and written out as a checkpoint every few seconds or records
+constexpr size_t JOURNAL_CHECKPOINT_RECORDS = 256;
+constexpr auto JOURNAL_CHECKPOINT_INTERVAL = chrono::seconds(10);
+
+//
+// ParallaxGenKeyHasher
+//
+
+void ParallaxGenKeyHasher::add(const void *Data, const size_t &Size) {
+  const auto *Bytes = static_cast<const unsigned char *>(Data);
+  for (size_t I = 0; I < Size; I++) {
+    State ^= Bytes[I]; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    State *= FNV_PRIME;
+  }
+}
+
+void ParallaxGenKeyHasher::add(const string &Str) {
+  add(Str.data(), Str.size());
+  // Terminate so "ab","c" and "a","bc" hash differently
+  add(static_cast<uint64_t>(Str.size()));
+}
+
+void ParallaxGenKeyHasher::add(const wstring &Str) { add(wstrToStr(Str)); }
+
+void ParallaxGenKeyHasher::add(const uint64_t &Value) { add(&Value, sizeof(Value)); }
+
+//
+// ParallaxGenIncremental
+//
+
+ParallaxGenIncremental::ParallaxGenIncremental(filesystem::path PreviousDir, const filesystem::path &PreviousZipPath)
+    : PreviousDir(std::move(PreviousDir)) {
+  const auto ManifestName = wstrToStr(getManifestName().wstring());
+  string ManifestStr;
+
+  if (filesystem::exists(PreviousZipPath)) {
+    // A zip of an interrupted run has no central directory, loose files are still used then
+    const string ZipPathStr = wstrToStr(PreviousZipPath.wstring());
+    if (mz_zip_reader_init_file(&PreviousZip, ZipPathStr.c_str(), 0) != 0) {
+      PreviousZipOpen = true;
+    } else {
+      spdlog::warn(L"Unable to open previous output {}, only loose files will be reused", PreviousZipPath.wstring());
+    }
+  }
+
+  if (PreviousZipOpen) {
+    size_t ManifestSize = 0;
+    void *ManifestData = mz_zip_reader_extract_file_to_heap(&PreviousZip, ManifestName.c_str(), &ManifestSize, 0);
+    if (ManifestData != nullptr) {
+      ManifestStr.assign(static_cast<const char *>(ManifestData), ManifestSize);
+      mz_free(ManifestData);
+    }
+  } else if (filesystem::exists(this->PreviousDir / getManifestName())) {
+    const auto ManifestBytes = getFileBytes(this->PreviousDir / getManifestName());
+    ManifestStr.assign(reinterpret_cast<const char *>(ManifestBytes.data()), ManifestBytes.size()); // NOLINT
+  }
+
+  if (!ManifestStr.empty()) {
+    loadManifest(ManifestStr);
+  }
+
+  // Meshes an interrupted run finished after its last complete manifest
+  if (filesystem::exists(this->PreviousDir / getJournalName())) {
+    loadJournal(this->PreviousDir / getJournalName());
+  }
+
+  if (PreviousRecords.empty()) {
+    spdlog::info("No previous mesh records found, all meshes will be processed");
+    return;
+  }
+
+  spdlog::info("Loaded {} mesh records from the previous run", PreviousRecords.size());
+}
+
+ParallaxGenIncremental::~ParallaxGenIncremental() {
+  if (PreviousZipOpen) {
+    mz_zip_reader_end(&PreviousZip);
+  }
+
+  closeJournal();
+}
+
+auto ParallaxGenIncremental::getManifestName() -> filesystem::path { return "ParallaxGen_Incremental.json"; }
+
+auto ParallaxGenIncremental::getJournalName() -> filesystem::path { return "ParallaxGen_Journal.jsonl"; }
+
+void ParallaxGenIncremental::loadManifest(const string &ManifestStr) {
+  try {
+    const auto Manifest = nlohmann::json::parse(ManifestStr);
+    if (!Manifest.contains("version") || Manifest["version"].get<int>() != MANIFEST_VERSION) {
+      spdlog::info("Previous incremental manifest is from another version, all meshes will be processed");
+      return;
+    }
+
+    for (const auto &[Key, Entry] : Manifest["meshes"].items()) {
+      PreviousRecords.insert_or_assign(Key, parseRecord(Key, Entry));
+    }
+  } catch (const exception &E) {
+    spdlog::warn("Unable to read previous incremental manifest, all meshes will be processed: {}", E.what());
+    PreviousRecords.clear();
+  }
+}
+
+void ParallaxGenIncremental::loadJournal(const filesystem::path &JournalPath) {
+  ifstream JournalFile(JournalPath);
+  string Line;
+  if (!getline(JournalFile, Line)) {
+    return;
+  }
+
+  try {
+    const auto Header = nlohmann::json::parse(Line);
+    if (!Header.contains("version") || Header["version"].get<int>() != MANIFEST_VERSION) {
+      spdlog::info("Journal is from another version, it will not be used");
+      return;
+    }
+  } catch (const exception &) {
+    spdlog::warn(L"Unable to read journal {}, it will not be used", JournalPath.wstring());
+    return;
+  }
+
+  size_t NumJournaled = 0;
+  while (getline(JournalFile, Line)) {
+    try {
+      const auto Entry = nlohmann::json::parse(Line);
+      const auto Key = Entry[0].get<string>();
+      PreviousRecords.insert_or_assign(Key, parseRecord(Key, Entry[1]));
+      NumJournaled++;
+    } catch (const exception &) {
+      // A line is cut off if the run was killed while writing a checkpoint, journals of resumed runs are appended
+      // after it
+      continue;
+    }
+  }
+
+  spdlog::info("Loaded {} journaled mesh records", NumJournaled);
+}
+
+auto ParallaxGenIncremental::parseRecord(const string &Key, const nlohmann::json &Entry) -> MeshRecord {
+  MeshRecord Record;
+  Record.NIFFile = strToWstr(Key);
+  Record.CRCBefore = Entry["crc32original"].get<uint32_t>();
+  Record.DecisionKey = Entry["decisionkey"].get<uint64_t>();
+  Record.Patched = Entry["patched"].get<bool>();
+  Record.CRCAfter = Entry["crc32patched"].get<uint32_t>();
+
+  for (const auto &TextureRef : Entry["textures"]) {
+    Record.TextureRefs.push_back(strToWstr(TextureRef.get<string>()));
+  }
+
+  for (const auto &Shape : Entry["pluginshapes"]) {
+    Record.PluginShapes.push_back(
+        {Shape[0].get<int>(), strToWstr(Shape[1].get<string>()), Shape[2].get<int>(), Shape[3].get<int>()});
+  }
+
+  return Record;
+}
+
+auto ParallaxGenIncremental::serializeRecord(const MeshRecord &Record) -> string {
+  string Out = R"({"crc32original":)" + to_string(Record.CRCBefore);
+  Out += R"(,"decisionkey":)" + to_string(Record.DecisionKey);
+  Out += R"(,"patched":)" + string(Record.Patched ? "true" : "false");
+  Out += R"(,"crc32patched":)" + to_string(Record.CRCAfter);
+
+  Out += R"(,"textures":[)";
+  for (size_t I = 0; I < Record.TextureRefs.size(); I++) {
+    if (I > 0) {
+      Out += ',';
+    }
+    Out += nlohmann::json(wstrToStr(Record.TextureRefs[I])).dump();
+  }
+
+  Out += R"(],"pluginshapes":[)";
+  for (size_t I = 0; I < Record.PluginShapes.size(); I++) {
+    const auto &Shape = Record.PluginShapes[I];
+    if (I > 0) {
+      Out += ',';
+    }
+    Out += '[' + to_string(Shape.Shader) + ',' + nlohmann::json(wstrToStr(Shape.ShapeName)).dump() + ',' +
+           to_string(Shape.OldIndex) + ',' + to_string(Shape.NewIndex) + ']';
+  }
+  Out += "]}";
+
+  return Out;
+}
+
+auto ParallaxGenIncremental::findPrevious(const filesystem::path &NIFFile) const -> const MeshRecord * {
+  const auto It = PreviousRecords.find(wstrToStr(NIFFile.wstring()));
+  if (It == PreviousRecords.end()) {
+    return nullptr;
+  }
+
+  return &It->second;
+}
+
+auto ParallaxGenIncremental::getPreviousFile(const filesystem::path &RelPath) -> vector<std::byte> {
+  if (!PreviousZipOpen) {
+    const auto LoosePath = PreviousDir / RelPath;
+    if (!filesystem::exists(LoosePath)) {
+      return {};
+    }
+
+    return getFileBytes(LoosePath);
+  }
+
+  const string EntryName = wstrToStr(RelPath.wstring());
+  size_t EntrySize = 0;
+  void *EntryData = nullptr;
+  {
+    const lock_guard<mutex> Lock(PreviousZipMutex);
+    EntryData = mz_zip_reader_extract_file_to_heap(&PreviousZip, EntryName.c_str(), &EntrySize, 0);
+  }
+
+  if (EntryData == nullptr) {
+    return {};
+  }
+
+  const auto *EntryStart = static_cast<const std::byte *>(EntryData);
+  vector<std::byte> Bytes(EntryStart, EntryStart + EntrySize);
+  mz_free(EntryData);
+
+  return Bytes;
+}
+
+void ParallaxGenIncremental::addRecord(MeshRecord Record) {
+  const lock_guard<mutex> Lock(RecordsMutex);
+
+  if (Journal.is_open()) {
+    JournalBuffer += '[' + nlohmann::json(wstrToStr(Record.NIFFile.wstring())).dump() + ',' + serializeRecord(Record) +
+                     "]\n";
+    NumBufferedRecords++;
+
+    if (NumBufferedRecords >= JOURNAL_CHECKPOINT_RECORDS ||
+        chrono::steady_clock::now() - LastCheckpoint >= JOURNAL_CHECKPOINT_INTERVAL) {
+      writeCheckpoint();
+    }
+  }
+
+  Records.push_back(std::move(Record));
+}
+
+void ParallaxGenIncremental::openJournal(const filesystem::path &JournalPath) {
+  const lock_guard<mutex> Lock(RecordsMutex);
+
+  Journal.open(JournalPath, ios::binary | ios::trunc);
+  if (!Journal.is_open()) {
+    spdlog::warn(L"Unable to create journal {}, this run can't be resumed", JournalPath.wstring());
+    return;
+  }
+
+  JournalBuffer = R"({"version":)" + to_string(MANIFEST_VERSION) + "}\n";
+  writeCheckpoint();
+}
+
+void ParallaxGenIncremental::closeJournal() {
+  const lock_guard<mutex> Lock(RecordsMutex);
+  if (!Journal.is_open()) {
+    return;
+  }
+
+  writeCheckpoint();
+  Journal.close();
+}
+
+void ParallaxGenIncremental::writeCheckpoint() {
+  Journal.write(JournalBuffer.data(), static_cast<streamsize>(JournalBuffer.size()));
+  Journal.flush();
+  JournalBuffer.clear();
+  NumBufferedRecords = 0;
+  LastCheckpoint = chrono::steady_clock::now();
+}
+
+auto ParallaxGenIncremental::serializeManifest() -> string {
+  const lock_guard<mutex> Lock(RecordsMutex);
+
+  // Keys are UTF-8 paths in byte order, same as the diff JSON
+  vector<pair<string, const MeshRecord *>> SortedRecords;
+  SortedRecords.reserve(Records.size());
+  for (const auto &Record : Records) {
+    SortedRecords.emplace_back(wstrToStr(Record.NIFFile.wstring()), &Record);
+  }
+  sort(SortedRecords.begin(), SortedRecords.end(),
+       [](const auto &A, const auto &B) { return A.first < B.first; });
+
+  string Out = R"({"version":)" + to_string(MANIFEST_VERSION) + R"(,"meshes":{)";
+  for (size_t I = 0; I < SortedRecords.size(); I++) {
+    if (I > 0) {
+      Out += ',';
+    }
+
+    Out += nlohmann::json(SortedRecords[I].first).dump() + ':' + serializeRecord(*SortedRecords[I].second);
+  }
+  Out += "}}\n";
+
+  return Out;
+}
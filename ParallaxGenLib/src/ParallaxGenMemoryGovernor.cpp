@@ -0,0 +1,122 @@
+#include "ParallaxGenMemoryGovernor.hpp"
+
+#include <spdlog/spdlog.h>
+#include <windows.h>
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+// Bytes per MiB, for logging
+constexpr size_t MIB = 1ULL << 20;
+
+//
+// Reservation
+//
+
+ParallaxGenMemoryGovernor::Reservation::Reservation(Reservation &&Other) noexcept
+    : Governor(std::exchange(Other.Governor, nullptr)), Bytes(std::exchange(Other.Bytes, 0)),
+      Admitted(std::exchange(Other.Admitted, false)) {}
+
+auto ParallaxGenMemoryGovernor::Reservation::operator=(Reservation &&Other) noexcept -> Reservation & {
+  if (this != &Other) {
+    release();
+    Governor = std::exchange(Other.Governor, nullptr);
+    Bytes = std::exchange(Other.Bytes, 0);
+    Admitted = std::exchange(Other.Admitted, false);
+  }
+
+  return *this;
+}
+
+void ParallaxGenMemoryGovernor::Reservation::release() {
+  if (Governor == nullptr) {
+    return;
+  }
+
+  Governor->release(Bytes, Admitted);
+  Governor = nullptr;
+  Bytes = 0;
+  Admitted = false;
+}
+
+//
+// ParallaxGenMemoryGovernor
+//
+
+ParallaxGenMemoryGovernor::ParallaxGenMemoryGovernor(const size_t &Budget)
+    : Budget(Budget > 0 ? Budget : getDefaultBudget()) {}
+
+void ParallaxGenMemoryGovernor::setBudget(const size_t &Budget) { ConfiguredBudget = Budget; }
+
+auto ParallaxGenMemoryGovernor::get() -> ParallaxGenMemoryGovernor & {
+  static ParallaxGenMemoryGovernor Governor(ConfiguredBudget);
+  return Governor;
+}
+
+auto ParallaxGenMemoryGovernor::getDefaultBudget() -> size_t {
+  MEMORYSTATUSEX Status{};
+  Status.dwLength = sizeof(Status);
+  if (GlobalMemoryStatusEx(&Status) == 0) {
+    spdlog::warn("Unable to read physical memory size, using a memory budget of {} MiB", MIN_BUDGET / MIB);
+    return MIN_BUDGET;
+  }
+
+  return max<size_t>(MIN_BUDGET, static_cast<size_t>(Status.ullTotalPhys / 100 * DEFAULT_BUDGET_PERCENT));
+}
+
+auto ParallaxGenMemoryGovernor::admit(const size_t &Bytes) -> Reservation { return admit(Bytes, {}); }
+
+auto ParallaxGenMemoryGovernor::admit(const size_t &Bytes, const function<bool()> &CanOvercommit) -> Reservation {
+  unique_lock<mutex> Lock(GovernorMutex);
+
+  const auto Fits = [this, &Bytes, &CanOvercommit] {
+    return Reserved + Bytes <= Budget || NumAdmitted == 0 || (CanOvercommit && CanOvercommit());
+  };
+  if (!Fits()) {
+    NumWaits++;
+    Released.wait(Lock, Fits);
+  }
+
+  Reserved += Bytes;
+  Peak = max(Peak, Reserved);
+  NumAdmitted++;
+
+  return {this, Bytes, true};
+}
+
+auto ParallaxGenMemoryGovernor::tryReserve(const size_t &Bytes) -> optional<Reservation> {
+  const lock_guard<mutex> Lock(GovernorMutex);
+  if (Reserved + Bytes > Budget) {
+    return nullopt;
+  }
+
+  Reserved += Bytes;
+  Peak = max(Peak, Reserved);
+
+  return Reservation(this, Bytes, false);
+}
+
+void ParallaxGenMemoryGovernor::release(const size_t &Bytes, const bool &Admitted) {
+  {
+    const lock_guard<mutex> Lock(GovernorMutex);
+    Reserved -= Bytes;
+    if (Admitted) {
+      NumAdmitted--;
+    }
+  }
+
+  Released.notify_all();
+}
+
+auto ParallaxGenMemoryGovernor::getPeak() -> size_t {
+  const lock_guard<mutex> Lock(GovernorMutex);
+  return Peak;
+}
+
+void ParallaxGenMemoryGovernor::printSummary() {
+  const lock_guard<mutex> Lock(GovernorMutex);
+  spdlog::info("Memory budget: {} MiB, peak reserved: {} MiB, waited for memory {} times", Budget / MIB, Peak / MIB,
+               NumWaits);
+}
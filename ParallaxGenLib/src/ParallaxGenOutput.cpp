@@ -0,0 +1,198 @@
+#include "ParallaxGenOutput.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "ParallaxGenUtil.hpp"
+
+using namespace std;
+using namespace ParallaxGenUtil;
+
+//
+// LooseOutputSink
+//
+
+LooseOutputSink::LooseOutputSink(filesystem::path OutputDir) : OutputDir(std::move(OutputDir)) {}
+
+auto LooseOutputSink::write(const ParallaxGenOutputFile &File) -> bool {
+  return writeFileBytes(OutputDir / File.RelPath, File.Bytes);
+}
+
+//
+// ZipOutputSink
+//
+
+namespace {
+constexpr int ZIP_ENTRY_YEAR = 1980; // first year a DOS date can hold
+constexpr int ZIP_ENTRY_HOUR = 12;   // midday keeps DST switches away from the date
+constexpr int TM_YEAR_OFFSET = 1900;
+
+// miniz turns the entry time back into a DOS date with localtime, so building it from local calendar fields with
+// mktime gives the same stored date on every machine and in every timezone
+auto getFixedEntryTime() -> MZ_TIME_T {
+  tm EntryTime{};
+  EntryTime.tm_year = ZIP_ENTRY_YEAR - TM_YEAR_OFFSET;
+  EntryTime.tm_mday = 1;
+  EntryTime.tm_hour = ZIP_ENTRY_HOUR;
+  EntryTime.tm_isdst = -1;
+  return mktime(&EntryTime);
+}
+} // namespace
+
+ZipOutputSink::ZipOutputSink(filesystem::path ZipPath) : ZipPath(std::move(ZipPath)), EntryTime(getFixedEntryTime()) {
+  // Check if file already exists and delete
+  if (filesystem::exists(this->ZipPath)) {
+    spdlog::info(L"Deleting existing output Zip file: {}", this->ZipPath.wstring());
+    filesystem::remove(this->ZipPath);
+  }
+
+  // initialize file
+  const string ZipPathString = wstrToStr(this->ZipPath.wstring());
+  if (mz_zip_writer_init_file(&Zip, ZipPathString.c_str(), 0) == 0) {
+    throw runtime_error("Error creating Zip file: " + ZipPathString);
+  }
+
+  Open = true;
+}
+
+ZipOutputSink::~ZipOutputSink() {
+  if (Open) {
+    mz_zip_writer_end(&Zip);
+  }
+}
+
+auto ZipOutputSink::write(const ParallaxGenOutputFile &File) -> bool {
+  if (!Open) {
+    return false;
+  }
+
+  const string ZipFilePath = wstrToStr(File.RelPath.wstring());
+
+  if (!File.DeflatedBytes.empty()) {
+    // add precompressed file to Zip
+    return mz_zip_writer_add_mem_ex_v2(&Zip, ZipFilePath.c_str(), File.DeflatedBytes.data(),
+                                       File.DeflatedBytes.size(), nullptr, 0,
+                                       MZ_DEFAULT_LEVEL | MZ_ZIP_FLAG_COMPRESSED_DATA, File.Bytes.size(), File.CRC32,
+                                       &EntryTime, nullptr, 0, nullptr, 0) != 0;
+  }
+
+  // add file to Zip, every entry gets the same time so identical runs give identical archives
+  return mz_zip_writer_add_mem_ex_v2(&Zip, ZipFilePath.c_str(), File.Bytes.data(), File.Bytes.size(), nullptr, 0,
+                                     MZ_NO_COMPRESSION, 0, 0, &EntryTime, nullptr, 0, nullptr, 0) != 0;
+}
+
+auto ZipOutputSink::finalize() -> bool {
+  if (!Open) {
+    return false;
+  }
+
+  const bool Success = mz_zip_writer_finalize_archive(&Zip) != 0;
+  mz_zip_writer_end(&Zip);
+  Open = false;
+
+  if (!Success) {
+    spdlog::critical(L"Error finalizing Zip archive: {}", ZipPath.wstring());
+  }
+
+  return Success;
+}
+
+//
+// MemoryOutputSink
+//
+
+auto MemoryOutputSink::write(const ParallaxGenOutputFile &File) -> bool {
+  Files[File.RelPath] = File.Bytes;
+  return true;
+}
+
+auto MemoryOutputSink::getFiles() const -> const map<filesystem::path, vector<std::byte>> & { return Files; }
+
+//
+// ParallaxGenOutput
+//
+
+ParallaxGenOutput::ParallaxGenOutput(vector<unique_ptr<ParallaxGenOutputSink>> Sinks, const int &CompressionLevel,
+                                     const size_t &QueueSize)
+    : Sinks(std::move(Sinks)), CompressionLevel(CompressionLevel), Queue(QueueSize) {
+  Writer = thread([this] {
+    while (auto File = Queue.pop()) {
+      for (auto &Sink : this->Sinks) {
+        if (!Sink->write(*File)) {
+          spdlog::error(L"Unable to write output file: {}", File->RelPath.wstring());
+          NumFailed++;
+        }
+      }
+    }
+  });
+}
+
+ParallaxGenOutput::~ParallaxGenOutput() { finish(); }
+
+auto ParallaxGenOutput::makeFile(filesystem::path RelPath, vector<std::byte> Bytes) const -> ParallaxGenOutputFile {
+  ParallaxGenOutputFile File;
+  File.RelPath = std::move(RelPath);
+  File.Bytes = std::move(Bytes);
+  const auto *RawBytes = reinterpret_cast<const unsigned char *>(File.Bytes.data()); // NOLINT
+  File.CRC32 = static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, RawBytes, File.Bytes.size()));
+
+  if (CompressionLevel <= 0 || File.Bytes.empty()) {
+    return File;
+  }
+
+  // Raw deflate stream (negative window bits) as stored in zip entries
+  const auto CompFlags = tdefl_create_comp_flags_from_zip_params(CompressionLevel, -MZ_DEFAULT_WINDOW_BITS,
+                                                                  MZ_DEFAULT_STRATEGY);
+  size_t DeflatedSize = 0;
+  void *Deflated = tdefl_compress_mem_to_heap(File.Bytes.data(), File.Bytes.size(), &DeflatedSize,
+                                              static_cast<int>(CompFlags));
+  if (Deflated == nullptr) {
+    spdlog::warn(L"Unable to compress output file, storing it uncompressed: {}", File.RelPath.wstring());
+    return File;
+  }
+
+  // Only keep the deflated data if it actually saves space
+  if (DeflatedSize < File.Bytes.size()) {
+    const auto *DeflatedStart = static_cast<const std::byte *>(Deflated);
+    File.DeflatedBytes.assign(DeflatedStart, DeflatedStart + DeflatedSize);
+  }
+  mz_free(Deflated);
+
+  return File;
+}
+
+void ParallaxGenOutput::addFile(ParallaxGenOutputFile File) {
+  if (!Queue.push(std::move(File))) {
+    spdlog::error("Output file added after output was finished");
+  }
+}
+
+void ParallaxGenOutput::addFile(filesystem::path RelPath, vector<std::byte> Bytes) {
+  addFile(makeFile(std::move(RelPath), std::move(Bytes)));
+}
+
+auto ParallaxGenOutput::finish() -> bool {
+  if (Finished) {
+    return NumFailed == 0;
+  }
+
+  Finished = true;
+
+  // Drain queued files
+  Queue.close();
+  if (Writer.joinable()) {
+    Writer.join();
+  }
+
+  for (auto &Sink : Sinks) {
+    if (!Sink->finalize()) {
+      NumFailed++;
+    }
+  }
+
+  return NumFailed == 0;
+}
@@ -0,0 +1,243 @@
+#include "ParallaxGenScheduler.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+using namespace std;
+
+namespace {
+// Scheduler and deque of the worker running on this thread, if any
+thread_local const ParallaxGenScheduler *CurrentScheduler = nullptr;
+thread_local size_t CurrentWorker = 0;
+// Tasks the calling thread is running, more than one when it helps out while waiting on a nested group
+thread_local size_t TaskDepth = 0;
+} // namespace
+
+//
+// ParallaxGenScheduler
+//
+
+ParallaxGenScheduler::ParallaxGenScheduler(const size_t &NumThreads) {
+  const size_t NumWorkers = NumThreads > 0 ? NumThreads : max<size_t>(1, thread::hardware_concurrency());
+
+  for (size_t I = 0; I <= NumWorkers; I++) {
+    Queues.push_back(make_unique<WorkerQueue>());
+  }
+
+  for (size_t I = 0; I < NumWorkers; I++) {
+    Workers.emplace_back([this, I] { workerLoop(I); });
+  }
+}
+
+ParallaxGenScheduler::~ParallaxGenScheduler() {
+  {
+    const lock_guard<mutex> Lock(WakeMutex);
+    Stopping = true;
+  }
+  WakeUp.notify_all();
+
+  for (auto &Worker : Workers) {
+    if (Worker.joinable()) {
+      Worker.join();
+    }
+  }
+}
+
+void ParallaxGenScheduler::setNumThreads(const size_t &NumThreads) { ConfiguredThreads = NumThreads; }
+
+auto ParallaxGenScheduler::get() -> ParallaxGenScheduler & {
+  static ParallaxGenScheduler Scheduler(ConfiguredThreads);
+  return Scheduler;
+}
+
+auto ParallaxGenScheduler::getQueueIndex() const -> size_t {
+  return CurrentScheduler == this ? CurrentWorker : Queues.size() - 1;
+}
+
+void ParallaxGenScheduler::submit(Task NewTask, const ParallaxGenTaskGroup *Group) {
+  // Counted before it is queued, a thread can pop the task right after the push and the count must not drop below 0
+  {
+    const lock_guard<mutex> Lock(WakeMutex);
+    NumQueued++;
+  }
+
+  auto &Queue = *Queues[getQueueIndex()];
+  {
+    const lock_guard<mutex> Lock(Queue.QueueMutex);
+    Queue.Tasks.push_back({std::move(NewTask), Group});
+  }
+  WakeUp.notify_one();
+}
+
+auto ParallaxGenScheduler::popTask(const size_t &QueueIndex, Task &Out) -> bool {
+  // Own deque from the back
+  {
+    auto &Own = *Queues[QueueIndex];
+    const lock_guard<mutex> Lock(Own.QueueMutex);
+    if (!Own.Tasks.empty()) {
+      Out = std::move(Own.Tasks.back().Function);
+      Own.Tasks.pop_back();
+      NumQueued--;
+      return true;
+    }
+  }
+
+  // Steal the oldest task of another deque, starting with the outside queue so submitted work starts in order
+  const size_t NumQueues = Queues.size();
+  for (size_t Offset = 0; Offset < NumQueues; Offset++) {
+    const size_t VictimIndex = (NumQueues - 1 + Offset) % NumQueues;
+    if (VictimIndex == QueueIndex) {
+      continue;
+    }
+
+    auto &Victim = *Queues[VictimIndex];
+    const lock_guard<mutex> Lock(Victim.QueueMutex);
+    if (!Victim.Tasks.empty()) {
+      Out = std::move(Victim.Tasks.front().Function);
+      Victim.Tasks.pop_front();
+      NumQueued--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+auto ParallaxGenScheduler::popGroupTask(const size_t &QueueIndex, const ParallaxGenTaskGroup *Group, Task &Out)
+    -> bool {
+  const size_t NumQueues = Queues.size();
+  for (size_t Offset = 0; Offset < NumQueues; Offset++) {
+    auto &Queue = *Queues[(QueueIndex + Offset) % NumQueues];
+    const lock_guard<mutex> Lock(Queue.QueueMutex);
+
+    const auto It = find_if(Queue.Tasks.rbegin(), Queue.Tasks.rend(),
+                            [Group](const QueuedTask &Queued) { return Queued.Group == Group; });
+    if (It != Queue.Tasks.rend()) {
+      Out = std::move(It->Function);
+      Queue.Tasks.erase(next(It).base());
+      NumQueued--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ParallaxGenScheduler::runTask(Task &CurTask) {
+  TaskDepth++;
+  CurTask();
+  TaskDepth--;
+}
+
+auto ParallaxGenScheduler::runPendingTask(const ParallaxGenTaskGroup *Group) -> bool {
+  Task NextTask;
+  const bool Found =
+      Group != nullptr ? popGroupTask(getQueueIndex(), Group, NextTask) : popTask(getQueueIndex(), NextTask);
+  if (!Found) {
+    return false;
+  }
+
+  runTask(NextTask);
+  return true;
+}
+
+auto ParallaxGenScheduler::isRunningTask() -> bool { return TaskDepth > 0; }
+
+void ParallaxGenScheduler::workerLoop(const size_t &WorkerIndex) {
+  CurrentScheduler = this;
+  CurrentWorker = WorkerIndex;
+
+  while (true) {
+    Task NextTask;
+    if (popTask(WorkerIndex, NextTask)) {
+      runTask(NextTask);
+      continue;
+    }
+
+    unique_lock<mutex> Lock(WakeMutex);
+    WakeUp.wait(Lock, [this] { return Stopping || NumQueued > 0; });
+    if (Stopping && NumQueued == 0) {
+      return;
+    }
+  }
+}
+
+//
+// ParallaxGenTaskGroup
+//
+
+ParallaxGenTaskGroup::ParallaxGenTaskGroup(ParallaxGenScheduler &Scheduler) : Scheduler(Scheduler) {}
+
+ParallaxGenTaskGroup::~ParallaxGenTaskGroup() { waitAll(); }
+
+void ParallaxGenTaskGroup::run(function<void()> Function) {
+  // Counted before it is queued, a waiter that finds nothing to run sleeps until a task is queued or all are done
+  {
+    const lock_guard<mutex> Lock(DoneMutex);
+    NumPending++;
+    NumQueued++;
+  }
+  Done.notify_all();
+
+  Scheduler.submit([this, Function = std::move(Function)]() {
+    {
+      const lock_guard<mutex> Lock(DoneMutex);
+      NumQueued--;
+    }
+
+    exception_ptr Exception;
+    if (!Cancelled) {
+      try {
+        Function();
+      } catch (...) {
+        Exception = current_exception();
+        Cancelled = true;
+      }
+    }
+
+    // The group may be destroyed as soon as NumPending hits 0, nothing touches it after the lock is released
+    const lock_guard<mutex> Lock(DoneMutex);
+    if (Exception && !FirstException) {
+      FirstException = Exception;
+    }
+    if (--NumPending == 0) {
+      Done.notify_all();
+    }
+  }, this);
+}
+
+void ParallaxGenTaskGroup::waitAll() {
+  while (true) {
+    {
+      const lock_guard<mutex> Lock(DoneMutex);
+      if (NumPending == 0) {
+        return;
+      }
+    }
+
+    // Help out instead of blocking a thread, this is what makes nested groups safe. Inside a task only with tasks of
+    // this group, anything else could block on what the waiting task holds
+    if (Scheduler.runPendingTask(ParallaxGenScheduler::isRunningTask() ? this : nullptr)) {
+      continue;
+    }
+
+    // Tasks of this group that are still queued can be run here, anything else is left to the workers
+    unique_lock<mutex> Lock(DoneMutex);
+    Done.wait(Lock, [this] { return NumPending == 0 || NumQueued > 0; });
+  }
+}
+
+void ParallaxGenTaskGroup::wait() {
+  waitAll();
+
+  exception_ptr Exception;
+  {
+    const lock_guard<mutex> Lock(DoneMutex);
+    Exception = std::exchange(FirstException, nullptr);
+  }
+
+  if (Exception) {
+    rethrow_exception(Exception);
+  }
+}
@@ -2,6 +2,8 @@
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+
 using namespace std;
 
 ParallaxGenTask::ParallaxGenTask(string TaskName, const size_t &TotalJobs, const int &ProgressPrintModulo)
@@ -24,6 +26,7 @@ void ParallaxGenTask::completeJob(const PGResult &Result) {
 
 void ParallaxGenTask::initJobStatus() {
   LastPerc = 0;
+  StartTime = chrono::steady_clock::now();
 
   spdlog::info("{} Starting...", TaskName);
 }
@@ -67,6 +70,43 @@ auto ParallaxGenTask::getCompletedJobs() -> size_t {
   return Sum;
 }
 
+void ParallaxGenTask::addWorkerBusyTime(const chrono::nanoseconds &BusyTime) {
+  const lock_guard<mutex> Lock(WorkerBusyTimeMutex);
+  WorkerBusyTime[this_thread::get_id()] += BusyTime;
+}
+
+void ParallaxGenTask::printWorkerIdleSummary(const size_t &NumWorkers) {
+  const lock_guard<mutex> Lock(WorkerBusyTimeMutex);
+
+  const auto WallTime = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - StartTime);
+  if (NumWorkers == 0 || WallTime.count() == 0) {
+    return;
+  }
+
+  // The thread waiting on the task (the one printing this) runs jobs too, it counts as one more worker when it did
+  const size_t NumThreads =
+      max(NumWorkers + (WorkerBusyTime.contains(this_thread::get_id()) ? 1 : 0), WorkerBusyTime.size());
+
+  // Workers that never picked up a job were idle the whole time
+  chrono::milliseconds TotalIdle = WallTime * static_cast<int64_t>(NumThreads - WorkerBusyTime.size());
+  chrono::milliseconds MaxIdle = WorkerBusyTime.size() < NumThreads ? WallTime : chrono::milliseconds(0);
+
+  size_t WorkerIndex = 0;
+  for (const auto &[ThreadID, BusyTime] : WorkerBusyTime) {
+    const auto Idle = max(chrono::milliseconds(0), WallTime - chrono::duration_cast<chrono::milliseconds>(BusyTime));
+    TotalIdle += Idle;
+    MaxIdle = max(MaxIdle, Idle);
+
+    spdlog::debug("{} Worker {}: busy {}ms, idle {}ms", TaskName, WorkerIndex++,
+                  chrono::duration_cast<chrono::milliseconds>(BusyTime).count(), Idle.count());
+  }
+
+  const auto IdlePerc = TotalIdle.count() * FULL_PERCENTAGE / (WallTime.count() * static_cast<int64_t>(NumThreads));
+  spdlog::info("{} Worker Idle Time: {} workers over {}ms, average idle {}ms [{}%], max idle {}ms", TaskName,
+               NumThreads, WallTime.count(), TotalIdle.count() / static_cast<int64_t>(NumThreads), IdlePerc,
+               MaxIdle.count());
+}
+
 void ParallaxGenTask::updatePGResult(PGResult &Result, const PGResult &CurrentResult, const PGResult &Threshold) {
   if (CurrentResult > Result) {
     if (CurrentResult > Threshold) {
@@ -0,0 +1,169 @@
+#include "ParallaxGenTextureDB.hpp"
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <exception>
+#include <span>
+#include <system_error>
+
+#include "ParallaxGenUtil.hpp"
+
+using namespace std;
+using namespace ParallaxGenUtil;
+
+// Bump when the layout changes or complex material detection decides differently
+constexpr int TEXTURE_DB_VERSION = 3;
+
+ParallaxGenTextureDB::ParallaxGenTextureDB(filesystem::path DBPath) : DBPath(std::move(DBPath)) {}
+
+auto ParallaxGenTextureDB::getDBName() -> filesystem::path { return "ParallaxGen_TextureDB.json"; }
+
+auto ParallaxGenTextureDB::load() -> vector<pair<filesystem::path, Record>> {
+  const auto DBBytes = getFileBytes(DBPath);
+  if (DBBytes.empty()) {
+    return {};
+  }
+
+  vector<pair<filesystem::path, Record>> Loaded;
+  try {
+    const auto DB = nlohmann::json::parse(reinterpret_cast<const char *>(DBBytes.data()), // NOLINT
+                                          reinterpret_cast<const char *>(DBBytes.data() + DBBytes.size())); // NOLINT
+    if (!DB.contains("version") || DB["version"].get<int>() != TEXTURE_DB_VERSION) {
+      spdlog::info("Texture database is from another version, textures will be analyzed again");
+      return {};
+    }
+
+    Loaded.reserve(DB["textures"].size());
+    for (const auto &[Key, Entry] : DB["textures"].items()) {
+      Record Existing;
+      Existing.TextureSource.Archive = strToWstr(Entry["archive"].get<string>());
+      Existing.TextureSource.Size = Entry["size"].get<uint64_t>();
+      Existing.TextureSource.ModifiedTime = Entry["mtime"].get<int64_t>();
+
+      if (Entry.contains("meta")) {
+        const auto &Meta = Entry["meta"];
+        DDSUtil::DDSHeaderInfo Info;
+        Info.Width = Meta[0].get<size_t>();
+        Info.Height = Meta[1].get<size_t>();
+        Info.Depth = Meta[2].get<size_t>();
+        Info.ArraySize = Meta[3].get<size_t>();
+        Info.MipLevels = Meta[4].get<size_t>();
+        Info.MiscFlags = Meta[5].get<uint32_t>();
+        Info.MiscFlags2 = Meta[6].get<uint32_t>();
+        Info.Format = Meta[7].get<uint32_t>();
+        Info.Dimension = Meta[8].get<uint32_t>();
+        Existing.Metadata = Info;
+      }
+
+      if (Entry.contains("cm")) {
+        Existing.IsComplexMaterial = Entry["cm"].get<bool>();
+      }
+
+      Loaded.emplace_back(strToWstr(Key), std::move(Existing));
+    }
+  } catch (const exception &E) {
+    spdlog::warn("Unable to read texture database, textures will be analyzed again: {}", E.what());
+    return {};
+  }
+
+  return Loaded;
+}
+
+void ParallaxGenTextureDB::save() {
+  const lock_guard<mutex> Lock(RecordsMutex);
+  if (!Changed) {
+    return;
+  }
+
+  // Sorted so unchanged load orders write the same file
+  vector<pair<string, const Record *>> SortedRecords;
+  SortedRecords.reserve(Records.size());
+  for (const auto &[Path, Existing] : Records) {
+    SortedRecords.emplace_back(wstrToStr(Path), &Existing);
+  }
+  sort(SortedRecords.begin(), SortedRecords.end(), [](const auto &A, const auto &B) { return A.first < B.first; });
+
+  string Out = R"({"version":)" + to_string(TEXTURE_DB_VERSION) + R"(,"textures":{)";
+  for (size_t I = 0; I < SortedRecords.size(); I++) {
+    const auto &[Path, Existing] = SortedRecords[I];
+    if (I > 0) {
+      Out += ',';
+    }
+
+    Out += nlohmann::json(Path).dump() + R"(:{"archive":)" +
+           nlohmann::json(wstrToStr(Existing->TextureSource.Archive)).dump() +
+           R"(,"size":)" + to_string(Existing->TextureSource.Size) + R"(,"mtime":)" +
+           to_string(Existing->TextureSource.ModifiedTime);
+
+    if (Existing->Metadata.has_value()) {
+      const auto &Info = *Existing->Metadata;
+      Out += R"(,"meta":[)" + to_string(Info.Width) + ',' + to_string(Info.Height) + ',' + to_string(Info.Depth) + ',' +
+             to_string(Info.ArraySize) + ',' + to_string(Info.MipLevels) + ',' + to_string(Info.MiscFlags) + ',' +
+             to_string(Info.MiscFlags2) + ',' + to_string(Info.Format) + ',' + to_string(Info.Dimension) + ']';
+    }
+
+    if (Existing->IsComplexMaterial.has_value()) {
+      Out += R"(,"cm":)" + string(*Existing->IsComplexMaterial ? "true" : "false");
+    }
+
+    Out += '}';
+  }
+  Out += "}}\n";
+
+  // Written next to the old database first so an interrupted save keeps the old one
+  filesystem::path TempPath = DBPath;
+  TempPath += ".tmp";
+  if (!writeFileBytes(TempPath, as_bytes(span(Out)))) {
+    spdlog::warn(L"Unable to write texture database {}", TempPath.wstring());
+    return;
+  }
+
+  error_code EC;
+  filesystem::rename(TempPath, DBPath, EC);
+  if (EC) {
+    spdlog::warn(L"Unable to replace texture database {}: {}", DBPath.wstring(), strToWstr(EC.message()));
+    return;
+  }
+
+  Changed = false;
+}
+
+void ParallaxGenTextureDB::restore(const filesystem::path &Path, Record Existing) {
+  const lock_guard<mutex> Lock(RecordsMutex);
+  Records.insert_or_assign(Path.wstring(), std::move(Existing));
+}
+
+auto ParallaxGenTextureDB::find(const filesystem::path &Path) -> optional<Record> {
+  const lock_guard<mutex> Lock(RecordsMutex);
+  const auto It = Records.find(Path.wstring());
+  if (It == Records.end()) {
+    return nullopt;
+  }
+
+  return It->second;
+}
+
+void ParallaxGenTextureDB::setMetadata(const filesystem::path &Path, const Source &TextureSource,
+                                       const DDSUtil::DDSHeaderInfo &Metadata) {
+  const lock_guard<mutex> Lock(RecordsMutex);
+  getRecord(Path, TextureSource).Metadata = Metadata;
+  Changed = true;
+}
+
+void ParallaxGenTextureDB::setComplexMaterial(const filesystem::path &Path, const Source &TextureSource,
+                                              const bool &IsComplexMaterial) {
+  const lock_guard<mutex> Lock(RecordsMutex);
+  getRecord(Path, TextureSource).IsComplexMaterial = IsComplexMaterial;
+  Changed = true;
+}
+
+auto ParallaxGenTextureDB::getRecord(const filesystem::path &Path, const Source &TextureSource) -> Record & {
+  auto &Existing = Records[Path.wstring()];
+  if (!(Existing.TextureSource == TextureSource)) {
+    Existing = {TextureSource, nullopt, nullopt};
+  }
+
+  return Existing;
+}
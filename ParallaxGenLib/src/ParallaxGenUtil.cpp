@@ -6,6 +6,7 @@
 #include <boost/algorithm/string.hpp>
 #include <fstream>
 #include <iostream>
+#include <utility>
 #include <wingdi.h>
 #include <winnt.h>
 
@@ -40,19 +41,20 @@ auto wstrToStr(const wstring &WStr) -> string {
   return Str;
 }
 
-auto getFileBytes(const filesystem::path &FilePath) -> vector<std::byte> {
+auto getFileBytes(const filesystem::path &FilePath, const size_t &MaxBytes) -> vector<std::byte> {
   ifstream InputFile(FilePath, ios::binary | ios::ate);
   if (!InputFile.is_open()) {
     // Unable to open file
     return {};
   }
 
-  auto Length = InputFile.tellg();
-  if (Length == -1) {
+  const auto FileLength = InputFile.tellg();
+  if (FileLength == -1) {
     // Unable to find length
     InputFile.close();
     return {};
   }
+  const auto Length = static_cast<streamsize>(min<size_t>(static_cast<size_t>(FileLength), MaxBytes));
 
   InputFile.seekg(0, ios::beg);
 
@@ -65,4 +67,70 @@ auto getFileBytes(const filesystem::path &FilePath) -> vector<std::byte> {
   return Buffer;
 }
 
+auto writeFileBytes(const filesystem::path &FilePath, span<const std::byte> Bytes) -> bool {
+  error_code EC;
+  filesystem::create_directories(FilePath.parent_path(), EC);
+
+  ofstream OutputFile(FilePath, ios::binary | ios::trunc);
+  if (!OutputFile.is_open()) {
+    // Unable to open file
+    return false;
+  }
+
+  OutputFile.write(reinterpret_cast<const char *>(Bytes.data()), static_cast<streamsize>(Bytes.size())); // NOLINT
+  OutputFile.close();
+
+  return !OutputFile.fail();
+}
+
+MappedFile::MappedFile(const filesystem::path &FilePath) {
+  HANDLE File = CreateFileW(FilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (File == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  LARGE_INTEGER FileSize{};
+  if (GetFileSizeEx(File, &FileSize) == 0 || FileSize.QuadPart == 0) {
+    // Empty files can't be mapped
+    CloseHandle(File);
+    return;
+  }
+
+  // The view keeps the mapping alive, neither handle is needed after this
+  HANDLE Mapping = CreateFileMappingW(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(File);
+  if (Mapping == nullptr) {
+    return;
+  }
+
+  View = static_cast<const std::byte *>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+  CloseHandle(Mapping);
+  if (View != nullptr) {
+    Size = static_cast<size_t>(FileSize.QuadPart);
+  }
+}
+
+MappedFile::MappedFile(MappedFile &&Other) noexcept
+    : View(std::exchange(Other.View, nullptr)), Size(std::exchange(Other.Size, 0)) {}
+
+auto MappedFile::operator=(MappedFile &&Other) noexcept -> MappedFile & {
+  if (this != &Other) {
+    if (View != nullptr) {
+      UnmapViewOfFile(View);
+    }
+
+    View = std::exchange(Other.View, nullptr);
+    Size = std::exchange(Other.Size, 0);
+  }
+
+  return *this;
+}
+
+MappedFile::~MappedFile() {
+  if (View != nullptr) {
+    UnmapViewOfFile(View);
+  }
+}
+
 } // namespace ParallaxGenUtil
@@ -29,22 +29,19 @@ PatcherComplexMaterial::PatcherComplexMaterial(filesystem::path NIFPath, nifly::
                                                ParallaxGenD3D *PGD3D)
     : NIFPath(std::move(NIFPath)), NIF(NIF), PGC(PGC), PGD3D(PGD3D) {}
 
-auto PatcherComplexMaterial::shouldApply(NiShape *NIFShape, const array<wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots,
-                                         bool &EnableResult, bool &EnableDynCubemaps,
+auto PatcherComplexMaterial::shouldApply(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
+                                         bool &EnableDynCubemaps,
                                          wstring &MatchedPath) const -> ParallaxGenTask::PGResult {
 
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
   // Prep
-  const auto ShapeBlockID = NIF->GetBlockID(NIFShape);
+  const auto ShapeBlockID = View.ShapeBlockID;
   spdlog::trace(L"NIF: {} | Shape: {} | CM | Starting checking", NIFPath.wstring(), ShapeBlockID);
 
-  auto *NIFShader = NIF->GetShader(NIFShape);
-  auto *const NIFShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(NIFShader);
-
   EnableResult = true; // Start with default true
 
-  if (shouldApplySlots(SearchPrefixes, OldSlots, MatchedPath, EnableDynCubemaps, NIFPath.wstring())) {
+  if (shouldApplySlots(View.SearchPrefixes, View.Slots, MatchedPath, EnableDynCubemaps, NIFPath.wstring())) {
     spdlog::trace(L"NIF: {} | Shape: {} | CM | Found CM map: {}", NIFPath.wstring(), ShapeBlockID, MatchedPath);
   } else {
     spdlog::trace(L"NIF: {} | Shape: {} | CM | No CM map found", NIFPath.wstring(), ShapeBlockID);
@@ -53,7 +50,7 @@ auto PatcherComplexMaterial::shouldApply(NiShape *NIFShape, const array<wstring,
   }
 
   // Get NIFShader type
-  auto NIFShaderType = static_cast<nifly::BSLightingShaderPropertyShaderType>(NIFShader->GetShaderType());
+  const auto NIFShaderType = View.ShaderType;
   if (NIFShaderType != BSLSP_DEFAULT && NIFShaderType != BSLSP_ENVMAP && NIFShaderType != BSLSP_PARALLAX &&
       (NIFShaderType != BSLSP_MULTILAYERPARALLAX || !DisableMLP)) {
     spdlog::trace(L"NIF: {} | Shape: {} | CM | Shape Rejected: Incorrect NIFShader type", NIFPath.wstring(),
@@ -63,7 +60,7 @@ auto PatcherComplexMaterial::shouldApply(NiShape *NIFShape, const array<wstring,
   }
 
   // Check if TruePBR is enabled
-  if (NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF2_UNUSED01)) {
+  if (View.hasFlag(SLSF2_UNUSED01)) {
     spdlog::trace(L"NIF: {} | Shape: {} | CM | Shape Rejected: TruePBR enabled", NIFPath.wstring(), ShapeBlockID);
     EnableResult = false;
     return Result;
@@ -71,9 +68,8 @@ auto PatcherComplexMaterial::shouldApply(NiShape *NIFShape, const array<wstring,
 
   // check to make sure there are textures defined in slot 3 or 8
   if (NIFShaderType != BSLSP_MULTILAYERPARALLAX &&
-      (!NIFUtil::getTextureSlot(NIF, NIFShape, NIFUtil::TextureSlots::GLOW).empty() ||
-       !NIFUtil::getTextureSlot(NIF, NIFShape, NIFUtil::TextureSlots::TINT).empty() ||
-       !NIFUtil::getTextureSlot(NIF, NIFShape, NIFUtil::TextureSlots::BACKLIGHT).empty())) {
+      (!View.getSlot(NIFUtil::TextureSlots::GLOW).empty() || !View.getSlot(NIFUtil::TextureSlots::TINT).empty() ||
+       !View.getSlot(NIFUtil::TextureSlots::BACKLIGHT).empty())) {
     spdlog::trace(L"NIF: {} | Shape: {} | CM | Shape Rejected: Texture defined in slots 3,7,or 8", NIFPath.wstring(),
                   ShapeBlockID);
     EnableResult = false;
@@ -81,12 +77,11 @@ auto PatcherComplexMaterial::shouldApply(NiShape *NIFShape, const array<wstring,
   }
 
   // verify that maps match each other
-  string DiffuseMap;
-  NIF->GetTextureSlot(NIFShape, DiffuseMap, 0);
+  const auto &DiffuseMap = View.getSlot(NIFUtil::TextureSlots::DIFFUSE);
   if (DiffuseMap.empty() || !PGD->isFile(DiffuseMap)) {
     // no Diffuse map
     spdlog::trace(L"NIF: {} | Shape: {} | CM | Shape Rejected: Diffuse map missing: {}", NIFPath.wstring(),
-                  ShapeBlockID, strToWstr(DiffuseMap));
+                  ShapeBlockID, DiffuseMap);
     EnableResult = false;
     return Result;
   }
@@ -130,14 +125,16 @@ auto PatcherComplexMaterial::shouldApplySlots(const std::array<std::wstring, NUM
   return !MatchedPath.empty();
 }
 
-auto PatcherComplexMaterial::applyPatch(NiShape *NIFShape, const wstring &MatchedPath, const bool &ApplyDynCubemaps,
+auto PatcherComplexMaterial::applyPatch(const NIFUtil::ShapeMaterialView &View, const wstring &MatchedPath,
+                                        const bool &ApplyDynCubemaps,
                                         bool &NIFModified) const -> ParallaxGenTask::PGResult {
   // enable complex material on shape
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
   // Prep
-  auto *NIFShader = NIF->GetShader(NIFShape);
-  auto *const NIFShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(NIFShader);
+  auto *NIFShape = View.Shape;
+  auto *NIFShader = View.Shader;
+  auto *const NIFShaderBSLSP = View.ShaderBSLSP;
 
   // Remove texture slots if disabling MLP
   if (DisableMLP && NIFShaderBSLSP->GetShaderType() == BSLSP_MULTILAYERPARALLAX) {
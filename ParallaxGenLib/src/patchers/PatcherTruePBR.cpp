@@ -114,13 +114,10 @@ void PatcherTruePBR::loadPatcherBuffers(const std::vector<std::filesystem::path>
   }
 }
 
-auto PatcherTruePBR::shouldApply(nifly::NiShape *NIFShape, const array<wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes,
-                                 bool &EnableResult,
+auto PatcherTruePBR::shouldApply(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
                                  map<size_t, tuple<nlohmann::json, wstring>> &TruePBRData) -> ParallaxGenTask::PGResult {
   // Prep
-  auto *NIFShader = NIF->GetShader(NIFShape);
-  auto *const NIFShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(NIFShader);
-  auto TextureSetBlockID = NIFShaderBSLSP->TextureSetRef()->index;
+  const auto TextureSetBlockID = View.TextureSetBlockID;
 
   // Check if we already matched this texture set
   if (MatchedTextureSets.find(TextureSetBlockID) != MatchedTextureSets.end()) {
@@ -129,12 +126,12 @@ auto PatcherTruePBR::shouldApply(nifly::NiShape *NIFShape, const array<wstring,
     return ParallaxGenTask::PGResult::SUCCESS;
   }
 
-  const auto ShapeBlockID = NIF->GetBlockID(NIFShape);
+  const auto ShapeBlockID = View.ShapeBlockID;
   wstring LogPrefix = L"NIF: " + NIFPath.wstring() + L" | Shape: " + to_wstring(ShapeBlockID) + L" | ";
 
   spdlog::trace(L"{}PBR | Starting checking", LogPrefix);
 
-  if (shouldApplySlots(LogPrefix, SearchPrefixes, NIFPath, TruePBRData)) {
+  if (shouldApplySlots(LogPrefix, View.SearchPrefixes, NIFPath, TruePBRData)) {
     EnableResult = true;
     spdlog::trace(L"{}PBR | {} PBR Configs matched", TruePBRData.size(), LogPrefix);
 
@@ -311,15 +308,17 @@ auto PatcherTruePBR::insertTruePBRData(const wstring &LogPrefix,
   TruePBRData.insert({Cfg, {CurCfg, MatchedPath}});
 }
 
-auto PatcherTruePBR::applyPatch(NiShape *NIFShape, nlohmann::json &TruePBRData, const std::wstring &MatchedPath,
-                                bool &NIFModified, bool &ShapeDeleted) const -> ParallaxGenTask::PGResult {
+auto PatcherTruePBR::applyPatch(const NIFUtil::ShapeMaterialView &View, nlohmann::json &TruePBRData,
+                                const std::wstring &MatchedPath, bool &NIFModified,
+                                bool &ShapeDeleted) const -> ParallaxGenTask::PGResult {
 
   // enable TruePBR on shape
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
   // Prep
-  auto *NIFShader = NIF->GetShader(NIFShape);
-  auto *const NIFShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(NIFShader);
+  auto *NIFShape = View.Shape;
+  auto *NIFShader = View.Shader;
+  auto *const NIFShaderBSLSP = View.ShaderBSLSP;
   const bool EnableTruePBR = !MatchedPath.empty();
   const bool EnableEnvMapping = TruePBRData.contains("env_mapping") && TruePBRData["env_mapping"] && !EnableTruePBR;
 
@@ -32,29 +32,48 @@ PatcherVanillaParallax::PatcherVanillaParallax(filesystem::path NIFPath, nifly::
   }
 }
 
-auto PatcherVanillaParallax::shouldApply(NiShape *NIFShape, const array<wstring, NUM_TEXTURE_SLOTS> &SearchPrefixes, const std::array<std::wstring, NUM_TEXTURE_SLOTS> &OldSlots,
-                                         bool &EnableResult, wstring &MatchedPath) const -> ParallaxGenTask::PGResult {
-  auto Result = ParallaxGenTask::PGResult::SUCCESS;
+auto PatcherVanillaParallax::shouldApply(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
+                                         wstring &MatchedPath) const -> ParallaxGenTask::PGResult {
+  spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Starting checking", NIFPath.wstring(), View.ShapeBlockID);
 
-  // Prep
-  const auto ShapeBlockID = NIF->GetBlockID(NIFShape);
-  spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Starting checking", NIFPath.wstring(), ShapeBlockID);
+  if (!shouldApplyShape(View)) {
+    EnableResult = false;
+    return ParallaxGenTask::PGResult::SUCCESS;
+  }
 
-  auto *NIFShader = NIF->GetShader(NIFShape);
-  auto *const NIFShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(NIFShader);
+  return shouldApplyMaterial(View, EnableResult, MatchedPath);
+}
 
-  EnableResult = true; // Start with default true
+auto PatcherVanillaParallax::shouldApplyShape(const NIFUtil::ShapeMaterialView &View) const -> bool {
+  const auto ShapeBlockID = View.ShapeBlockID;
 
   // Check if nif has attached havok (Results in crashes for vanilla Parallax)
   if (HasAttachedHavok) {
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Attached havok animations", NIFPath.wstring(),
                   ShapeBlockID);
-    EnableResult = false;
-    return Result;
+    return false;
+  }
+
+  // ignore skinned meshes, these don't support Parallax
+  if (View.Shape->HasSkinInstance() || View.Shape->IsSkinned()) {
+    spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Skinned mesh", NIFPath.wstring(), ShapeBlockID);
+    return false;
   }
 
+  return true;
+}
+
+auto PatcherVanillaParallax::shouldApplyMaterial(const NIFUtil::ShapeMaterialView &View, bool &EnableResult,
+                                                 wstring &MatchedPath) const -> ParallaxGenTask::PGResult {
+  auto Result = ParallaxGenTask::PGResult::SUCCESS;
+
+  // Prep
+  const auto ShapeBlockID = View.ShapeBlockID;
+
+  EnableResult = true; // Start with default true
+
   // Check if parallax map exists
-  if (shouldApplySlots(SearchPrefixes, OldSlots, MatchedPath)) {
+  if (shouldApplySlots(View.SearchPrefixes, View.Slots, MatchedPath)) {
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Found parallax map: {}", NIFPath.wstring(), ShapeBlockID, MatchedPath);
   } else {
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | No parallax map found", NIFPath.wstring(), ShapeBlockID);
@@ -62,16 +81,8 @@ auto PatcherVanillaParallax::shouldApply(NiShape *NIFShape, const array<wstring,
     return Result;
   }
 
-  // ignore skinned meshes, these don't support Parallax
-  if (NIFShape->HasSkinInstance() || NIFShape->IsSkinned()) {
-    spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Skinned mesh", NIFPath.wstring(), ShapeBlockID);
-    EnableResult = false;
-    return Result;
-  }
-
   // Check for shader type
-  auto NIFShaderType = static_cast<nifly::BSLightingShaderPropertyShaderType>(NIFShader->GetShaderType());
-  if (NIFShaderType != BSLSP_DEFAULT && NIFShaderType != BSLSP_PARALLAX) {
+  if (View.ShaderType != BSLSP_DEFAULT && View.ShaderType != BSLSP_PARALLAX) {
     // don't overwrite existing NIFShaders
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Incorrect NIFShader type", NIFPath.wstring(),
                   ShapeBlockID);
@@ -80,24 +91,21 @@ auto PatcherVanillaParallax::shouldApply(NiShape *NIFShape, const array<wstring,
   }
 
   // Check if TruePBR is enabled
-  if (NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF2_UNUSED01)) {
+  if (View.hasFlag(SLSF2_UNUSED01)) {
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: TruePBR enabled", NIFPath.wstring(), ShapeBlockID);
     EnableResult = false;
     return Result;
   }
 
   // decals don't work with regular Parallax
-  if (NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF1_DECAL) ||
-      NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF1_DYNAMIC_DECAL)) {
+  if (View.hasFlag(SLSF1_DECAL) || View.hasFlag(SLSF1_DYNAMIC_DECAL)) {
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Decal shape", NIFPath.wstring(), ShapeBlockID);
     EnableResult = false;
     return Result;
   }
 
   // Mesh lighting doesn't work with regular Parallax
-  if (NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF2_SOFT_LIGHTING) ||
-      NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF2_RIM_LIGHTING) ||
-      NIFUtil::hasShaderFlag(NIFShaderBSLSP, SLSF2_BACK_LIGHTING)) {
+  if (View.hasFlag(SLSF2_SOFT_LIGHTING) || View.hasFlag(SLSF2_RIM_LIGHTING) || View.hasFlag(SLSF2_BACK_LIGHTING)) {
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Lighting on shape", NIFPath.wstring(),
                   ShapeBlockID);
     EnableResult = false;
@@ -105,12 +113,11 @@ auto PatcherVanillaParallax::shouldApply(NiShape *NIFShape, const array<wstring,
   }
 
   // verify that maps match each other (this is somewhat expense so it happens last)
-  string DiffuseMap;
-  NIF->GetTextureSlot(NIFShape, DiffuseMap, static_cast<unsigned int>(NIFUtil::TextureSlots::DIFFUSE));
+  const auto &DiffuseMap = View.getSlot(NIFUtil::TextureSlots::DIFFUSE);
   if (DiffuseMap.empty() || !PGD->isFile(DiffuseMap)) {
     // no Diffuse map
     spdlog::trace(L"NIF: {} | Shape: {} | Parallax | Shape Rejected: Diffuse map missing: {}", NIFPath.wstring(),
-                  ShapeBlockID, strToWstr(DiffuseMap));
+                  ShapeBlockID, DiffuseMap);
     EnableResult = false;
     return Result;
   }
@@ -149,14 +156,15 @@ auto PatcherVanillaParallax::shouldApplySlots(const std::array<std::wstring, NUM
   return !MatchedPath.empty();
 }
 
-auto PatcherVanillaParallax::applyPatch(NiShape *NIFShape, const wstring &MatchedPath,
+auto PatcherVanillaParallax::applyPatch(const NIFUtil::ShapeMaterialView &View, const wstring &MatchedPath,
                                         bool &NIFModified) -> ParallaxGenTask::PGResult {
   // enable Parallax on shape
   auto Result = ParallaxGenTask::PGResult::SUCCESS;
 
   // Prep
-  auto *NIFShader = NIF->GetShader(NIFShape);
-  auto *const NIFShaderBSLSP = dynamic_cast<BSLightingShaderProperty *>(NIFShader);
+  auto *NIFShape = View.Shape;
+  auto *NIFShader = View.Shader;
+  auto *const NIFShaderBSLSP = View.ShaderBSLSP;
 
   // Set NIFShader type to Parallax
   NIFUtil::setShaderType(NIFShader, BSLSP_PARALLAX, NIFModified);
@@ -0,0 +1,73 @@
+#include "DDSUtil.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace {
+void writeU32(vector<std::byte> &Bytes, const size_t &Offset, const uint32_t &Value) {
+  memcpy(Bytes.data() + Offset, &Value, sizeof(Value));
+}
+
+// Header of a 2D texture with the given pixel format, DX10 header bytes are left zero
+auto makeHeader(const uint32_t &Width, const uint32_t &Height, const uint32_t &Mips, const uint32_t &FourCC)
+    -> vector<std::byte> {
+  vector<std::byte> Bytes(DDSUtil::DDS_HEADER_MAX_SIZE, std::byte{0});
+  writeU32(Bytes, 0, 0x20534444); // "DDS "
+  writeU32(Bytes, 4, 124);
+  writeU32(Bytes, 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000); // caps, height, width, pixel format, mip count
+  writeU32(Bytes, 12, Height);
+  writeU32(Bytes, 16, Width);
+  writeU32(Bytes, 28, Mips);
+  writeU32(Bytes, 76, 32);
+  writeU32(Bytes, 80, 0x4); // FourCC
+  writeU32(Bytes, 84, FourCC);
+  return Bytes;
+}
+
+constexpr uint32_t FOURCC_DXT5 = 0x35545844;
+constexpr uint32_t FOURCC_DX10 = 0x30315844;
+} // namespace
+
+TEST(DDSUtilTests, TestParseLegacyHeader) {
+  const auto Header = makeHeader(512, 256, 10, FOURCC_DXT5);
+  const auto Info = DDSUtil::parseDDSHeader({Header.data(), 128});
+  ASSERT_TRUE(Info.has_value());
+  EXPECT_EQ(Info->Width, 512);
+  EXPECT_EQ(Info->Height, 256);
+  EXPECT_EQ(Info->MipLevels, 10);
+  EXPECT_EQ(Info->Format, 77); // BC3_UNORM
+  EXPECT_EQ(Info->Dimension, 3);
+  EXPECT_EQ(Info->ArraySize, 1);
+  EXPECT_EQ(Info->MiscFlags2, 0);
+
+  // More mips than the size allows, truncated header, unknown FourCC
+  EXPECT_FALSE(DDSUtil::parseDDSHeader(makeHeader(512, 256, 11, FOURCC_DXT5)).has_value());
+  EXPECT_FALSE(DDSUtil::parseDDSHeader({Header.data(), 100}).has_value());
+  EXPECT_FALSE(DDSUtil::parseDDSHeader(makeHeader(512, 256, 1, 0x31545858)).has_value());
+}
+
+TEST(DDSUtilTests, TestParseDX10Header) {
+  auto Header = makeHeader(64, 64, 0, FOURCC_DX10);
+  writeU32(Header, 128, 98); // BC7_UNORM
+  writeU32(Header, 132, 3);  // 2D
+  writeU32(Header, 136, 0x4); // cube
+  writeU32(Header, 140, 1);
+  writeU32(Header, 144, 3); // opaque alpha
+
+  const auto Info = DDSUtil::parseDDSHeader(Header);
+  ASSERT_TRUE(Info.has_value());
+  EXPECT_EQ(Info->Format, 98);
+  EXPECT_EQ(Info->MipLevels, 1);
+  EXPECT_EQ(Info->ArraySize, 6);
+  EXPECT_EQ(Info->MiscFlags, 0x4);
+  EXPECT_EQ(Info->MiscFlags2, 3);
+
+  // DX10 header cut off
+  EXPECT_FALSE(DDSUtil::parseDDSHeader({Header.data(), 140}).has_value());
+}
@@ -0,0 +1,152 @@
+#include "NIFUtil.hpp"
+#include "ParallaxGenUtil.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+// Compares NIF loading through the span streambuf with the boost::iostreams stream it replaced. Needs a folder of
+// meshes, for example extracted vanilla BSAs, in PARALLAXGEN_NIF_CORPUS and is skipped otherwise. Timings are printed,
+// both loaders have to agree on every mesh. Built as ParallaxGenLibBenchmarks, apart from the unit tests.
+
+namespace {
+constexpr int BENCHMARK_PASSES = 3;
+
+auto getCorpusDir() -> filesystem::path {
+  const char *CorpusDir = getenv("PARALLAXGEN_NIF_CORPUS"); // NOLINT(concurrency-mt-unsafe)
+  return CorpusDir == nullptr ? filesystem::path() : filesystem::path(CorpusDir);
+}
+
+auto getCorpusMeshes(const filesystem::path &CorpusDir) -> vector<filesystem::path> {
+  vector<filesystem::path> Meshes;
+  for (const auto &Entry : filesystem::recursive_directory_iterator(CorpusDir)) {
+    if (Entry.is_regular_file() && boost::iequals(Entry.path().extension().wstring(), L".nif")) {
+      Meshes.push_back(Entry.path());
+    }
+  }
+
+  return Meshes;
+}
+
+// What loadNIFFromBytes did before it read from spans, a boost::iostreams stream over the bytes
+auto loadNIFWithIOStreams(span<const std::byte> NIFBytes) -> nifly::NifFile {
+  boost::iostreams::array_source NIFArraySource(reinterpret_cast<const char *>(NIFBytes.data()), // NOLINT
+                                                NIFBytes.size());
+  boost::iostreams::stream<boost::iostreams::array_source> NIFStream(NIFArraySource);
+
+  nifly::NifFile NIF;
+  NIF.Load(NIFStream);
+  return NIF;
+}
+
+// Loads every mesh BENCHMARK_PASSES times, returns the fastest pass in milliseconds
+auto timeLoader(const vector<vector<std::byte>> &Corpus,
+                const function<nifly::NifFile(span<const std::byte>)> &Loader) -> double {
+  double Fastest = 0;
+  for (int Pass = 0; Pass < BENCHMARK_PASSES; Pass++) {
+    const auto Start = chrono::steady_clock::now();
+    for (const auto &NIFBytes : Corpus) {
+      try {
+        Loader(NIFBytes);
+      } catch (...) {
+        // invalid meshes cost the same on both loaders
+      }
+    }
+
+    const double Elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - Start).count();
+    Fastest = Pass == 0 ? Elapsed : min(Fastest, Elapsed);
+  }
+
+  return Fastest;
+}
+} // namespace
+
+TEST(NIFUtilBenchmarks, TestSpanLoaderMatchesIOStreamsLoader) {
+  const auto CorpusDir = getCorpusDir();
+  if (CorpusDir.empty()) {
+    GTEST_SKIP() << "PARALLAXGEN_NIF_CORPUS is not set";
+  }
+
+  // Read up front so only parsing is timed
+  vector<vector<std::byte>> Corpus;
+  size_t CorpusBytes = 0;
+  for (const auto &Mesh : getCorpusMeshes(CorpusDir)) {
+    Corpus.push_back(ParallaxGenUtil::getFileBytes(Mesh));
+    CorpusBytes += Corpus.back().size();
+  }
+  ASSERT_FALSE(Corpus.empty()) << "No meshes in " << CorpusDir.string();
+
+  for (const auto &NIFBytes : Corpus) {
+    if (NIFBytes.empty()) {
+      continue;
+    }
+
+    auto Expected = loadNIFWithIOStreams(NIFBytes);
+    if (!Expected.IsValid()) {
+      EXPECT_THROW(NIFUtil::loadNIFFromBytes(span<const std::byte>(NIFBytes)), runtime_error);
+      continue;
+    }
+
+    auto Actual = NIFUtil::loadNIFFromBytes(span<const std::byte>(NIFBytes));
+    EXPECT_EQ(Actual.GetHeader().GetNumBlocks(), Expected.GetHeader().GetNumBlocks());
+    EXPECT_EQ(Actual.GetShapes().size(), Expected.GetShapes().size());
+  }
+
+  const double IOStreamsTime = timeLoader(Corpus, loadNIFWithIOStreams);
+  const double SpanTime = timeLoader(Corpus, [](span<const std::byte> NIFBytes) {
+    return NIFUtil::loadNIFFromBytes(NIFBytes);
+  });
+
+  cout << "Loaded " << Corpus.size() << " meshes (" << CorpusBytes / 1024 / 1024 << " MiB), fastest of "
+       << BENCHMARK_PASSES << " passes: boost::iostreams " << IOStreamsTime << "ms, span " << SpanTime << "ms\n";
+}
+
+TEST(NIFUtilBenchmarks, TestMappedLoaderMatchesReadLoader) {
+  const auto CorpusDir = getCorpusDir();
+  if (CorpusDir.empty()) {
+    GTEST_SKIP() << "PARALLAXGEN_NIF_CORPUS is not set";
+  }
+
+  double ReadTime = 0;
+  double MappedTime = 0;
+  for (const auto &Mesh : getCorpusMeshes(CorpusDir)) {
+    auto Start = chrono::steady_clock::now();
+    const auto NIFBytes = ParallaxGenUtil::getFileBytes(Mesh);
+    if (NIFBytes.empty()) {
+      continue;
+    }
+
+    nifly::NifFile Expected;
+    try {
+      Expected = NIFUtil::loadNIFFromBytes(NIFBytes);
+    } catch (const runtime_error &) {
+      continue;
+    }
+    ReadTime += chrono::duration<double, milli>(chrono::steady_clock::now() - Start).count();
+
+    Start = chrono::steady_clock::now();
+    const ParallaxGenUtil::MappedFile Mapping(Mesh);
+    ASSERT_TRUE(Mapping.isOpen()) << Mesh.string();
+    auto Actual = NIFUtil::loadNIFFromBytes(Mapping.getBytes());
+    MappedTime += chrono::duration<double, milli>(chrono::steady_clock::now() - Start).count();
+
+    EXPECT_EQ(Actual.GetHeader().GetNumBlocks(), Expected.GetHeader().GetNumBlocks()) << Mesh.string();
+  }
+
+  // The second loader finds the files in the OS cache, so this compares copying against mapping, not disk reads
+  cout << "Read and parse " << ReadTime << "ms, map and parse " << MappedTime << "ms\n";
+}
@@ -0,0 +1,85 @@
+#include "NIFUtil.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+#include <tuple>
+
+using namespace std;
+
+namespace {
+// Reference implementation: longest case-insensitive suffix match against the suffix map
+auto getTexBaseReference(const filesystem::path &Path) -> tuple<wstring, NIFUtil::TextureSlots, NIFUtil::TextureType> {
+  const auto PathStr = (Path.parent_path() / Path.stem()).wstring();
+
+  size_t BestLength = 0;
+  tuple<NIFUtil::TextureSlots, NIFUtil::TextureType> BestMatch = {NIFUtil::TextureSlots::UNKNOWN,
+                                                                  NIFUtil::TextureType::UNKNOWN};
+  for (const auto &[Suffix, Defaults] : NIFUtil::getTexSuffixMap()) {
+    if (Suffix.size() > BestLength && boost::iends_with(PathStr, Suffix)) {
+      BestLength = Suffix.size();
+      BestMatch = Defaults;
+    }
+  }
+
+  return {PathStr.substr(0, PathStr.size() - BestLength), get<0>(BestMatch), get<1>(BestMatch)};
+}
+} // namespace
+
+TEST(NIFUtilTests, TestTexSuffixMatchesReference) {
+  const vector<wstring> Paths = {L"textures\\architecture\\whiterun\\wrwoodplank01_n.dds",
+                                 L"textures\\architecture\\whiterun\\WRWoodPlank01_N.DDS",
+                                 L"textures\\clutter\\metal_envmask.dds",
+                                 L"textures\\clutter\\metal_em.dds",
+                                 L"textures\\clutter\\metal_m.dds",
+                                 L"textures\\clutter\\metalmask.dds",
+                                 L"textures\\actors\\character\\male\\malebody_1_msn.dds",
+                                 L"textures\\actors\\character\\male\\malebody_1_sk.dds",
+                                 L"textures\\landscape\\dirt01_p.dds",
+                                 L"textures\\pbr\\landscape\\dirt01_rmaos.dds",
+                                 L"textures\\plants\\leaf_bl.dds",
+                                 L"textures\\plants\\leaf_b.dds",
+                                 L"textures\\plants\\leafbl.dds",
+                                 L"textures\\plants\\leaf.dds",
+                                 L"textures\\with.dot\\leaf_d.dds",
+                                 L"textures\\noextension_n",
+                                 L"textures/architecture/whiterun/wrwoodplank01_n.dds",
+                                 L"textures\\clutter/metal_envmask.dds",
+                                 L"textures//plants\\\\leaf_b.dds",
+                                 L"/leaf_n.dds",
+                                 L"_n.dds",
+                                 L""};
+
+  for (const auto &Path : Paths) {
+    const auto [ExpectedBase, ExpectedSlot, ExpectedType] = getTexBaseReference(Path);
+
+    EXPECT_EQ(NIFUtil::getTexBase(Path), ExpectedBase) << filesystem::path(Path).string();
+    EXPECT_EQ(NIFUtil::getTexBase(filesystem::path(Path)), ExpectedBase) << filesystem::path(Path).string();
+    EXPECT_EQ(NIFUtil::getDefaultsFromSuffix(wstring_view(Path)), make_tuple(ExpectedSlot, ExpectedType))
+        << filesystem::path(Path).string();
+  }
+}
+
+TEST(NIFUtilTests, TestTexSuffixLongestMatch) {
+  // "_envmask" also ends with "mask", the longer suffix has to win
+  const auto Match = NIFUtil::matchTexSuffix(L"textures\\clutter\\metal_envmask.dds");
+  EXPECT_EQ(Match.BaseLength, wstring(L"textures\\clutter\\metal").size());
+  EXPECT_EQ(Match.Slot, NIFUtil::TextureSlots::ENVMASK);
+  EXPECT_EQ(Match.Type, NIFUtil::TextureType::ENVIRONMENTMASK);
+}
+
+TEST(NIFUtilTests, TestTexBaseSeparator) {
+  // The filename is joined with the preferred separator like parent_path() / stem() did, keys from PBR JSON match
+  // fields with '/' have to equal the ones built from the texture list
+  const wstring Expected =
+      wstring(L"textures\\pbr") + static_cast<wchar_t>(filesystem::path::preferred_separator) + L"dirt01";
+  EXPECT_EQ(NIFUtil::getTexBase(L"textures\\pbr/dirt01_rmaos.dds"), Expected);
+  EXPECT_EQ(NIFUtil::getTexBase(wstring(L"textures\\pbr/dirt01_rmaos.dds")), Expected);
+
+  EXPECT_EQ(NIFUtil::getDefaultsFromSuffix(L"textures/pbr/dirt01_rmaos.dds"),
+            make_tuple(NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::RMAOS));
+  EXPECT_EQ(NIFUtil::getDefaultsFromSuffix(wstring(L"textures/pbr/dirt01_rmaos.dds")),
+            make_tuple(NIFUtil::TextureSlots::ENVMASK, NIFUtil::TextureType::RMAOS));
+}
@@ -0,0 +1,200 @@
+#include "ParallaxGenCPUCompute.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct TestImage {
+  vector<uint8_t> Pixels;
+  ParallaxGenCPUCompute::RGBAImage View;
+};
+
+// Red and alpha vary per pixel, green and blue are noise the kernels have to ignore
+auto makeImage(const size_t &Width, const size_t &Height, const uint8_t &Seed) -> TestImage {
+  TestImage Image;
+  const size_t RowPitch = (Width * 4) + 8; // padded rows
+  Image.Pixels.resize(RowPitch * Height);
+  for (size_t I = 0; I < Image.Pixels.size(); I++) {
+    Image.Pixels[I] = static_cast<uint8_t>((I * 37) + Seed);
+  }
+
+  Image.View = {Image.Pixels.data(), Width, Height, RowPitch};
+  return Image;
+}
+
+// Box filtered mip of half the size, the way mips are usually generated
+auto makeHalfMip(const TestImage &Source) -> TestImage {
+  TestImage Mip;
+  const size_t Width = Source.View.Width / 2;
+  const size_t Height = Source.View.Height / 2;
+  Mip.Pixels.resize(Width * 4 * Height);
+  for (size_t Y = 0; Y < Height; Y++) {
+    for (size_t X = 0; X < Width; X++) {
+      for (size_t Channel = 0; Channel < 4; Channel++) {
+        const auto SourcePixel = [&Source, &Channel](const size_t &SX, const size_t &SY) -> unsigned {
+          return Source.Pixels[(SY * Source.View.RowPitch) + (SX * 4) + Channel];
+        };
+        const unsigned Sum = SourcePixel(X * 2, Y * 2) + SourcePixel((X * 2) + 1, Y * 2) +
+                             SourcePixel(X * 2, (Y * 2) + 1) + SourcePixel((X * 2) + 1, (Y * 2) + 1);
+        Mip.Pixels[(Y * Width * 4) + (X * 4) + Channel] = static_cast<uint8_t>((Sum + 2) / 4);
+      }
+    }
+  }
+
+  Mip.View = {Mip.Pixels.data(), Width, Height, Width * 4};
+  return Mip;
+}
+
+// MergeToComplexMaterial.hlsl for a single pixel
+auto shaderMerge(const ParallaxGenCPUCompute::RGBAImage *Map, const uint8_t &Default, const size_t &Width,
+                 const size_t &Height, const size_t &X, const size_t &Y) -> uint8_t {
+  if (Map == nullptr) {
+    return Default;
+  }
+
+  const float ScaleX = static_cast<float>(Map->Width) / static_cast<float>(Width);
+  const float ScaleY = static_cast<float>(Map->Height) / static_cast<float>(Height);
+  const auto SourceX = static_cast<size_t>(floor(ScaleX * static_cast<float>(X)));
+  const auto SourceY = static_cast<size_t>(floor(ScaleY * static_cast<float>(Y)));
+  return Map->Pixels[(SourceY * Map->RowPitch) + (SourceX * 4)];
+}
+
+void expectMatchesShader(const ParallaxGenCPUCompute::RGBAImage *EnvMap,
+                         const ParallaxGenCPUCompute::RGBAImage *ParallaxMap, const size_t &Width,
+                         const size_t &Height) {
+  const size_t RowPitch = Width * 4;
+  vector<uint8_t> Output(RowPitch * Height, 1);
+  const auto Range =
+      ParallaxGenCPUCompute::mergeToComplexMaterial(EnvMap, ParallaxMap, Width, Height, Output.data(), RowPitch);
+
+  ParallaxGenCPUCompute::MinMaxValues Expected;
+  for (size_t Y = 0; Y < Height; Y++) {
+    for (size_t X = 0; X < Width; X++) {
+      const uint8_t Env = shaderMerge(EnvMap, 0, Width, Height, X, Y);
+      const uint8_t Parallax = shaderMerge(ParallaxMap, 255, Width, Height, X, Y);
+      const uint8_t *Pixel = &Output[(Y * RowPitch) + (X * 4)];
+      ASSERT_EQ(Pixel[0], Env) << X << ", " << Y;
+      ASSERT_EQ(Pixel[1], 0) << X << ", " << Y;
+      ASSERT_EQ(Pixel[2], 0) << X << ", " << Y;
+      ASSERT_EQ(Pixel[3], Parallax) << X << ", " << Y;
+
+      Expected.MinEnvValue = min<uint32_t>(Expected.MinEnvValue, Env);
+      Expected.MaxEnvValue = max<uint32_t>(Expected.MaxEnvValue, Env);
+      Expected.MinParallaxValue = min<uint32_t>(Expected.MinParallaxValue, Parallax);
+      Expected.MaxParallaxValue = max<uint32_t>(Expected.MaxParallaxValue, Parallax);
+    }
+  }
+
+  EXPECT_EQ(Range.MinEnvValue, Expected.MinEnvValue);
+  EXPECT_EQ(Range.MaxEnvValue, Expected.MaxEnvValue);
+  EXPECT_EQ(Range.MinParallaxValue, Expected.MinParallaxValue);
+  EXPECT_EQ(Range.MaxParallaxValue, Expected.MaxParallaxValue);
+}
+} // namespace
+
+TEST(ParallaxGenCPUComputeTests, TestMergeMatchesShaderForSameSizeMaps) {
+  // Odd width so the vector loop leaves a remainder
+  const auto EnvMap = makeImage(67, 70, 3);
+  const auto ParallaxMap = makeImage(67, 70, 101);
+
+  expectMatchesShader(&EnvMap.View, &ParallaxMap.View, 67, 70);
+  expectMatchesShader(&EnvMap.View, nullptr, 67, 70);
+  expectMatchesShader(nullptr, &ParallaxMap.View, 67, 70);
+}
+
+TEST(ParallaxGenCPUComputeTests, TestMergeMatchesShaderForScaledMaps) {
+  const auto EnvMap = makeImage(32, 24, 5);
+  const auto ParallaxMap = makeImage(128, 96, 11);
+
+  expectMatchesShader(&EnvMap.View, &ParallaxMap.View, 128, 96);
+}
+
+TEST(ParallaxGenCPUComputeTests, TestCountAlphaValues) {
+  auto Image = makeImage(45, 33, 0);
+
+  size_t Expected = 0;
+  for (size_t Y = 0; Y < Image.View.Height; Y++) {
+    for (size_t X = 0; X < Image.View.Width; X++) {
+      uint8_t &Alpha = Image.Pixels[(Y * Image.View.RowPitch) + (X * 4) + 3];
+      Alpha = (X + Y) % 3 == 0 ? 255 : static_cast<uint8_t>(X);
+      Expected += Alpha == 255 ? 1 : 0;
+    }
+  }
+
+  EXPECT_EQ(ParallaxGenCPUCompute::countAlphaValues(Image.View), Expected);
+
+  // Early exit has to give the same answer right at the threshold
+  EXPECT_TRUE(ParallaxGenCPUCompute::countAlphaValuesExceeds(Image.View, Expected - 1));
+  EXPECT_FALSE(ParallaxGenCPUCompute::countAlphaValuesExceeds(Image.View, Expected));
+  EXPECT_TRUE(ParallaxGenCPUCompute::countAlphaValuesExceeds(Image.View, 0));
+  EXPECT_FALSE(ParallaxGenCPUCompute::countAlphaValuesExceeds(Image.View, Image.View.Width * Image.View.Height));
+}
+
+TEST(ParallaxGenCPUComputeTests, TestCountAlphaValuesOnBlocks) {
+  using BlockFormat = ParallaxGenCPUCompute::BlockFormat;
+
+  // BC2: all alpha nibbles 15, on a 6x3 image the second block is only partly inside
+  vector<uint8_t> BC2(32, 0);
+  fill_n(BC2.begin(), 8, 0xFF);
+  fill_n(BC2.begin() + 16, 8, 0xFF);
+  EXPECT_EQ(ParallaxGenCPUCompute::countAlphaValuesBC(BC2.data(), 6, 3, 32, BlockFormat::BC2), 12 + 6);
+
+  // BC3: 255/254 interpolates to 254.86 for index 2 which rounds to 255, 200/100 never reaches it
+  vector<uint8_t> BC3(32, 0);
+  BC3[0] = 255;
+  BC3[1] = 254;
+  const uint64_t AllIndex2 = 2 * 0x249249249249ULL;
+  for (size_t I = 0; I < 6; I++) {
+    BC3[2 + I] = static_cast<uint8_t>(AllIndex2 >> (I * 8));
+  }
+  BC3[16] = 200;
+  BC3[17] = 100;
+  EXPECT_EQ(ParallaxGenCPUCompute::countAlphaValuesBC(BC3.data(), 8, 4, 32, BlockFormat::BC3), 16);
+  EXPECT_TRUE(ParallaxGenCPUCompute::countAlphaValuesBCExceeds(BC3.data(), 8, 4, 32, BlockFormat::BC3, 15));
+  EXPECT_FALSE(ParallaxGenCPUCompute::countAlphaValuesBCExceeds(BC3.data(), 8, 4, 32, BlockFormat::BC3, 16));
+
+  // BC7: mode 0 has no alpha, mode 6 with every alpha bit set is opaque, the reserved mode is transparent
+  vector<uint8_t> BC7(48, 0xFF);
+  BC7[0] = 0x01;
+  BC7[16] = 0xC0;
+  fill_n(BC7.begin() + 32, 16, 0);
+  EXPECT_EQ(ParallaxGenCPUCompute::countAlphaValuesBC(BC7.data(), 12, 4, 48, BlockFormat::BC7), 32);
+}
+
+TEST(ParallaxGenCPUComputeTests, TestLowerMipOnlyShowsOpaque) {
+  // 70% of the pixels have full alpha, scattered so that hardly any texel of a lower mip averages only opaque pixels
+  auto Top = makeImage(256, 256, 0);
+  size_t TopCount = 0;
+  for (size_t Y = 0; Y < Top.View.Height; Y++) {
+    for (size_t X = 0; X < Top.View.Width; X++) {
+      uint8_t &Alpha = Top.Pixels[(Y * Top.View.RowPitch) + (X * 4) + 3];
+      Alpha = ((X * 7) + (Y * 13)) % 10 < 7 ? 255 : 0;
+      TopCount += Alpha == 255 ? 1 : 0;
+    }
+  }
+  const size_t TopPixels = Top.View.Width * Top.View.Height;
+  EXPECT_EQ(ParallaxGenCPUCompute::countAlphaValues(Top.View), TopCount);
+  EXPECT_GT(TopCount, TopPixels * 2 / 3);
+
+  // Smallest mip with 64x64 pixels, where the estimate starts
+  const auto Mip = makeHalfMip(makeHalfMip(Top));
+  const size_t MipPixels = Mip.View.Width * Mip.View.Height;
+  const size_t MipCount = ParallaxGenCPUCompute::countAlphaValues(Mip.View);
+  EXPECT_LT(MipCount, MipPixels / 20);
+
+  // The low count must not decide the texture isn't mostly opaque, only the exact count can
+  EXPECT_FALSE(ParallaxGenCPUCompute::showsOpaqueFraction(MipCount, MipPixels, 0.5, 0.15));
+  EXPECT_TRUE(ParallaxGenCPUCompute::countAlphaValuesExceeds(Top.View, TopPixels / 2));
+
+  // A clearly opaque estimate does decide, a lower mip can't make opaque pixels up
+  EXPECT_TRUE(ParallaxGenCPUCompute::showsOpaqueFraction(MipPixels * 7 / 10, MipPixels, 0.5, 0.15));
+  EXPECT_FALSE(ParallaxGenCPUCompute::showsOpaqueFraction(MipPixels * 6 / 10, MipPixels, 0.5, 0.15));
+  EXPECT_FALSE(ParallaxGenCPUCompute::showsOpaqueFraction(0, 0, 0.5, 0.15));
+}
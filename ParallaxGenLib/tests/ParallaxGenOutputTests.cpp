@@ -0,0 +1,98 @@
+#include "ParallaxGenOutput.hpp"
+#include "ParallaxGenUtil.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// Every entry is stamped with 1980-01-01 12:00, as DOS time and date
+constexpr uint16_t FIXED_DOS_TIME = 12 << 11;
+constexpr uint16_t FIXED_DOS_DATE = ((1980 - 1980) << 9) | (1 << 5) | 1;
+
+constexpr uint32_t END_OF_CENTRAL_DIR_SIG = 0x06054B50;
+constexpr uint32_t CENTRAL_DIR_HEADER_SIG = 0x02014B50;
+constexpr size_t END_OF_CENTRAL_DIR_SIZE = 22;
+constexpr size_t CENTRAL_DIR_HEADER_SIZE = 46;
+
+// Writes the same two files, one deflated and one stored, into a zip
+void writeTestZip(const filesystem::path &ZipPath) {
+  vector<unique_ptr<ParallaxGenOutputSink>> Sinks;
+  Sinks.push_back(make_unique<ZipOutputSink>(ZipPath));
+  ParallaxGenOutput Output(std::move(Sinks), MZ_DEFAULT_LEVEL);
+
+  Output.addFile("meshes/test/compressible.nif", vector<std::byte>(4096, std::byte{0x2A}));
+  Output.addFile("meshes/test/tiny.nif", vector<std::byte>{std::byte{1}, std::byte{2}, std::byte{3}});
+  ASSERT_TRUE(Output.finish());
+}
+
+auto readLE16(span<const std::byte> Bytes, const size_t &Offset) -> uint16_t {
+  return static_cast<uint16_t>(static_cast<uint16_t>(Bytes[Offset]) | static_cast<uint16_t>(Bytes[Offset + 1]) << 8);
+}
+
+auto readLE32(span<const std::byte> Bytes, const size_t &Offset) -> uint32_t {
+  return static_cast<uint32_t>(readLE16(Bytes, Offset)) | static_cast<uint32_t>(readLE16(Bytes, Offset + 2)) << 16;
+}
+
+struct DOSTimestamp {
+  uint16_t Time;
+  uint16_t Date;
+};
+
+// Modification time and date of every central directory entry, read from the raw bytes. The writer adds no archive
+// comment, so the end of central directory record is the last 22 bytes
+auto readCentralDirTimes(span<const std::byte> ZipBytes) -> vector<DOSTimestamp> {
+  vector<DOSTimestamp> Times;
+  if (ZipBytes.size() < END_OF_CENTRAL_DIR_SIZE) {
+    ADD_FAILURE() << "Zip is too short";
+    return Times;
+  }
+
+  const size_t EndOffset = ZipBytes.size() - END_OF_CENTRAL_DIR_SIZE;
+  if (readLE32(ZipBytes, EndOffset) != END_OF_CENTRAL_DIR_SIG) {
+    ADD_FAILURE() << "No end of central directory record";
+    return Times;
+  }
+
+  const uint16_t NumEntries = readLE16(ZipBytes, EndOffset + 10);
+  size_t Offset = readLE32(ZipBytes, EndOffset + 16);
+  for (uint16_t I = 0; I < NumEntries; I++) {
+    if (Offset + CENTRAL_DIR_HEADER_SIZE > EndOffset || readLE32(ZipBytes, Offset) != CENTRAL_DIR_HEADER_SIG) {
+      ADD_FAILURE() << "Central directory entry " << I << " is invalid";
+      return Times;
+    }
+
+    Times.push_back({readLE16(ZipBytes, Offset + 12), readLE16(ZipBytes, Offset + 14)});
+    Offset += CENTRAL_DIR_HEADER_SIZE + readLE16(ZipBytes, Offset + 28) + readLE16(ZipBytes, Offset + 30) +
+              readLE16(ZipBytes, Offset + 32);
+  }
+
+  return Times;
+}
+} // namespace
+
+TEST(ParallaxGenOutputTests, TestZipEntriesHaveFixedTime) {
+  const auto TestDir = filesystem::temp_directory_path() / "ParallaxGenOutputTests";
+  filesystem::remove_all(TestDir);
+  filesystem::create_directories(TestDir);
+
+  writeTestZip(TestDir / "test.zip");
+  const auto ZipBytes = ParallaxGenUtil::getFileBytes(TestDir / "test.zip");
+  ASSERT_FALSE(ZipBytes.empty());
+
+  const auto Times = readCentralDirTimes(ZipBytes);
+  ASSERT_EQ(Times.size(), 2);
+  for (const auto &Time : Times) {
+    EXPECT_EQ(Time.Time, FIXED_DOS_TIME);
+    EXPECT_EQ(Time.Date, FIXED_DOS_DATE);
+  }
+
+  filesystem::remove_all(TestDir);
+}
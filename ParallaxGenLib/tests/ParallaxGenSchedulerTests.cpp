@@ -0,0 +1,146 @@
+#include "ParallaxGenMemoryGovernor.hpp"
+#include "ParallaxGenScheduler.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(ParallaxGenSchedulerTests, TestParallelForVisitsEveryIndexOnce) {
+  ParallaxGenScheduler Scheduler(4);
+
+  constexpr size_t NumItems = 10000;
+  vector<atomic<int>> Visits(NumItems);
+  Scheduler.parallelFor(0, NumItems, [&Visits](const size_t &I) { Visits[I]++; });
+
+  for (size_t I = 0; I < NumItems; I++) {
+    EXPECT_EQ(Visits[I], 1) << "Index " << I;
+  }
+}
+
+TEST(ParallaxGenSchedulerTests, TestNestedParallelForDoesNotDeadlock) {
+  // Fewer threads than outer tasks, waiting tasks have to run the inner ones themselves
+  ParallaxGenScheduler Scheduler(2);
+
+  atomic<size_t> Count = 0;
+  Scheduler.parallelFor(
+      0, 16, [&](const size_t &) { Scheduler.parallelFor(0, 16, [&Count](const size_t &) { Count++; }, 1); }, 1);
+
+  EXPECT_EQ(Count, 16 * 16);
+}
+
+TEST(ParallaxGenSchedulerTests, TestTaskGroupRethrowsFirstException) {
+  ParallaxGenScheduler Scheduler(4);
+
+  ParallaxGenTaskGroup Group(Scheduler);
+  for (int I = 0; I < 64; I++) {
+    Group.run([I]() {
+      if (I == 10) {
+        throw runtime_error("task failed");
+      }
+    });
+  }
+
+  EXPECT_THROW(Group.wait(), runtime_error);
+  EXPECT_TRUE(Group.isCancelled());
+}
+
+TEST(ParallaxGenSchedulerTests, TestConcurrentSubmitFromOutsideThreads) {
+  // Outside threads share one queue that the workers drain while it is being filled
+  ParallaxGenScheduler Scheduler(4);
+
+  constexpr size_t NumSubmitters = 8;
+  constexpr size_t NumTasks = 2000;
+  atomic<size_t> Count = 0;
+
+  vector<thread> Submitters;
+  for (size_t S = 0; S < NumSubmitters; S++) {
+    Submitters.emplace_back([&Scheduler, &Count]() {
+      ParallaxGenTaskGroup Group(Scheduler);
+      for (size_t I = 0; I < NumTasks; I++) {
+        Group.run([&Count]() { Count++; });
+      }
+      Group.wait();
+    });
+  }
+  for (auto &Submitter : Submitters) {
+    Submitter.join();
+  }
+
+  EXPECT_EQ(Count, NumSubmitters * NumTasks);
+}
+
+TEST(ParallaxGenSchedulerTests, TestNestedParallelForHoldingReservationDoesNotDeadlock) {
+  // Only one outer task fits in the budget at a time. The other worker steals the long inner chunk, so the task waiting
+  // on its inner loop finds the next outer task queued meanwhile. It must not take it, that task would wait for the
+  // memory the waiting task holds
+  ParallaxGenScheduler Scheduler(2);
+  ParallaxGenMemoryGovernor Governor(100);
+
+  constexpr int NumOuter = 8;
+  atomic<size_t> Count = 0;
+  ParallaxGenTaskGroup Outer(Scheduler);
+  for (int I = 0; I < NumOuter; I++) {
+    Outer.run([&]() {
+      const auto Memory = Governor.admit(60);
+      Scheduler.parallelFor(
+          0, 2,
+          [&Count](const size_t &J) {
+            this_thread::sleep_for(chrono::milliseconds(J == 0 ? 20 : 2));
+            Count++;
+          },
+          1);
+    });
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  Outer.wait();
+
+  EXPECT_EQ(Count, NumOuter * 2);
+}
+
+TEST(ParallaxGenSchedulerTests, TestNestedWaitWakesForTasksQueuedLater) {
+  // The other worker runs the first inner task, which queues a second one and blocks until it ran. Only the task
+  // waiting on the inner group is left to run it, so that wait has to wake up when the task is queued
+  ParallaxGenScheduler Scheduler(2);
+
+  constexpr auto Timeout = chrono::seconds(5);
+  atomic<bool> SecondRan = false;
+  atomic<bool> SecondRanInTime = false;
+  atomic<bool> OuterDone = false;
+  ParallaxGenTaskGroup Outer(Scheduler);
+  Outer.run([&]() {
+    ParallaxGenTaskGroup Inner(Scheduler);
+    Inner.run([&]() {
+      // long enough for the waiting task to go to sleep
+      this_thread::sleep_for(chrono::milliseconds(20));
+      Inner.run([&SecondRan]() { SecondRan = true; });
+
+      const auto Start = chrono::steady_clock::now();
+      while (!SecondRan && chrono::steady_clock::now() - Start < Timeout) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+      }
+      SecondRanInTime = SecondRan.load();
+    });
+
+    // let the other worker steal the first task
+    this_thread::sleep_for(chrono::milliseconds(5));
+    Inner.wait();
+    OuterDone = true;
+  });
+
+  // Waiting on the outer group from here would run the second task on this thread, so only after the first one gave up
+  const auto Start = chrono::steady_clock::now();
+  while (!OuterDone && chrono::steady_clock::now() - Start < 2 * Timeout) {
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  Outer.wait();
+
+  EXPECT_TRUE(SecondRanInTime);
+  EXPECT_TRUE(OuterDone);
+}
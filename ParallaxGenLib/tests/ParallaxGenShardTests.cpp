@@ -0,0 +1,185 @@
+#include "CommonTests.hpp"
+#include "NIFUtil.hpp"
+#include "ParallaxGen.hpp"
+#include "ParallaxGenIncremental.hpp"
+#include "ParallaxGenUtil.hpp"
+
+#include <gtest/gtest.h>
+#include <miniz.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// End to end check of --shard and --merge-shards: patching in two shards and merging them has to give the same output
+// as patching in one process. Runs an installed ParallaxGen.exe from PARALLAXGEN_EXE (it needs its cfg and assets
+// folders next to it) on a generated game folder and is skipped otherwise.
+
+namespace {
+constexpr int NUM_TEST_MESHES = 12;
+constexpr uint32_t TEST_TEXTURE_SIZE = 64;
+const string COMMON_ARGS = "--autostart --no-bsa --no-plugin --no-gpu --no-texture-db -g skyrimse";
+
+auto getParallaxGenExe() -> filesystem::path {
+  const char *ExePath = getenv("PARALLAXGEN_EXE"); // NOLINT(concurrency-mt-unsafe)
+  return ExePath == nullptr ? filesystem::path() : filesystem::path(ExePath);
+}
+
+// DXT1 texture with a single black mip, only the header matters to the patchers
+auto makeDDS(const uint32_t &Width, const uint32_t &Height) -> vector<std::byte> {
+  const uint32_t DataSize = max(1U, (Width + 3) / 4) * max(1U, (Height + 3) / 4) * 8;
+
+  array<uint32_t, 32> Header{};
+  Header[0] = 0x20534444;  // "DDS "
+  Header[1] = 124;         // header size
+  Header[2] = 0x81007;     // caps, height, width, pixel format, linear size
+  Header[3] = Height;
+  Header[4] = Width;
+  Header[5] = DataSize;
+  Header[7] = 1;           // mip count
+  Header[19] = 32;         // pixel format size
+  Header[20] = 0x4;        // four CC
+  Header[21] = 0x31545844; // "DXT1"
+  Header[27] = 0x1000;     // texture
+
+  vector<std::byte> Bytes(sizeof(Header) + DataSize);
+  memcpy(Bytes.data(), Header.data(), sizeof(Header));
+  return Bytes;
+}
+
+// Single quad with a diffuse and normal map, which the vanilla parallax patcher picks up when a height map exists
+auto makeMesh(const string &TexBase) -> vector<std::byte> {
+  nifly::NifFile NIF;
+  NIF.Create(nifly::NiVersion::getSSE());
+
+  const vector<nifly::Vector3> Verts = {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}};
+  const vector<nifly::Triangle> Tris = {{0, 1, 2}, {0, 2, 3}};
+  const vector<nifly::Vector2> UVs = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  auto *Shape = NIF.CreateShapeFromData("Rock", &Verts, &Tris, &UVs);
+
+  bool Changed = false;
+  NIFUtil::setTextureSlot(&NIF, Shape, NIFUtil::TextureSlots::DIFFUSE, TexBase + ".dds", Changed);
+  NIFUtil::setTextureSlot(&NIF, Shape, NIFUtil::TextureSlots::NORMAL, TexBase + "_n.dds", Changed);
+
+  return NIFUtil::saveNIFToBytes(NIF, {});
+}
+
+// Plugins from the test environment plus meshes of which every other one has a height map
+void createGameDir(const filesystem::path &GameDir) {
+  const auto DataDir = GameDir / "Data";
+  filesystem::create_directories(DataDir);
+  filesystem::copy(PGTestEnvs::TESTENVSkyrimSE.GamePath / "data", DataDir, filesystem::copy_options::recursive);
+
+  for (int I = 0; I < NUM_TEST_MESHES; I++) {
+    const string Name = "rock" + to_string(I);
+    const string TexBase = "textures\\shardtest\\" + Name;
+
+    ParallaxGenUtil::writeFileBytes(DataDir / "meshes" / "shardtest" / (Name + ".nif"), makeMesh(TexBase));
+    ParallaxGenUtil::writeFileBytes(DataDir / "textures" / "shardtest" / (Name + ".dds"),
+                                    makeDDS(TEST_TEXTURE_SIZE, TEST_TEXTURE_SIZE));
+    ParallaxGenUtil::writeFileBytes(DataDir / "textures" / "shardtest" / (Name + "_n.dds"),
+                                    makeDDS(TEST_TEXTURE_SIZE, TEST_TEXTURE_SIZE));
+    if (I % 2 == 0) {
+      ParallaxGenUtil::writeFileBytes(DataDir / "textures" / "shardtest" / (Name + "_p.dds"),
+                                      makeDDS(TEST_TEXTURE_SIZE, TEST_TEXTURE_SIZE));
+    }
+  }
+}
+
+auto runParallaxGen(const filesystem::path &Exe, const filesystem::path &GameDir, const filesystem::path &OutputDir,
+                    const string &ExtraArgs) -> int {
+  // cmd strips the outer quotes, the inner ones survive
+  const string Command = "\"\"" + Exe.string() + "\" " + COMMON_ARGS + " -d \"" + GameDir.string() + "\" -o \"" +
+                         OutputDir.string() + "\" " + ExtraArgs + "\"";
+  return system(Command.c_str()); // NOLINT(concurrency-mt-unsafe,cert-env33-c)
+}
+
+auto readZip(const filesystem::path &ZipPath) -> map<string, vector<std::byte>> {
+  map<string, vector<std::byte>> Entries;
+
+  mz_zip_archive Zip{};
+  if (mz_zip_reader_init_file(&Zip, ZipPath.string().c_str(), 0) == 0) {
+    ADD_FAILURE() << "Unable to open " << ZipPath.string();
+    return Entries;
+  }
+
+  for (mz_uint I = 0; I < mz_zip_reader_get_num_files(&Zip); I++) {
+    mz_zip_archive_file_stat Stat;
+    if (mz_zip_reader_file_stat(&Zip, I, &Stat) == 0) {
+      ADD_FAILURE() << "Unable to read entry " << I << " of " << ZipPath.string();
+      continue;
+    }
+
+    size_t Size = 0;
+    void *Data = mz_zip_reader_extract_to_heap(&Zip, I, &Size, 0);
+    if (Data == nullptr) {
+      ADD_FAILURE() << "Unable to extract " << Stat.m_filename << " from " << ZipPath.string();
+      continue;
+    }
+
+    Entries[Stat.m_filename].assign(static_cast<const std::byte *>(Data), static_cast<const std::byte *>(Data) + Size);
+    mz_free(Data);
+  }
+
+  mz_zip_reader_end(&Zip);
+  return Entries;
+}
+
+} // namespace
+
+TEST(ParallaxGenShardTests, TestMergedShardsMatchSingleRun) {
+  const auto Exe = getParallaxGenExe();
+  if (Exe.empty()) {
+    GTEST_SKIP() << "PARALLAXGEN_EXE is not set";
+  }
+
+  const auto TestDir = filesystem::temp_directory_path() / "ParallaxGenShardTests";
+  filesystem::remove_all(TestDir);
+  const auto GameDir = TestDir / "game";
+  createGameDir(GameDir);
+
+  // Both runs keep a manifest, the merge has to produce the same one as the single run
+  ASSERT_EQ(runParallaxGen(Exe, GameDir, TestDir / "single", "--incremental"), 0);
+  ASSERT_EQ(runParallaxGen(Exe, GameDir, TestDir / "shard1", "--shard 1/2"), 0);
+  ASSERT_EQ(runParallaxGen(Exe, GameDir, TestDir / "shard2", "--shard 2/2"), 0);
+  ASSERT_EQ(runParallaxGen(Exe, GameDir, TestDir / "merged",
+                           "--incremental --merge-shards \"" + (TestDir / "shard1").string() + "\" \"" +
+                               (TestDir / "shard2").string() + "\""),
+            0);
+
+  // The merged run has to write the same archive byte for byte
+  const auto SingleZip = TestDir / "single" / ParallaxGen::getOutputZipName();
+  const auto MergedZip = TestDir / "merged" / ParallaxGen::getOutputZipName();
+  const auto SingleZipBytes = ParallaxGenUtil::getFileBytes(SingleZip);
+  ASSERT_FALSE(SingleZipBytes.empty());
+  EXPECT_TRUE(SingleZipBytes == ParallaxGenUtil::getFileBytes(MergedZip)) << "Output zips differ";
+
+  const auto SingleEntries = readZip(SingleZip);
+  const auto MergedEntries = readZip(MergedZip);
+
+  // Some meshes have to actually be patched, otherwise this compares two empty outputs
+  size_t NumMeshes = 0;
+  for (const auto &[Name, Entry] : SingleEntries) {
+    NumMeshes += Name.ends_with(".nif") ? 1 : 0;
+  }
+  EXPECT_EQ(NumMeshes, static_cast<size_t>(NUM_TEST_MESHES / 2));
+
+  // Same for the state files, compared on their own so a mismatch says which one
+  for (const auto &StateFile : {ParallaxGen::getDiffJSONName(), ParallaxGenIncremental::getManifestName()}) {
+    const auto Name = StateFile.string();
+    ASSERT_TRUE(SingleEntries.contains(Name)) << Name;
+    ASSERT_TRUE(MergedEntries.contains(Name)) << Name;
+    EXPECT_TRUE(SingleEntries.at(Name) == MergedEntries.at(Name)) << Name << " differs";
+  }
+
+  filesystem::remove_all(TestDir);
+}
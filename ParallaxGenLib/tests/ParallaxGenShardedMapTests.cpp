@@ -0,0 +1,49 @@
+#include "ParallaxGenShardedMap.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(ParallaxGenShardedMapTests, TestGetOrComputeOnceComputesEachKeyOnce) {
+  ParallaxGenShardedMap<int, int> Map;
+
+  constexpr size_t NumThreads = 8;
+  constexpr int NumKeys = 32;
+  atomic<int> Computes = 0;
+  vector<thread> Threads;
+  for (size_t T = 0; T < NumThreads; T++) {
+    Threads.emplace_back([&Map, &Computes]() {
+      for (int Key = 0; Key < NumKeys; Key++) {
+        const int Value = Map.getOrComputeOnce(Key, [&Computes, Key]() {
+          Computes++;
+          // slow enough for the other threads to ask for the same key meanwhile
+          this_thread::sleep_for(chrono::milliseconds(1));
+          return Key * 2;
+        });
+        EXPECT_EQ(Value, Key * 2);
+      }
+    });
+  }
+
+  for (auto &Thread : Threads) {
+    Thread.join();
+  }
+
+  EXPECT_EQ(Computes, NumKeys);
+  EXPECT_EQ(Map.size(), NumKeys);
+}
+
+TEST(ParallaxGenShardedMapTests, TestGetOrComputeOnceDoesNotStoreExceptions) {
+  ParallaxGenShardedMap<int, int> Map;
+
+  EXPECT_THROW(Map.getOrComputeOnce(1, []() -> int { throw runtime_error("read failed"); }), runtime_error);
+  EXPECT_FALSE(Map.find(1).has_value());
+  EXPECT_EQ(Map.getOrComputeOnce(1, []() { return 5; }), 5);
+}
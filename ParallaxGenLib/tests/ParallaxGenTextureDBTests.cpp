@@ -0,0 +1,142 @@
+#include "ParallaxGenTextureDB.hpp"
+#include "ParallaxGenUtil.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <span>
+#include <string>
+
+using namespace std;
+
+namespace {
+auto getTestDir() -> filesystem::path {
+  const auto TestDir = filesystem::temp_directory_path() / "ParallaxGenTextureDBTests";
+  filesystem::remove_all(TestDir);
+  filesystem::create_directories(TestDir);
+  return TestDir;
+}
+
+auto makeMetadata() -> DDSUtil::DDSHeaderInfo {
+  DDSUtil::DDSHeaderInfo Info;
+  Info.Width = 512;
+  Info.Height = 256;
+  Info.MipLevels = 10;
+  Info.MiscFlags2 = 1;
+  Info.Format = 71; // DXGI_FORMAT_BC1_UNORM
+  Info.Dimension = 3;
+  return Info;
+}
+
+void writeDB(const filesystem::path &DBPath, const string &Contents) {
+  ASSERT_TRUE(ParallaxGenUtil::writeFileBytes(DBPath, as_bytes(span(Contents))));
+}
+} // namespace
+
+TEST(ParallaxGenTextureDBTests, TestSaveLoadRoundTrip) {
+  const auto TestDir = getTestDir();
+  const auto DBPath = TestDir / ParallaxGenTextureDB::getDBName();
+
+  const ParallaxGenTextureDB::Source LooseSource{L"", 4096, 1700000000};
+  const ParallaxGenTextureDB::Source BSASource{L"Skyrim - Textures0.bsa", 8192, 1600000000};
+  {
+    ParallaxGenTextureDB DB(DBPath);
+    DB.setMetadata("textures\\rock_m.dds", LooseSource, makeMetadata());
+    DB.setComplexMaterial("textures\\rock_m.dds", LooseSource, true);
+    DB.setComplexMaterial("textures\\wood_m.dds", BSASource, false);
+    DB.save();
+  }
+
+  ParallaxGenTextureDB DB(DBPath);
+  auto Loaded = DB.load();
+  ASSERT_EQ(Loaded.size(), 2);
+  sort(Loaded.begin(), Loaded.end(), [](const auto &A, const auto &B) { return A.first < B.first; });
+
+  const auto &[RockPath, Rock] = Loaded[0];
+  EXPECT_EQ(RockPath, filesystem::path("textures\\rock_m.dds"));
+  EXPECT_TRUE(Rock.TextureSource == LooseSource);
+  ASSERT_TRUE(Rock.Metadata.has_value());
+  EXPECT_EQ(Rock.Metadata->Width, 512);
+  EXPECT_EQ(Rock.Metadata->Height, 256);
+  EXPECT_EQ(Rock.Metadata->Depth, 1);
+  EXPECT_EQ(Rock.Metadata->ArraySize, 1);
+  EXPECT_EQ(Rock.Metadata->MipLevels, 10);
+  EXPECT_EQ(Rock.Metadata->MiscFlags, 0);
+  EXPECT_EQ(Rock.Metadata->MiscFlags2, 1);
+  EXPECT_EQ(Rock.Metadata->Format, 71);
+  EXPECT_EQ(Rock.Metadata->Dimension, 3);
+  EXPECT_EQ(Rock.IsComplexMaterial, true);
+
+  const auto &[WoodPath, Wood] = Loaded[1];
+  EXPECT_EQ(WoodPath, filesystem::path("textures\\wood_m.dds"));
+  EXPECT_TRUE(Wood.TextureSource == BSASource);
+  EXPECT_FALSE(Wood.Metadata.has_value());
+  EXPECT_EQ(Wood.IsComplexMaterial, false);
+
+  filesystem::remove_all(TestDir);
+}
+
+TEST(ParallaxGenTextureDBTests, TestOtherVersionIsDropped) {
+  const auto TestDir = getTestDir();
+  const auto DBPath = TestDir / ParallaxGenTextureDB::getDBName();
+
+  // A version 2 database, its complex material verdicts may come from lower mips
+  writeDB(DBPath,
+          R"({"version":2,"textures":{"textures\\rock_m.dds":{"archive":"","size":4096,"mtime":1,"cm":true}}})");
+
+  ParallaxGenTextureDB DB(DBPath);
+  EXPECT_TRUE(DB.load().empty());
+
+  filesystem::remove_all(TestDir);
+}
+
+TEST(ParallaxGenTextureDBTests, TestCorruptFileIsIgnored) {
+  const auto TestDir = getTestDir();
+  const auto DBPath = TestDir / ParallaxGenTextureDB::getDBName();
+
+  ParallaxGenTextureDB DB(DBPath);
+
+  // Cut off in the middle of a save
+  writeDB(DBPath, R"({"version":3,"textures":{"textures\\rock_m.dds":{"archive":"","si)");
+  EXPECT_NO_THROW(EXPECT_TRUE(DB.load().empty()));
+
+  // Valid JSON with a field of the wrong type
+  writeDB(DBPath, R"({"version":3,"textures":{"textures\\rock_m.dds":{"archive":"","size":"big","mtime":1}}})");
+  EXPECT_NO_THROW(EXPECT_TRUE(DB.load().empty()));
+
+  // Not a database at all
+  writeDB(DBPath, "[1,2,3]");
+  EXPECT_NO_THROW(EXPECT_TRUE(DB.load().empty()));
+
+  filesystem::remove_all(TestDir);
+}
+
+TEST(ParallaxGenTextureDBTests, TestOtherSourceResetsRecord) {
+  const auto TestDir = getTestDir();
+  ParallaxGenTextureDB DB(TestDir / ParallaxGenTextureDB::getDBName());
+
+  const filesystem::path TexPath = "textures\\rock_m.dds";
+  const ParallaxGenTextureDB::Source OldSource{L"", 4096, 1};
+  const ParallaxGenTextureDB::Source NewSource{L"", 4096, 2};
+
+  DB.setMetadata(TexPath, OldSource, makeMetadata());
+  DB.setComplexMaterial(TexPath, OldSource, true);
+
+  // The texture changed on disk, nothing from the old bytes may survive
+  DB.setComplexMaterial(TexPath, NewSource, false);
+  auto Found = DB.find(TexPath);
+  ASSERT_TRUE(Found.has_value());
+  EXPECT_TRUE(Found->TextureSource == NewSource);
+  EXPECT_FALSE(Found->Metadata.has_value());
+  EXPECT_EQ(Found->IsComplexMaterial, false);
+
+  DB.setMetadata(TexPath, OldSource, makeMetadata());
+  Found = DB.find(TexPath);
+  ASSERT_TRUE(Found.has_value());
+  EXPECT_TRUE(Found->TextureSource == OldSource);
+  EXPECT_TRUE(Found->Metadata.has_value());
+  EXPECT_FALSE(Found->IsComplexMaterial.has_value());
+
+  filesystem::remove_all(TestDir);
+}